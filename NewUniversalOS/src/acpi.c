@@ -0,0 +1,272 @@
+#include "acpi.h"
+#include "paging.h"
+#include "klib.h"
+
+#define BDA_EBDA_SEGMENT 0x40E     // Word: real-mode segment of the EBDA
+#define BIOS_ROM_START   0xE0000
+#define BIOS_ROM_END     0x100000
+#define BASE_MEM_LAST_KB 0x9FC00   // Fallback EBDA location for the MP search
+
+// MADT entry types
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_ISO            2      // Interrupt source override
+#define MADT_LAPIC_OVERRIDE 5
+#define MADT_LAPIC_ENABLED  0x1
+#define MADT_PCAT_COMPAT    0x1
+
+// MP configuration table entry types and sizes
+#define MP_PROCESSOR   0
+#define MP_BUS         1
+#define MP_IOAPIC      2
+#define MP_IO_INTR     3
+#define MP_PROCESSOR_SIZE 20
+#define MP_OTHER_SIZE     8
+#define MP_CPU_ENABLED    0x1
+#define MP_IOAPIC_USABLE  0x1
+#define MP_INTR_INT       0        // Vectored interrupt (not NMI/SMI/ExtINT)
+
+typedef struct {
+    char signature[8];   // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_t;
+
+typedef struct {
+    acpi_sdt_t header;   // "APIC"
+    uint32_t lapic_phys;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+    char signature[4];   // "_MP_"
+    uint32_t config;     // Physical address of the configuration table
+    uint8_t length;      // In 16-byte units
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t features[5];
+} __attribute__((packed)) mp_floating_t;
+
+typedef struct {
+    char signature[4];   // "PCMP"
+    uint16_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_phys;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} __attribute__((packed)) mp_config_t;
+
+static uint8_t checksum(const void* p, uint32_t len) {
+    const uint8_t* b = p;
+    uint8_t sum = 0;
+    while (len--) sum += *b++;
+    return sum;
+}
+
+// Firmware tables normally sit in identity-mapped RAM or ROM; anything
+// else goes through the MMIO window (mapped cacheable, read-only use)
+static const void* acpi_map(uint32_t phys, uint32_t len) {
+    if (virt_to_phys(phys) == phys && virt_to_phys(phys + len - 1) == phys + len - 1) {
+        return (const void*)phys;
+    }
+    return (const void*)paging_map_mmio(phys, len, 0);
+}
+
+static const void* scan(uint32_t start, uint32_t end, const char* sig, uint32_t sig_len, uint32_t check_len) {
+    for (uint32_t p = start; p + check_len <= end; p += 16) {
+        if (memcmp((const void*)p, sig, sig_len) == 0 && checksum((const void*)p, check_len) == 0) {
+            return (const void*)p;
+        }
+    }
+    return 0;
+}
+
+// The BIOS data area sits at a low constant address, which GCC would flag
+// as a null-pointer dereference if read through a plain pointer
+static uint32_t ebda_base(void) {
+    uint32_t seg;
+    asm volatile ("movzwl (%1), %0" : "=r"(seg) : "r"(BDA_EBDA_SEGMENT) : "memory");
+    return seg << 4;
+}
+
+static void config_defaults(smp_config_t* cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    for (uint32_t irq = 0; irq < 16; irq++) {
+        cfg->isa_gsi[irq] = irq; // Identity unless overridden
+    }
+}
+
+static void add_cpu(smp_config_t* cfg, uint8_t apic_id) {
+    if (cfg->cpu_count < SMP_MAX_CPUS) {
+        cfg->apic_ids[cfg->cpu_count++] = apic_id;
+    }
+}
+
+static int parse_madt(const acpi_madt_t* madt, smp_config_t* cfg) {
+    config_defaults(cfg);
+    cfg->lapic_phys = madt->lapic_phys;
+    cfg->has_8259 = (madt->flags & MADT_PCAT_COMPAT) != 0;
+    cfg->source = "ACPI";
+
+    const uint8_t* p = (const uint8_t*)(madt + 1);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        switch (p[0]) {
+        case MADT_LAPIC:
+            if (*(const uint32_t*)(p + 4) & MADT_LAPIC_ENABLED) {
+                add_cpu(cfg, p[3]);
+            }
+            break;
+        case MADT_IOAPIC:
+            if (!cfg->ioapic_phys) {
+                cfg->ioapic_phys = *(const uint32_t*)(p + 4);
+                cfg->ioapic_gsi_base = *(const uint32_t*)(p + 8);
+            }
+            break;
+        case MADT_ISO:
+            if (p[2] == 0 && p[3] < 16) { // Bus 0 is ISA
+                cfg->isa_gsi[p[3]] = *(const uint32_t*)(p + 4);
+                cfg->isa_flags[p[3]] = *(const uint16_t*)(p + 8);
+            }
+            break;
+        case MADT_LAPIC_OVERRIDE:
+            if (*(const uint32_t*)(p + 8) == 0) { // Only usable below 4 GB
+                cfg->lapic_phys = *(const uint32_t*)(p + 4);
+            }
+            break;
+        }
+        p += p[1];
+    }
+    return cfg->cpu_count && cfg->ioapic_phys ? 0 : -1;
+}
+
+static int find_madt(smp_config_t* cfg) {
+    uint32_t ebda = ebda_base();
+    const acpi_rsdp_t* rsdp = 0;
+    if (ebda >= 0x80000 && ebda < BIOS_ROM_START) {
+        rsdp = scan(ebda, ebda + 1024, "RSD PTR ", 8, 20);
+    }
+    if (!rsdp) {
+        rsdp = scan(BIOS_ROM_START, BIOS_ROM_END, "RSD PTR ", 8, 20);
+    }
+    if (!rsdp) {
+        return -1;
+    }
+
+    const acpi_sdt_t* rsdt = acpi_map(rsdp->rsdt, sizeof(acpi_sdt_t));
+    if (!rsdt || memcmp(rsdt->signature, "RSDT", 4) != 0) {
+        return -1;
+    }
+    rsdt = acpi_map(rsdp->rsdt, rsdt->length);
+    if (!rsdt || checksum(rsdt, rsdt->length) != 0) {
+        return -1;
+    }
+
+    const uint32_t* tables = (const uint32_t*)(rsdt + 1);
+    uint32_t count = (rsdt->length - sizeof(acpi_sdt_t)) / 4;
+    for (uint32_t i = 0; i < count; i++) {
+        const acpi_sdt_t* h = acpi_map(tables[i], sizeof(acpi_sdt_t));
+        if (!h || memcmp(h->signature, "APIC", 4) != 0) {
+            continue;
+        }
+        const acpi_madt_t* madt = acpi_map(tables[i], h->length);
+        if (madt && checksum(madt, madt->header.length) == 0) {
+            return parse_madt(madt, cfg);
+        }
+    }
+    return -1;
+}
+
+static int parse_mp(const mp_config_t* mpc, smp_config_t* cfg) {
+    config_defaults(cfg);
+    cfg->lapic_phys = mpc->lapic_phys;
+    cfg->source = "MP";
+
+    int isa_bus = -1;
+    uint8_t ioapic_id = 0;
+    const uint8_t* p = (const uint8_t*)(mpc + 1);
+    const uint8_t* end = (const uint8_t*)mpc + mpc->length;
+    for (uint32_t i = 0; i < mpc->entry_count && p < end; i++) {
+        switch (p[0]) {
+        case MP_PROCESSOR:
+            if (p[3] & MP_CPU_ENABLED) {
+                add_cpu(cfg, p[1]);
+            }
+            p += MP_PROCESSOR_SIZE;
+            continue;
+        case MP_BUS:
+            if (memcmp(p + 2, "ISA", 3) == 0) {
+                isa_bus = p[1];
+            }
+            break;
+        case MP_IOAPIC:
+            if ((p[3] & MP_IOAPIC_USABLE) && !cfg->ioapic_phys) {
+                ioapic_id = p[1];
+                cfg->ioapic_phys = *(const uint32_t*)(p + 4);
+            }
+            break;
+        case MP_IO_INTR:
+            // Entries come after the buses and I/O APICs they refer to
+            if (p[1] == MP_INTR_INT && p[4] == isa_bus && p[5] < 16 && p[6] == ioapic_id) {
+                cfg->isa_gsi[p[5]] = p[7];
+                cfg->isa_flags[p[5]] = *(const uint16_t*)(p + 2);
+            }
+            break;
+        }
+        p += MP_OTHER_SIZE;
+    }
+    return cfg->cpu_count && cfg->ioapic_phys ? 0 : -1;
+}
+
+static int find_mp(smp_config_t* cfg) {
+    uint32_t ebda = ebda_base();
+    const mp_floating_t* mpf = 0;
+    if (ebda >= 0x80000 && ebda < BIOS_ROM_START) {
+        mpf = scan(ebda, ebda + 1024, "_MP_", 4, sizeof(mp_floating_t));
+    }
+    if (!mpf) mpf = scan(BASE_MEM_LAST_KB, BASE_MEM_LAST_KB + 1024, "_MP_", 4, sizeof(mp_floating_t));
+    if (!mpf) mpf = scan(BIOS_ROM_START + 0x10000, BIOS_ROM_END, "_MP_", 4, sizeof(mp_floating_t));
+    if (!mpf || !mpf->config) {
+        return -1; // No table, or one of the default configurations, which we do not support
+    }
+
+    const mp_config_t* mpc = acpi_map(mpf->config, sizeof(mp_config_t));
+    if (!mpc || memcmp(mpc->signature, "PCMP", 4) != 0) {
+        return -1;
+    }
+    mpc = acpi_map(mpf->config, mpc->length);
+    if (!mpc || checksum(mpc, mpc->length) != 0) {
+        return -1;
+    }
+    int ret = parse_mp(mpc, cfg);
+    cfg->has_8259 = 1; // MP systems always have them, in PIC or virtual wire mode
+    return ret;
+}
+
+int acpi_find_smp_config(smp_config_t* cfg) {
+    if (find_madt(cfg) == 0 || find_mp(cfg) == 0) {
+        return 0;
+    }
+    return -1;
+}
@@ -0,0 +1,33 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include "smp.h" // For SMP_MAX_CPUS
+
+// Interrupt controller and processor layout, from the ACPI MADT or, on
+// machines without one, the Intel MultiProcessor table.
+
+// Polarity and trigger flags of an interrupt source (same encoding in the
+// MADT and the MP table)
+#define INTI_POLARITY_MASK 0x3
+#define INTI_POLARITY_LOW  0x3
+#define INTI_TRIGGER_MASK  0xC
+#define INTI_TRIGGER_LEVEL 0xC
+
+typedef struct {
+    uint32_t lapic_phys;
+    uint32_t cpu_count;                 // Enabled processors, boot CPU included
+    uint8_t apic_ids[SMP_MAX_CPUS];
+    uint32_t ioapic_phys;               // First I/O APIC; 0 if there is none
+    uint32_t ioapic_gsi_base;
+    uint32_t isa_gsi[16];               // Global system interrupt each ISA IRQ is wired to
+    uint16_t isa_flags[16];             // INTI_* flags of each ISA IRQ (0: bus default)
+    uint8_t has_8259;                   // Dual 8259s are present and must be masked
+    const char* source;                 // "ACPI" or "MP"
+} smp_config_t;
+
+// Returns 0 and fills *cfg, or -1 if neither table was found. Needs paging
+// (tables outside the identity map are mapped into the MMIO window).
+int acpi_find_smp_config(smp_config_t* cfg);
+
+#endif // ACPI_H
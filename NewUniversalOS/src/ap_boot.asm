@@ -0,0 +1,75 @@
+; Application processor trampoline. smp_boot_aps copies everything from
+; ap_trampoline to ap_trampoline_end down to AP_TRAMPOLINE_ADDR, fills in
+; the parameter block and sends a startup IPI pointing there. The AP starts
+; in real mode at that address with CS:IP = (page << 8):0000, switches to
+; protected mode with the kernel GDT, turns on paging with the boot CPU's
+; page directory and calls entry(arg) on its own stack.
+;
+; The code runs at a different address from the one it is linked at, so
+; every absolute reference goes through REL().
+
+%define AP_TRAMPOLINE_ADDR 0x8000 ; Must match smp.c; page aligned, below 1 MB
+%define REL(x) (AP_TRAMPOLINE_ADDR + (x) - ap_trampoline)
+
+%define KERNEL_CODE_SEGMENT 0x08
+%define KERNEL_DATA_SEGMENT 0x10
+%define CR0_PE 0x1
+
+section .rodata
+global ap_trampoline, ap_trampoline_params, ap_trampoline_end
+
+align 16
+bits 16
+ap_trampoline:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    o32 lgdt [REL(params_gdt)]  ; 32-bit base: the GDT lives above 1 MB
+    mov eax, cr0
+    or eax, CR0_PE
+    mov cr0, eax
+    jmp dword KERNEL_CODE_SEGMENT:REL(ap_protected)
+
+bits 32
+ap_protected:
+    mov ax, KERNEL_DATA_SEGMENT
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; Same paging and FPU/SSE setup as the boot CPU. CR4 first, so large
+    ; and global pages are understood before CR0.PG turns paging on.
+    mov eax, [REL(params_cr4)]
+    mov cr4, eax
+    mov eax, [REL(params_cr3)]
+    mov cr3, eax
+    mov eax, [REL(params_cr0)]
+    mov cr0, eax
+
+    mov esp, [REL(params_stack)]
+    xor ebp, ebp                ; Ends the frame-pointer chain for stack walks
+    push dword [REL(params_arg)]
+    mov eax, [REL(params_entry)]
+    call eax                    ; Does not return
+
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; Parameter block, filled in by smp_boot_aps. Layout must match ap_params_t.
+align 4
+ap_trampoline_params:
+params_gdt:    dw 0             ; GDT limit
+               dd 0             ; GDT base
+               dw 0             ; Padding
+params_cr0:    dd 0
+params_cr3:    dd 0
+params_cr4:    dd 0
+params_stack:  dd 0             ; Initial ESP
+params_entry:  dd 0             ; void entry(uint32_t arg)
+params_arg:    dd 0
+ap_trampoline_end:
@@ -0,0 +1,204 @@
+#include "apic.h"
+#include "idt.h"
+#include "gdt.h"  // For GDT_KERNEL_CODE
+#include "paging.h"
+#include "ports.h"
+#include "clock.h"
+#include "klog.h"
+#include "cpu.h"
+
+#define MSR_APIC_BASE        0x1B
+#define APIC_BASE_ENABLE     0x800
+#define CPUID_FEATURE_APIC   (1 << 9) // Leaf 1, EDX
+
+// Local APIC registers (offsets from its base)
+#define LAPIC_ID         0x020
+#define LAPIC_TPR        0x080
+#define LAPIC_EOI        0x0B0
+#define LAPIC_SVR        0x0F0
+#define LAPIC_ESR        0x280
+#define LAPIC_ICR_LOW    0x300
+#define LAPIC_ICR_HIGH   0x310
+#define LAPIC_LVT_TIMER  0x320
+#define LAPIC_LVT_LINT0  0x350
+#define LAPIC_LVT_LINT1  0x360
+#define LAPIC_LVT_ERROR  0x370
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR  0x390
+#define LAPIC_TIMER_DIV  0x3E0
+
+#define LAPIC_SVR_ENABLE     0x100
+#define LAPIC_LVT_MASKED     0x10000
+#define LAPIC_ICR_PENDING    0x1000  // Delivery status: not yet accepted
+#define LAPIC_TIMER_DIV_16   0x3
+#define LAPIC_CALIBRATE_US   10000
+
+// I/O APIC: an index register and a data window
+#define IOAPIC_REGSEL     0x00
+#define IOAPIC_WIN        0x10
+#define IOAPIC_VER        0x01
+#define IOAPIC_REDTBL(n)  (0x10 + 2 * (n))
+#define IOAPIC_MASKED     0x10000
+#define IOAPIC_LEVEL      0x08000
+#define IOAPIC_ACTIVE_LOW 0x02000
+
+#define PIC_MASTER_DATA 0x21
+#define PIC_SLAVE_DATA  0xA1
+
+static volatile uint32_t* lapic = 0;
+static volatile uint32_t* ioapic = 0;
+static uint32_t ioapic_gsi_base = 0;
+static uint32_t ioapic_pins = 0;
+static uint32_t isa_pin[16];      // I/O APIC pin of each ISA IRQ
+static int apic_active = 0;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t v) {
+    lapic[reg / 4] = v;
+}
+
+static uint32_t ioapic_read(uint32_t reg) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WIN / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t v) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WIN / 4] = v;
+}
+
+int apic_enabled(void) {
+    return apic_active;
+}
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr_low) {
+    uint32_t flags = irq_save(); // The two ICR writes must not be split
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr_low);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        cpu_relax();
+    }
+    irq_restore(flags);
+}
+
+void lapic_send_init(uint32_t apic_id) {
+    lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+}
+
+void lapic_send_startup(uint32_t apic_id, uint32_t page) {
+    lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | (page & 0xFF));
+}
+
+static void lapic_error_handler(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+    lapic_write(LAPIC_ESR, 0); // Latch the current errors
+    klog(KLOG_WARN, "apic: LAPIC %u error 0x%02x\n", lapic_id(), lapic_read(LAPIC_ESR));
+    lapic_eoi();
+}
+
+// Raised when an interrupt is withdrawn before it could be delivered.
+// Like 8259 spurious interrupts it must not get an EOI.
+static void lapic_spurious_handler(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+}
+
+void lapic_init_cpu(void) {
+    wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+    lapic_write(LAPIC_TPR, 0); // Accept every priority
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_ERROR_VECTOR);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0); // Back-to-back writes clear it
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_eoi(); // Drop anything left in service by the BIOS
+}
+
+uint32_t lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED); // One-shot, no interrupt
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    clock_delay_us(LAPIC_CALIBRATE_US);
+    uint32_t ticks = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    return (uint32_t)div_u64_u32((uint64_t)ticks * 16 * 1000, LAPIC_CALIBRATE_US);
+}
+
+static void ioapic_set_mask(uint8_t irq, int masked) {
+    if (irq >= 16 || isa_pin[irq] >= ioapic_pins) {
+        return;
+    }
+    uint32_t reg = IOAPIC_REDTBL(isa_pin[irq]);
+    uint32_t v = ioapic_read(reg);
+    ioapic_write(reg, masked ? v | IOAPIC_MASKED : v & ~IOAPIC_MASKED);
+}
+
+void ioapic_mask_irq(uint8_t irq) {
+    ioapic_set_mask(irq, 1);
+}
+
+void ioapic_unmask_irq(uint8_t irq) {
+    ioapic_set_mask(irq, 0);
+}
+
+int apic_init(const smp_config_t* cfg) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & CPUID_FEATURE_APIC) || !cfg->lapic_phys || !cfg->ioapic_phys) {
+        return -1;
+    }
+    lapic = (volatile uint32_t*)paging_map_mmio(cfg->lapic_phys, PAGE_SIZE, PTE_WRITE | PTE_PCD);
+    ioapic = (volatile uint32_t*)paging_map_mmio(cfg->ioapic_phys, PAGE_SIZE, PTE_WRITE | PTE_PCD);
+    if (!lapic || !ioapic) {
+        klog(KLOG_WARN, "apic: could not map the APIC registers\n");
+        return -1;
+    }
+
+    idt_set_gate(LAPIC_ERROR_VECTOR, (uint32_t)isr254, GDT_KERNEL_CODE, 0x8E);
+    idt_set_gate(LAPIC_SPURIOUS_VECTOR, (uint32_t)isr255, GDT_KERNEL_CODE, 0x8E);
+    register_irq_handler(LAPIC_ERROR_VECTOR, lapic_error_handler, 0);
+    register_irq_handler(LAPIC_SPURIOUS_VECTOR, lapic_spurious_handler, 0);
+    lapic_init_cpu();
+
+    // Every ISA IRQ goes to the boot CPU, masked until someone unmasks it,
+    // with the polarity and trigger mode the firmware reported
+    ioapic_gsi_base = cfg->ioapic_gsi_base;
+    ioapic_pins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+    uint32_t dest = lapic_id();
+    for (uint32_t irq = 0; irq < 16; irq++) {
+        isa_pin[irq] = cfg->isa_gsi[irq] - ioapic_gsi_base;
+        if (isa_pin[irq] >= ioapic_pins) {
+            continue;
+        }
+        uint32_t lo = IOAPIC_MASKED | IRQ_VECTOR(irq);
+        if ((cfg->isa_flags[irq] & INTI_POLARITY_MASK) == INTI_POLARITY_LOW) lo |= IOAPIC_ACTIVE_LOW;
+        if ((cfg->isa_flags[irq] & INTI_TRIGGER_MASK) == INTI_TRIGGER_LEVEL) lo |= IOAPIC_LEVEL;
+        ioapic_write(IOAPIC_REDTBL(isa_pin[irq]) + 1, dest << 24);
+        ioapic_write(IOAPIC_REDTBL(isa_pin[irq]), lo);
+    }
+
+    // The 8259s stay remapped (a stray interrupt from them lands on a
+    // harmless vector) but never raise anything again
+    if (cfg->has_8259) {
+        outb(PIC_MASTER_DATA, 0xFF);
+        outb(PIC_SLAVE_DATA, 0xFF);
+    }
+    apic_active = 1;
+    klog(KLOG_INFO, "apic: LAPIC %u at 0x%08x, I/O APIC at 0x%08x with %u pins\n",
+         dest, cfg->lapic_phys, cfg->ioapic_phys, ioapic_pins);
+    return 0;
+}
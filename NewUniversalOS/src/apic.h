@@ -0,0 +1,43 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+#include "acpi.h" // For smp_config_t
+
+// Local APIC of each CPU and the (first) I/O APIC. Once apic_init() has
+// run, ISA IRQs are routed through the I/O APIC to the boot CPU on the same
+// vectors the 8259s used (IRQ_VECTOR(irq)), and the 8259s are masked.
+
+#define LAPIC_ERROR_VECTOR    0xFE
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+// ICR delivery modes (low dword)
+#define LAPIC_ICR_FIXED   0x00000
+#define LAPIC_ICR_INIT    0x00500
+#define LAPIC_ICR_STARTUP 0x00600
+#define LAPIC_ICR_ASSERT  0x04000
+
+// Map the LAPIC and the I/O APIC, mask the 8259s and route every ISA IRQ
+// (masked) to the boot CPU. Returns -1, leaving the 8259s in charge, if the
+// CPU has no APIC.
+int apic_init(const smp_config_t* cfg);
+int apic_enabled(void);
+
+// Enable this CPU's LAPIC (every CPU calls this once, the boot CPU from
+// apic_init) and measure its timer input clock
+void lapic_init_cpu(void);
+uint32_t lapic_timer_calibrate(void); // kHz; runs the timer one-shot for a few ms
+
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+
+// Send an IPI and wait until the LAPIC has accepted it
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr_low);
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_startup(uint32_t apic_id, uint32_t page); // AP starts in real mode at page * 4 KB
+
+// Mask or unmask an ISA IRQ at its I/O APIC pin
+void ioapic_mask_irq(uint8_t irq);
+void ioapic_unmask_irq(uint8_t irq);
+
+#endif // APIC_H
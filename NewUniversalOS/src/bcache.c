@@ -0,0 +1,399 @@
+#include "bcache.h"
+#include "sched.h"
+#include "klib.h"
+#include "klog.h"
+#include "dbgcon.h"
+#include "cpu.h" // For irq_save/irq_restore
+
+#define BCACHE_MAX_IO (BCACHE_RA_MAX + 1) // Blocks per device transfer
+
+// Threads only touch the cache, so irq_save is the lock. It is dropped
+// around device I/O; buffers in flight carry BCACHE_BUSY meanwhile.
+static bcache_buf_t bufs[BCACHE_BUFS];
+static uint32_t nbufs = 0;
+static bcache_buf_t* hash[BCACHE_HASH];
+static bcache_buf_t lru;              // Sentinel: lru.lru_next is the most recently used
+static wait_queue_t waiters = WAIT_QUEUE_INIT; // For a busy buffer or a free one
+static bcache_stats_t stats;
+static int readahead_enabled = 1;     // bcache_bench turns it off for comparison
+
+static uint32_t hash_index(const blockdev_t* dev, uint32_t block) {
+    // Consecutive blocks land in consecutive buckets
+    return (block ^ ((uint32_t)dev >> 6)) & (BCACHE_HASH - 1);
+}
+
+static bcache_buf_t* lookup(const blockdev_t* dev, uint32_t block) {
+    for (bcache_buf_t* b = hash[hash_index(dev, block)]; b; b = b->hash_next) {
+        if (b->dev == dev && b->block == block) {
+            return b;
+        }
+    }
+    return 0;
+}
+
+static void hash_insert(bcache_buf_t* b) {
+    bcache_buf_t** head = &hash[hash_index(b->dev, b->block)];
+    b->hash_next = *head;
+    *head = b;
+}
+
+static void hash_remove(bcache_buf_t* b) {
+    for (bcache_buf_t** p = &hash[hash_index(b->dev, b->block)]; *p; p = &(*p)->hash_next) {
+        if (*p == b) {
+            *p = b->hash_next;
+            return;
+        }
+    }
+}
+
+static void lru_remove(bcache_buf_t* b) {
+    b->lru_prev->lru_next = b->lru_next;
+    b->lru_next->lru_prev = b->lru_prev;
+}
+
+static void lru_push_front(bcache_buf_t* b) {
+    b->lru_next = lru.lru_next;
+    b->lru_prev = &lru;
+    lru.lru_next->lru_prev = b;
+    lru.lru_next = b;
+}
+
+static void lru_push_back(bcache_buf_t* b) {
+    b->lru_prev = lru.lru_prev;
+    b->lru_next = &lru;
+    lru.lru_prev->lru_next = b;
+    lru.lru_prev = b;
+}
+
+// The least recently used buffer nobody holds and no I/O is using
+static bcache_buf_t* find_victim(void) {
+    for (bcache_buf_t* b = lru.lru_prev; b != &lru; b = b->lru_prev) {
+        if (!(b->flags & BCACHE_BUSY)) {
+            return b;
+        }
+    }
+    return 0;
+}
+
+// Take a victim off the LRU list and rename it to (dev, block), busy
+static void claim(bcache_buf_t* b, blockdev_t* dev, uint32_t block, uint8_t flags) {
+    lru_remove(b);
+    if (b->flags & BCACHE_VALID) {
+        hash_remove(b);
+        stats.evictions++;
+    }
+    b->dev = dev;
+    b->block = block;
+    b->flags = BCACHE_BUSY | flags;
+    hash_insert(b);
+}
+
+// Write b and the dirty blocks that follow it in one transfer. Called with
+// interrupts off (flags as saved by the caller); they are back on for the I/O.
+static int writeback_run(bcache_buf_t* b, uint32_t flags) {
+    bcache_buf_t* run[BCACHE_MAX_IO];
+    char* data[BCACHE_MAX_IO];
+    uint32_t n = 0;
+    run[n++] = b;
+    while (n < BCACHE_MAX_IO && b->block + n < b->dev->blocks) {
+        bcache_buf_t* next = lookup(b->dev, b->block + n);
+        if (!next || (next->flags & (BCACHE_DIRTY | BCACHE_BUSY)) != BCACHE_DIRTY) {
+            break;
+        }
+        run[n++] = next;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        run[i]->flags = (run[i]->flags | BCACHE_BUSY) & ~BCACHE_DIRTY; // bdirty during the write marks it again
+        data[i] = run[i]->data;
+    }
+
+    irq_restore(flags);
+    int rc = b->dev->rw(b->dev, b->block, n, data, 1);
+    irq_save();
+
+    for (uint32_t i = 0; i < n; i++) {
+        run[i]->flags &= ~BCACHE_BUSY;
+        if (rc != 0) {
+            run[i]->flags |= BCACHE_DIRTY;
+        }
+    }
+    if (rc == 0) {
+        stats.writebacks += n;
+    }
+    wait_queue_wake_all(&waiters);
+    return rc;
+}
+
+// Pick the read-ahead window for a miss on block: grow it while misses
+// land where the last read ended, drop it otherwise
+static uint32_t readahead_window(blockdev_t* dev, uint32_t block) {
+    if (!readahead_enabled || block != dev->ra_next) {
+        dev->ra_window = 0;
+    } else if (dev->ra_window == 0) {
+        dev->ra_window = BCACHE_RA_MIN;
+    } else {
+        dev->ra_window = dev->ra_window * 2 > BCACHE_RA_MAX ? BCACHE_RA_MAX : dev->ra_window * 2;
+    }
+    return dev->ra_window;
+}
+
+bcache_buf_t* bread(blockdev_t* dev, uint32_t block) {
+    if (block >= dev->blocks) {
+        return 0;
+    }
+    uint32_t flags = irq_save();
+    bcache_buf_t* b;
+    for (;;) {
+        b = lookup(dev, block);
+        if (b) {
+            if (b->flags & BCACHE_BUSY) {
+                wait_queue_sleep(&waiters);
+                continue;
+            }
+            if (b->refs++ == 0) {
+                lru_remove(b);
+            }
+            stats.hits++;
+            if (b->flags & BCACHE_READAHEAD) {
+                b->flags &= ~BCACHE_READAHEAD;
+                stats.ra_hits++;
+            }
+            irq_restore(flags);
+            return b;
+        }
+        b = find_victim();
+        if (!b) {
+            wait_queue_sleep(&waiters); // Every buffer is held or in flight
+            continue;
+        }
+        if (b->flags & BCACHE_DIRTY) {
+            writeback_run(b, flags); // Then look again: things moved while we slept
+            continue;
+        }
+        break;
+    }
+
+    // Miss: read block plus whatever read-ahead we can get clean buffers for
+    bcache_buf_t* run[BCACHE_MAX_IO];
+    char* data[BCACHE_MAX_IO];
+    uint32_t n = 0;
+    claim(b, dev, block, 0);
+    b->refs = 1;
+    run[n++] = b;
+    uint32_t window = readahead_window(dev, block);
+    while (n <= window && block + n < dev->blocks && !lookup(dev, block + n)) {
+        bcache_buf_t* v = find_victim();
+        if (!v || (v->flags & BCACHE_DIRTY)) {
+            break; // Read-ahead never waits for a write-back
+        }
+        claim(v, dev, block + n, BCACHE_READAHEAD);
+        run[n++] = v;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        data[i] = run[i]->data;
+    }
+    dev->ra_next = block + n;
+    stats.misses++;
+    stats.reads++;
+    stats.ra_blocks += n - 1;
+
+    irq_restore(flags);
+    int rc = dev->rw(dev, block, n, data, 0);
+    irq_save();
+
+    for (uint32_t i = 0; i < n; i++) {
+        bcache_buf_t* r = run[i];
+        r->flags &= ~BCACHE_BUSY;
+        if (rc != 0) {
+            hash_remove(r);
+            r->flags = 0;
+        } else {
+            r->flags |= BCACHE_VALID;
+        }
+        if (i > 0) {
+            // Read-ahead blocks start out recently used, or a long scan would evict them unread
+            if (rc == 0) {
+                lru_push_front(r);
+            } else {
+                lru_push_back(r);
+            }
+        }
+    }
+    if (rc != 0) {
+        b->refs = 0;
+        lru_push_back(b);
+        b = 0;
+    }
+    wait_queue_wake_all(&waiters);
+    irq_restore(flags);
+    return b;
+}
+
+void bdirty(bcache_buf_t* b) {
+    // writeback_run may be changing the flags of a held buffer next to its run
+    uint32_t flags = irq_save();
+    b->flags |= BCACHE_DIRTY;
+    irq_restore(flags);
+}
+
+void brelse(bcache_buf_t* b) {
+    uint32_t flags = irq_save();
+    if (--b->refs == 0) {
+        lru_push_front(b);
+        wait_queue_wake_all(&waiters);
+    }
+    irq_restore(flags);
+}
+
+int bcache_sync(blockdev_t* dev) {
+    int rc = 0;
+    uint32_t flags = irq_save();
+    for (uint32_t i = 0; i < nbufs; i++) {
+        bcache_buf_t* b = &bufs[i];
+        if (b->dev != dev || (b->flags & (BCACHE_DIRTY | BCACHE_BUSY)) != BCACHE_DIRTY) {
+            continue;
+        }
+        // Back up to the start of the dirty run so it goes out in one transfer
+        for (uint32_t k = 0; k < BCACHE_RA_MAX && b->block > 0; k++) {
+            bcache_buf_t* prev = lookup(dev, b->block - 1);
+            if (!prev || (prev->flags & (BCACHE_DIRTY | BCACHE_BUSY)) != BCACHE_DIRTY) {
+                break;
+            }
+            b = prev;
+        }
+        if (writeback_run(b, flags) != 0) {
+            rc = -1; // Still dirty; move on rather than retry
+        } else if (b != &bufs[i]) {
+            i--; // bufs[i] was past the end of that run and may still be dirty
+        }
+    }
+    irq_restore(flags);
+    if (rc == 0 && dev->flush) {
+        rc = dev->flush(dev);
+    }
+    return rc;
+}
+
+void bcache_invalidate(blockdev_t* dev) {
+    uint32_t flags = irq_save();
+    for (uint32_t i = 0; i < nbufs; i++) {
+        bcache_buf_t* b = &bufs[i];
+        if (b->dev == dev && b->refs == 0 && (b->flags & (BCACHE_VALID | BCACHE_DIRTY | BCACHE_BUSY)) == BCACHE_VALID) {
+            hash_remove(b);
+            b->flags = 0;
+            lru_remove(b);
+            lru_push_back(b);
+        }
+    }
+    dev->ra_next = 0xFFFFFFFF;
+    dev->ra_window = 0;
+    irq_restore(flags);
+}
+
+void bcache_get_stats(bcache_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
+
+void bcache_reset_stats(void) {
+    uint32_t flags = irq_save();
+    stats = (bcache_stats_t){ 0 };
+    irq_restore(flags);
+}
+
+void bcache_report(void) {
+    bcache_stats_t s;
+    bcache_get_stats(&s);
+    uint32_t lookups = s.hits + s.misses;
+    klog(KLOG_INFO, "bcache: %u hits, %u misses (%u%% hits), %u buffers\n",
+         s.hits, s.misses, lookups ? s.hits * 100 / lookups : 0, nbufs);
+    klog(KLOG_INFO, "bcache: %u blocks read ahead, %u used, %u device reads\n", s.ra_blocks, s.ra_hits, s.reads);
+    klog(KLOG_INFO, "bcache: %u written back, %u evicted\n", s.writebacks, s.evictions);
+}
+
+void bcache_init(void) {
+    lru.lru_next = lru.lru_prev = &lru;
+    for (nbufs = 0; nbufs < BCACHE_BUFS; nbufs++) {
+        bcache_buf_t* b = &bufs[nbufs];
+        b->data = (char*)alloc_pages(0);
+        if (!b->data) {
+            break;
+        }
+        lru_push_back(b);
+    }
+    klog(KLOG_INFO, "bcache: %u buffers of %u bytes\n", nbufs, BCACHE_BLOCK_SIZE);
+    dbgcon_register('b', bcache_report, "log block cache counters");
+}
+
+#ifdef CONFIG_BENCH
+#include "bench.h"
+#include "ide.h"
+
+// Read blocks [0, n) once through the cache and report the hit rate
+static void bench_scan(const char* name, blockdev_t* dev, uint32_t n) {
+    bcache_reset_stats();
+    uint64_t t0 = rdtsc();
+    for (uint32_t i = 0; i < n; i++) {
+        bcache_buf_t* b = bread(dev, i);
+        if (!b) {
+            klog(KLOG_WARN, "bcache bench: %s: read error\n", name);
+            return;
+        }
+        brelse(b);
+    }
+    bench_report(name, n, n, rdtsc() - t0);
+    bcache_stats_t s;
+    bcache_get_stats(&s);
+    klog(KLOG_INFO, "bcache bench: %s %u%% hits, %u read ahead, %u device reads\n",
+         name, s.hits * 100 / n, s.ra_blocks, s.reads);
+}
+
+void bcache_bench(void) {
+    int writable;
+    int drive = ide_bench_drive(&writable);
+    blockdev_t* dev = drive >= 0 ? ide_blockdev(drive) : 0;
+    if (!dev || nbufs == 0) {
+        klog(KLOG_INFO, "bcache bench: no disk, skipped\n");
+        return;
+    }
+    uint32_t fits = nbufs / 2;      // Stays cached between passes
+    uint32_t floods = nbufs * 2;    // Pushes itself out under LRU
+    fits = fits < dev->blocks ? fits : dev->blocks;
+    floods = floods < dev->blocks ? floods : dev->blocks;
+
+    readahead_enabled = 0;
+    bcache_invalidate(dev);
+    bench_scan("bcache.scan_cold_nora", dev, fits);
+    readahead_enabled = 1;
+    bcache_invalidate(dev);
+    bench_scan("bcache.scan_cold", dev, fits);
+    bench_scan("bcache.scan_warm", dev, fits);
+    bcache_invalidate(dev);
+    bench_scan("bcache.scan_big", dev, floods);
+    bench_scan("bcache.rescan_big", dev, floods);
+
+    if (writable) {
+        // Dirty a run of blocks, then time writing them back
+        for (uint32_t i = 0; i < fits; i++) {
+            bcache_buf_t* b = bread(dev, i);
+            if (!b) {
+                return;
+            }
+            b->data[0] ^= 1;
+            bdirty(b);
+            brelse(b);
+        }
+        bcache_reset_stats();
+        uint64_t t0 = rdtsc();
+        int rc = bcache_sync(dev);
+        uint64_t cycles = rdtsc() - t0;
+        bcache_stats_t s;
+        bcache_get_stats(&s);
+        if (rc == 0) {
+            bench_report("bcache.sync", fits, s.writebacks, cycles);
+        }
+    }
+    bcache_report();
+}
+#endif
@@ -0,0 +1,86 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include "pmm.h" // For PAGE_SIZE
+
+// Block cache. A fixed pool of page-sized buffers, found through a hash on
+// (device, block) and recycled in least-recently-used order. Writes only
+// mark a buffer dirty; it goes to the device when it is evicted or on
+// bcache_sync. A miss that continues a sequential run also reads the blocks
+// after it in the same transfer, doubling the read-ahead window on each run
+// up to BCACHE_RA_MAX and dropping it on the first non-sequential miss.
+//
+// Every call may sleep on I/O, so callers must be threads (not the idle
+// thread, not interrupt handlers).
+
+#define BCACHE_BLOCK_SIZE PAGE_SIZE
+#define BCACHE_BUFS       256 // 1 MB of buffers
+#define BCACHE_HASH       512 // Buckets, a power of two
+#define BCACHE_RA_MIN     2   // Window after the first sequential miss
+#define BCACHE_RA_MAX     15  // Blocks read ahead at most; with the missed block, 64 KB per transfer
+
+// A device the cache can sit on. rw moves count blocks (at most
+// BCACHE_RA_MAX + 1) starting at block between the device and bufs[0..count),
+// one BCACHE_BLOCK_SIZE buffer each, and returns 0 or -1 on an I/O error.
+typedef struct blockdev {
+    const char* name;
+    uint32_t blocks;
+    int (*rw)(struct blockdev* dev, uint32_t block, uint32_t count, char* const* bufs, int write);
+    int (*flush)(struct blockdev* dev); // Drain the device's write cache; may be 0
+    void* priv;
+    uint32_t ra_next;   // Block a sequential reader would miss on next (bcache only)
+    uint32_t ra_window; // Current read-ahead in blocks, 0 when not sequential
+} blockdev_t;
+
+typedef struct bcache_buf {
+    blockdev_t* dev;
+    uint32_t block;
+    char* data;
+    uint16_t refs;          // bread holders; only unreferenced buffers sit on the LRU list
+    uint8_t flags;          // BCACHE_*
+    uint8_t reserved;
+    struct bcache_buf* hash_next;
+    struct bcache_buf* lru_prev;
+    struct bcache_buf* lru_next;
+} bcache_buf_t;
+
+#define BCACHE_VALID     0x01 // data holds the block
+#define BCACHE_DIRTY     0x02 // data is newer than the device
+#define BCACHE_BUSY      0x04 // I/O in flight; wait before touching it
+#define BCACHE_READAHEAD 0x08 // Read ahead and not yet asked for
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t ra_hits;      // Hits on blocks brought in by read-ahead
+    uint32_t ra_blocks;    // Blocks read ahead
+    uint32_t reads;        // Device transfers
+    uint32_t writebacks;   // Blocks written back
+    uint32_t evictions;
+} bcache_stats_t;
+
+void bcache_init(void); // Needs kmem and pmm
+
+// Return the buffer holding block, reading it in if needed, or 0 on an I/O
+// error or a block past the end. The buffer stays put until brelse.
+bcache_buf_t* bread(blockdev_t* dev, uint32_t block);
+void bdirty(bcache_buf_t* b); // The caller changed b->data
+void brelse(bcache_buf_t* b);
+
+// Write back every dirty block of dev, merging runs of consecutive blocks
+// into one transfer, then flush the device's write cache. 0 or -1.
+int bcache_sync(blockdev_t* dev);
+
+// Drop every clean, unreferenced block of dev so the next reads go to it
+void bcache_invalidate(blockdev_t* dev);
+
+void bcache_get_stats(bcache_stats_t* out);
+void bcache_reset_stats(void);
+void bcache_report(void); // klog the counters
+
+#ifdef CONFIG_BENCH
+void bcache_bench(void); // Hit rates over repeated scans of the benchmark disk
+#endif
+
+#endif // BCACHE_H
@@ -0,0 +1,149 @@
+#include "bench.h"
+
+#ifdef CONFIG_BENCH
+#include "sched.h"
+#include "clock.h"
+#include "serial.h"
+#include "idt.h"
+#include "ports.h"
+#include "klog.h"
+#include "klib.h"
+#include "pmm.h"
+#include "slab.h"
+#include "paging.h"
+#include "vga_text.h"
+#include "smp.h"
+#include "syscall.h"
+#include "virtcon.h"
+#include "ide.h"
+#include "bcache.h"
+#include "initrd.h"
+
+#define BENCH_PRIORITY     10 // Above the home screen and debug console, below sched_bench's threads
+#define BENCH_SETTLE_NS    (20 * NSEC_PER_MSEC)
+#define BENCH_ROUNDS       5  // Micro-benchmarks report the best round
+#define BENCH_INT_OPS      10000
+#define BENCH_INT_VECTOR   31 // Reserved exception: the CPU never raises it
+#define BENCH_SERIAL_BYTES (64 * 1024)
+#define BENCH_ALLOC_ROUNDS 200000
+
+typedef struct {
+    const char* name;
+    void (*fn)(void);
+} bench_t;
+
+static uint32_t results = 0;
+
+void bench_report(const char* name, uint32_t param, uint32_t ops, uint64_t cycles) {
+    uint64_t per100 = div_u64_u32(cycles * 100, ops ? ops : 1);
+    uint32_t v = per100 > 0xFFFFFFFFULL ? 0xFFFFFFFF : (uint32_t)per100;
+    if (param) {
+        klog(KLOG_INFO, "BENCH %s/%u %u.%02u cycles/op\n", name, param, v / 100, v % 100);
+    } else {
+        klog(KLOG_INFO, "BENCH %s %u.%02u cycles/op\n", name, v / 100, v % 100);
+    }
+    results++;
+}
+
+uint32_t bench_kb_per_sec(uint32_t bytes, uint64_t cycles) {
+    uint64_t us = div_u64_u32(clock_cycles_to_ns(cycles), NSEC_PER_USEC);
+    return us ? (uint32_t)div_u64_u32((uint64_t)bytes * 1000, (uint32_t)us) : 0;
+}
+
+static void bench_int_handler(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+}
+
+// Software interrupt through the whole dispatch path: stub, isr_handler_c,
+// a registered handler and iret
+static void bench_int(void) {
+    register_irq_handler(BENCH_INT_VECTOR, bench_int_handler, 0);
+    uint64_t best = ~0ULL;
+    for (uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+        uint64_t t0 = rdtsc();
+        for (uint32_t i = 0; i < BENCH_INT_OPS; i++) {
+            asm volatile ("int %0" : : "i"(BENCH_INT_VECTOR) : "memory");
+        }
+        uint64_t cycles = rdtsc() - t0;
+        if (cycles < best) best = cycles;
+    }
+    register_irq_handler(BENCH_INT_VECTOR, 0, 0);
+    bench_report("irq.int_roundtrip", 0, BENCH_INT_OPS, best);
+}
+
+// Bytes through the TX ring and out of the UART, measured until the ring
+// is empty again
+static void bench_serial(void) {
+    static const char line[] = "serial bench: filler text to time the transmit path 0123456789\n";
+    const uint32_t len = sizeof(line) - 1;
+    serial_flush();
+    uint32_t sent = 0;
+    uint64_t t0 = rdtsc();
+    while (sent < BENCH_SERIAL_BYTES) {
+        uint32_t done = 0;
+        while (done < len) {
+            done += serial_write(line + done, len - done);
+        }
+        sent += len;
+    }
+    serial_flush();
+    bench_report("serial.tx_byte", 0, sent, rdtsc() - t0);
+}
+
+static void bench_pmm(void) {
+    pmm_stress(BENCH_ALLOC_ROUNDS);
+}
+
+static void bench_kmem(void) {
+    kmem_bench(BENCH_ALLOC_ROUNDS);
+}
+
+static const bench_t benches[] = {
+    { "irq",     bench_int },
+    { "serial",  bench_serial },
+    { "vga",     vga_bench },
+    { "klib",    klib_bench },
+    { "pmm",     bench_pmm },
+    { "kmem",    bench_kmem },
+    { "paging",  paging_bench },
+    { "sched",   sched_bench },
+    { "smp",     smp_bench },
+    { "syscall", syscall_bench },
+    { "virtio",  virtcon_bench },
+    { "ide",     ide_bench },
+    { "bcache",  bcache_bench },
+    { "initrd",  initrd_bench },
+};
+
+// Let the idle thread write out the log so far, so output from one
+// benchmark does not run during the next
+static void bench_settle(void) {
+    do {
+        thread_sleep(BENCH_SETTLE_NS);
+    } while (klog_pending());
+}
+
+static void bench_thread(void* arg) {
+    (void)arg;
+    for (uint32_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        bench_settle();
+        klog(KLOG_INFO, "bench: running %s\n", benches[i].name);
+        benches[i].fn();
+    }
+    bench_settle();
+    klog(KLOG_INFO, "BENCH-END %u results, %u log records lost\n", results, klog_lost());
+    bench_settle();
+    serial_flush();
+
+    // QEMU exits with status 1 ((0 << 1) | 1); without the device this does nothing
+    outb(BENCH_EXIT_PORT, 0);
+    klog(KLOG_INFO, "bench: done (no isa-debug-exit device)\n");
+}
+
+void bench_start(void) {
+    if (!thread_create("bench", bench_thread, 0, BENCH_PRIORITY)) {
+        klog(KLOG_WARN, "bench: could not start the benchmark thread\n");
+    }
+}
+#endif
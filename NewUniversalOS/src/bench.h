@@ -0,0 +1,37 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include "cpu.h"      // For rdtsc
+
+// Benchmark mode (make BENCH=1). Once the kernel is up, a thread runs the
+// benchmarks listed in bench.c one after another and then exits QEMU
+// through the isa-debug-exit device. Every result is a log line
+//   BENCH <name>[/<param>] <cycles>.<hundredths> cycles/op
+// which tools/benchcmp.py picks out of the serial output; make bench
+// compares them against tools/bench_baseline.txt.
+
+#define BENCH_EXIT_PORT 0xF4 // isa-debug-exit iobase (see the Makefile)
+
+#ifdef CONFIG_BENCH
+// Report ops operations that took cycles in total. name must be a string
+// literal; a non-zero param (sizes, counts) is appended after a slash.
+void bench_report(const char* name, uint32_t param, uint32_t ops, uint64_t cycles);
+// Throughput of bytes moved in cycles, in KB/s (1000 bytes), for logging
+uint32_t bench_kb_per_sec(uint32_t bytes, uint64_t cycles);
+
+// Run the benchmarks on their own thread. Needs the scheduler, the timer
+// wheel and interrupts enabled.
+void bench_start(void);
+
+// Time one call made during boot, e.g. BENCH_ONCE("boot.idt_init", idt_init())
+#define BENCH_ONCE(name, call) do { \
+        uint64_t bench_t0 = rdtsc(); \
+        call; \
+        bench_report(name, 0, 1, rdtsc() - bench_t0); \
+    } while (0)
+#else
+#define BENCH_ONCE(name, call) call
+#endif
+
+#endif // BENCH_H
@@ -2,26 +2,417 @@ bits 16 ; We are in 16-bit real mode
 
 org 0x7c00 ; BIOS loads our bootloader at this address
 
+; Disk layout: [stage 1 (1 sector)][stage 2 (STAGE2_SECTORS)][kernel.bin ...][initrd ...]
+%define STAGE2_SECTORS   16
+%define STAGE2_ADDR      0x7E00
+%define KERNEL_LBA       (1 + STAGE2_SECTORS)
+
+; Kernel header (see entry.asm); image_size is stamped in by the Makefile
+%define KERNEL_LOAD_ADDR 0x100000
+%define KERNEL_MAGIC     0x4B534F55 ; 'UOSK'
+%define KHDR_MAGIC       0
+%define KHDR_IMAGE_SIZE  12
+%define KHDR_MEM_END     16
+%define KHDR_ENTRY       20
+%define KHDR_FLAGS       24
+%define KHDR_PAYLOAD     28         ; LZ4 images: compressed bytes after the header
+%define KHDR_UNPACKED    32         ; LZ4 images: size once decompressed
+%define KHDR_SIZE        64
+%define KHDR_FLAG_LZ4    0x1
+
+; Initrd header (see initrd.h); the image starts at the sector after the kernel
+%define INITRD_MAGIC     0x49534F55 ; 'UOSI'
+%define IRD_MAGIC        0
+%define IRD_IMAGE_SIZE   12
+
+; Sectors are read into a bounce buffer below 1 MB and then moved above 1 MB
+; from unreal mode. 127 sectors is the largest count every EDD BIOS accepts.
+%define BOUNCE_SEG       0x1000
+%define BOUNCE_ADDR      0x10000
+%define BATCH_SECTORS    127
+
+; boot_info_t handed to kmain in EBX (see bootinfo.h)
+%define BOOT_INFO_ADDR   0x1000
+%define BOOT_INFO_SIZE   64
+%define BOOT_INFO_MAGIC  0x49544F42 ; 'BOTI'
+%define BI_MAGIC         0
+%define BI_BOOT_DRIVE    4
+%define BI_KERNEL_SIZE   8
+%define BI_TSC_BOOT      16
+%define BI_TSC_LOADED    24
+%define BI_LZ4_PACKED    32
+%define BI_LZ4_UNPACKED  36
+%define BI_LZ4_CYCLES    40
+%define BI_E820_COUNT    48
+%define BI_E820_MAP      52
+%define BI_INITRD_ADDR   56
+%define BI_INITRD_SIZE   60
+
+; BIOS memory map entries (base, length, type, ACPI attributes) for the
+; kernel's page allocator, stored right behind boot_info_t
+%define E820_MAP_ADDR    0x1100
+%define E820_ENTRY_SIZE  24
+%define E820_MAX_ENTRIES 64
+%define SMAP_SIGNATURE   0x534D4150 ; 'SMAP'
+
+; ---------------------------------------------------------------------------
+; Stage 1: boot sector. Loads stage 2 right behind itself and jumps to it.
+; ---------------------------------------------------------------------------
 start:
-    ; Switch to VGA graphics mode 13h (320x200, 256 colors)
-    mov ah, 0x00    ; Set video mode function
-    mov al, 0x13    ; Mode 13h
-    int 0x10        ; Call BIOS video interrupt
-
-    ; Fill screen with blue (color code 1)
-    mov ax, 0xA000
-    mov es, ax          ; ES points to video memory segment A000h
-    xor di, di          ; DI = 0 (start offset in video memory)
-    mov cx, 320*200     ; Number of pixels (320*200 = 64000 bytes)
-    mov al, 0x01        ; Color blue (palette index 1)
-    rep stosb           ; Fill CX bytes at ES:[DI] with AL, inc DI, dec CX
-
-    ; After filling screen, proceed to enable A20 line and other setup
-    jmp enable_a20
+    jmp 0x0000:stage1_main  ; Normalise CS:IP to 0000:7C00
+
+stage1_main:
+    cli
+    xor ax, ax
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov sp, 0x7c00          ; Stack grows down from just below the boot sector
+    sti
+    cld
+
+    mov [boot_drive], dl    ; BIOS passes the boot drive in DL
+    rdtsc                   ; Boot timestamp, reported to the kernel in boot_info
+    mov [tsc_start], eax
+    mov [tsc_start + 4], edx
+
+    ; Stage 2 sits on cylinder 0, head 0 (sectors 2..) on both floppies and
+    ; hard disks, so a plain CHS read is enough here.
+    mov ax, 0x0200 | STAGE2_SECTORS ; AH=02h read, AL=sector count
+    mov cx, 0x0002          ; Cylinder 0, sector 2
+    xor dh, dh              ; Head 0
+    mov dl, [boot_drive]    ; (rdtsc clobbered EDX)
+    mov bx, STAGE2_ADDR
+    int 0x13
+    jc disk_error
+    jmp stage2_main
+
+disk_error:
+    mov si, msg_disk_error
+    jmp fatal
+
+; Print the NUL-terminated string at DS:SI and halt
+fatal:
+    lodsb
+    test al, al
+    jz halt
+    mov ah, 0x0E            ; BIOS teletype output
+    mov bx, 0x000F          ; Page 0, white (colour is used in graphics modes)
+    int 0x10
+    jmp fatal
 
 halt:
     cli             ; Clear interrupts
     hlt             ; Halt the processor
+    jmp halt
+
+msg_disk_error: db "Disk read error", 0
+boot_drive:     db 0
+tsc_start:      dq 0
+
+; Padding and magic number
+times 510 - ($-$$) db 0 ; Pad remainder of boot sector with 0s
+dw 0xaa55             ; Boot signature
+
+; ---------------------------------------------------------------------------
+; Stage 2: video mode, A20, kernel load, protected mode.
+; ---------------------------------------------------------------------------
+stage2_main:
+    ; Switch to VGA graphics mode 13h (320x200, 256 colors)
+    mov ah, 0x00    ; Set video mode function
+    mov al, 0x13    ; Mode 13h
+    int 0x10        ; Call BIOS video interrupt
+
+    ; Fill screen with blue (color code 1)
+    push es
+    mov ax, 0xA000
+    mov es, ax          ; ES points to video memory segment A000h
+    xor di, di          ; DI = 0 (start offset in video memory)
+    mov cx, 320*200     ; Number of pixels (320*200 = 64000 bytes)
+    mov al, 0x01        ; Color blue (palette index 1)
+    rep stosb           ; Fill CX bytes at ES:[DI] with AL, inc DI, dec CX
+    pop es
+
+    call enable_a20
+    call disk_init
+
+    ; The first kernel sector holds the header with the image size
+    mov eax, KERNEL_LBA
+    mov cx, 1
+    call read_to_bounce
+    mov ax, BOUNCE_SEG
+    mov fs, ax
+    cmp dword [fs:KHDR_MAGIC], KERNEL_MAGIC
+    jne bad_kernel
+    mov eax, [fs:KHDR_IMAGE_SIZE]
+    test eax, eax
+    jz bad_kernel           ; Header was never stamped
+    mov [kernel_size], eax
+    mov ebx, [fs:KHDR_MEM_END]
+    mov [kernel_mem_end], ebx
+    add eax, 511
+    shr eax, 9              ; Bytes -> sectors
+    mov [sectors_left], eax
+
+    ; A compressed image is staged above everything the kernel will occupy
+    ; (image and .bss) and expanded to the load address from protected mode
+    test dword [fs:KHDR_FLAGS], KHDR_FLAG_LZ4
+    jz .load
+    mov byte [kernel_lz4], 1
+    mov eax, [fs:KHDR_UNPACKED]
+    add eax, KERNEL_LOAD_ADDR
+    cmp eax, [fs:KHDR_MEM_END]
+    jae .staging_ok
+    mov eax, [fs:KHDR_MEM_END]
+.staging_ok:
+    add eax, 0xFFF
+    and eax, ~0xFFF
+    mov [load_dest], eax
+    mov [lz4_src], eax
+
+.load:
+    call load_sectors
+    call load_initrd
+
+    ; Fill in boot_info_t for the kernel
+    mov di, BOOT_INFO_ADDR
+    mov cx, BOOT_INFO_SIZE / 2
+    xor ax, ax
+    rep stosw
+    mov dword [BOOT_INFO_ADDR + BI_MAGIC], BOOT_INFO_MAGIC
+    movzx eax, byte [boot_drive]
+    mov [BOOT_INFO_ADDR + BI_BOOT_DRIVE], eax
+    mov eax, [kernel_size]
+    mov [BOOT_INFO_ADDR + BI_KERNEL_SIZE], eax
+    mov eax, [tsc_start]
+    mov [BOOT_INFO_ADDR + BI_TSC_BOOT], eax
+    mov eax, [tsc_start + 4]
+    mov [BOOT_INFO_ADDR + BI_TSC_BOOT + 4], eax
+    rdtsc
+    mov [BOOT_INFO_ADDR + BI_TSC_LOADED], eax
+    mov [BOOT_INFO_ADDR + BI_TSC_LOADED + 4], edx
+    mov eax, [initrd_addr]
+    mov [BOOT_INFO_ADDR + BI_INITRD_ADDR], eax
+    mov eax, [initrd_size]
+    mov [BOOT_INFO_ADDR + BI_INITRD_SIZE], eax
+    call detect_memory
+
+    jmp load_gdt
+
+bad_kernel:
+    mov si, msg_bad_kernel
+    jmp fatal
+
+; Read [sectors_left] sectors from LBA [load_lba] to [load_dest] above 1 MB,
+; in BATCH_SECTORS chunks through the bounce buffer. Advances both.
+load_sectors:
+    mov eax, [sectors_left]
+    test eax, eax
+    jz .done
+    cmp eax, BATCH_SECTORS
+    jbe .batch_ok
+    mov eax, BATCH_SECTORS
+.batch_ok:
+    mov [batch_sectors], ax
+    sub [sectors_left], eax
+    mov cx, ax
+    mov eax, [load_lba]
+    call read_to_bounce
+
+    call enter_unreal       ; BIOS calls may have reset the segment limits
+    movzx ecx, word [batch_sectors]
+    add [load_lba], ecx
+    mov edi, [load_dest]
+    shl ecx, 7              ; Sectors -> dwords (512 / 4)
+    lea eax, [edi + ecx*4]
+    mov [load_dest], eax
+    mov esi, BOUNCE_ADDR
+    a32 rep movsd           ; DS:ESI -> ES:EDI, both with 4 GB limits
+    jmp load_sectors
+.done:
+    ret
+
+; Load the initrd that follows the kernel on disk (the Makefile always
+; appends one, possibly empty) to the first page above both the kernel's
+; .bss and a staged LZ4 image. The kernel keeps it out of its free memory.
+load_initrd:
+    mov eax, [load_lba]
+    mov cx, 1
+    call read_to_bounce
+    mov ax, BOUNCE_SEG
+    mov fs, ax
+    cmp dword [fs:IRD_MAGIC], INITRD_MAGIC
+    jne .done               ; Leave initrd_size at 0
+    mov eax, [fs:IRD_IMAGE_SIZE]
+    mov [initrd_size], eax
+    add eax, 511
+    shr eax, 9
+    mov [sectors_left], eax
+    mov eax, [load_dest]    ; End of the kernel or of the staged LZ4 image
+    cmp eax, [kernel_mem_end]
+    jae .above_bss
+    mov eax, [kernel_mem_end]
+.above_bss:
+    add eax, 0xFFF
+    and eax, ~0xFFF
+    mov [load_dest], eax
+    mov [initrd_addr], eax
+    call load_sectors
+.done:
+    ret
+
+; Collect the INT 15h E820 memory map at E820_MAP_ADDR and record it in
+; boot_info. Without E820 support the count stays 0 and the kernel falls back
+; to a conservative default.
+detect_memory:
+    push es
+    xor ax, ax
+    mov es, ax
+    mov di, E820_MAP_ADDR
+    xor ebx, ebx            ; Continuation value, 0 for the first entry
+    xor si, si              ; Entries kept
+.next:
+    mov dword [es:di + 20], 1 ; Entries without ACPI attributes count as valid
+    mov eax, 0xE820
+    mov edx, SMAP_SIGNATURE
+    mov ecx, E820_ENTRY_SIZE
+    int 0x15
+    jc .done                ; Unsupported, or past the last entry
+    cmp eax, SMAP_SIGNATURE
+    jne .done
+    test byte [es:di + 20], 1
+    jz .skip                ; BIOS says ignore this entry
+    mov eax, [es:di + 8]
+    or eax, [es:di + 12]
+    jz .skip                ; Zero-length entry
+    inc si
+    add di, E820_ENTRY_SIZE
+    cmp si, E820_MAX_ENTRIES
+    jae .done
+.skip:
+    test ebx, ebx
+    jnz .next
+.done:
+    movzx eax, si
+    mov [BOOT_INFO_ADDR + BI_E820_COUNT], eax
+    mov dword [BOOT_INFO_ADDR + BI_E820_MAP], E820_MAP_ADDR
+    pop es
+    ret
+
+; Read CX sectors starting at LBA EAX into the bounce buffer
+read_to_bounce:
+    push es
+    push bx
+    push word BOUNCE_SEG
+    pop es
+    xor bx, bx
+    call disk_read
+    pop bx
+    pop es
+    ret
+
+; Probe for INT 13h extensions; fall back to CHS geometry if they are missing
+disk_init:
+    mov ah, 0x41
+    mov bx, 0x55AA
+    mov dl, [boot_drive]
+    int 0x13
+    jc .no_edd
+    cmp bx, 0xAA55
+    jne .no_edd
+    test cx, 1              ; Bit 0: packet (AH=42h) access supported
+    jz .no_edd
+    mov byte [edd_present], 1
+    ret
+.no_edd:
+    push es
+    xor di, di
+    mov es, di              ; Some BIOSes want ES:DI = 0 for AH=08h
+    mov ah, 0x08
+    mov dl, [boot_drive]
+    int 0x13
+    pop es
+    jc disk_error
+    and cl, 0x3F
+    mov [sectors_per_track], cl
+    inc dh
+    mov [head_count], dh
+    ret
+
+; Read CX sectors starting at LBA EAX into ES:BX
+disk_read:
+    pushad
+    push es
+    cmp byte [edd_present], 0
+    je .chs
+
+    ; One extended read (AH=42h) for the whole batch
+    mov [dap_count], cx
+    mov [dap_offset], bx
+    mov [dap_segment], es
+    mov [dap_lba], eax
+    mov si, dap
+    mov dl, [boot_drive]
+    mov ah, 0x42
+    int 0x13
+    jc disk_error
+    jmp .done
+
+    ; No extensions: one AH=02h read per sector
+.chs:
+    push eax
+    push cx
+    xor edx, edx
+    movzx ecx, byte [sectors_per_track]
+    div ecx                 ; EAX = track, EDX = sector index
+    inc dl
+    mov cl, dl              ; Sector (1-based) in CL bits 0-5
+    xor edx, edx
+    movzx esi, byte [head_count]
+    div esi                 ; EAX = cylinder, EDX = head
+    mov dh, dl              ; Head
+    mov ch, al              ; Cylinder bits 0-7
+    shl ah, 6
+    or cl, ah               ; Cylinder bits 8-9 in CL bits 6-7
+    mov dl, [boot_drive]
+    mov ax, 0x0201          ; Read one sector
+    int 0x13
+    jc disk_error
+    mov ax, es
+    add ax, 512 / 16        ; Advance the buffer by one sector
+    mov es, ax
+    pop cx
+    pop eax
+    inc eax
+    loop .chs
+
+.done:
+    pop es
+    popad
+    ret
+
+; Load DS/ES with 4 GB limits and drop back to real mode ("unreal mode"),
+; so 32-bit addresses can reach memory above 1 MB.
+enter_unreal:
+    push eax
+    push ds
+    push es
+    cli
+    lgdt [gdt_descriptor]
+    mov eax, cr0
+    or al, 1
+    mov cr0, eax
+    mov ax, 0x10            ; Flat data segment: loads the 4 GB limit
+    mov ds, ax
+    mov es, ax
+    mov eax, cr0
+    and al, 0xFE
+    mov cr0, eax
+    pop es                  ; Back to real-mode bases, the limits stay
+    pop ds
+    sti
+    pop eax
+    ret
 
 ; Enable A20 Line using Keyboard Controller
 enable_a20:
@@ -36,7 +427,7 @@ enable_a20:
 
     call    a20_wait_input_empty    ; Wait for input buffer to be empty
     ; A20 line should now be enabled.
-    jmp     load_gdt                ; Jump to load GDT (or next step)
+    ret
 
 a20_wait_input_empty:
     in      al, 0x64                ; Read status port
@@ -45,17 +436,18 @@ a20_wait_input_empty:
     ret
 
 load_gdt:
+    cli                     ; Disable interrupts
     lgdt [gdt_descriptor] ; Load GDT register
 
-    cli                     ; Disable interrupts
     mov eax, cr0            ; Load CR0
     or eax, 0x1             ; Set PE bit (bit 0)
     mov cr0, eax            ; Write back to CR0 - now in protected mode!
-    
+
     jmp 0x08:protected_mode_entry ; Far jump to 32-bit code segment (selector 0x08)
 
 
 ; Global Descriptor Table (GDT)
+align 8
 gdt_start:
     ; Null Descriptor (8 bytes)
     dq 0x0000000000000000
@@ -88,6 +480,33 @@ gdt_descriptor:
     dw gdt_end - gdt_start - 1 ; GDT Limit (size of GDT - 1)
     dd gdt_start               ; GDT Base Address (linear address of gdt_start)
 
+; INT 13h extended read disk address packet
+align 4
+dap:
+    db 0x10                 ; Packet size
+    db 0                    ; Reserved
+dap_count:   dw 0           ; Sectors to read
+dap_offset:  dw 0           ; Buffer offset
+dap_segment: dw 0           ; Buffer segment
+dap_lba:     dq 0           ; Starting LBA
+
+edd_present:       db 0
+sectors_per_track: db 0
+head_count:        db 0
+batch_sectors:     dw 0
+kernel_size:       dd 0
+kernel_mem_end:    dd 0            ; End of .bss, from the kernel header
+initrd_addr:       dd 0
+initrd_size:       dd 0
+kernel_lz4:        db 0
+lz4_src:           dd 0            ; Where the compressed image was staged
+sectors_left:      dd 0
+load_lba:          dd KERNEL_LBA
+load_dest:         dd KERNEL_LOAD_ADDR
+
+msg_bad_kernel: db "Bad kernel header", 0
+msg_lz4_error:  db "LZ4: bad kernel image", 13, 10, 0
+
 
 protected_mode_entry:
     bits 32         ; We are now in 32-bit Protected Mode
@@ -97,29 +516,117 @@ protected_mode_entry:
     mov ds, ax
     mov es, ax
     ; fs and gs are not strictly necessary for this simple example but good practice
-    mov fs, ax 
+    mov fs, ax
     mov gs, ax
     mov ss, ax
+    mov esp, 0x7c00         ; Temporary stack; the kernel switches to its own
 
-    ; Kernel copy routine
-    ; Source: 0x7E00 (where kernel is loaded after bootloader)
-    ; Destination: 0x100000 (where kernel will run)
-    ; Size: 8KB = 8192 bytes = 2048 dwords (double words)
+    cmp byte [kernel_lz4], 0
+    je .start_kernel
+    call unpack_kernel
 
-    mov esi, 0x7E00         ; Source address
-    mov edi, 0x100000       ; Destination address
-    mov ecx, 2048           ; Number of dwords to copy (8192 bytes / 4 bytes/dword)
-    
-    cld                     ; Clear direction flag (so LODSD/STOSD increment ESI/EDI)
+.start_kernel:
+    ; The kernel image is already at 0x100000. Jump to the entry point from
+    ; its header with EBX pointing at boot_info_t.
+    mov ebx, BOOT_INFO_ADDR
+    jmp dword [KERNEL_LOAD_ADDR + KHDR_ENTRY]
 
-copy_loop:
-    lodsd                   ; Load dword from [ds:esi] into eax, increment esi
-    stosd                   ; Store dword from eax into [es:edi], increment edi
-    loop copy_loop          ; Decrement ecx, loop if ecx != 0
+; Expand the staged LZ4 image to KERNEL_LOAD_ADDR and record sizes and the
+; cycles spent in boot_info. The kernel reports them over serial.
+unpack_kernel:
+    mov ebx, [lz4_src]
+    mov eax, [ebx + KHDR_PAYLOAD]
+    mov [BOOT_INFO_ADDR + BI_LZ4_PACKED], eax
+    lea esi, [ebx + KHDR_SIZE]
+    mov edi, KERNEL_LOAD_ADDR
 
-    ; Jump to the kernel's entry point at 0x100000
-    jmp 0x100000
+    rdtsc
+    push edx
+    push eax
+    mov edx, esi
+    add edx, [BOOT_INFO_ADDR + BI_LZ4_PACKED] ; End of the compressed data
+    call lz4_decompress
+    rdtsc
+    sub eax, [esp]
+    sbb edx, [esp + 4]
+    add esp, 8
+    mov [BOOT_INFO_ADDR + BI_LZ4_CYCLES], eax
+    mov [BOOT_INFO_ADDR + BI_LZ4_CYCLES + 4], edx
 
-; Padding and magic number
-times 510 - ($-$$) db 0 ; Pad remainder of boot sector with 0s
-dw 0xaa55             ; Boot signature
\ No newline at end of file
+    sub edi, KERNEL_LOAD_ADDR
+    mov [BOOT_INFO_ADDR + BI_LZ4_UNPACKED], edi
+    mov ebx, [lz4_src]
+    cmp edi, [ebx + KHDR_UNPACKED]
+    jne .corrupt
+    ret
+.corrupt:
+    mov esi, msg_lz4_error
+.print:
+    lodsb                   ; No BIOS any more: poll COM1 directly
+    test al, al
+    jz .stop
+    mov ah, al
+    mov dx, 0x3FD           ; COM1 line status
+.wait_tx:
+    in al, dx
+    test al, 0x20
+    jz .wait_tx
+    mov al, ah
+    mov dx, 0x3F8
+    out dx, al
+    jmp .print
+.stop:
+    cli
+    hlt
+    jmp .stop
+
+; Decode one LZ4 block (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md)
+; In: ESI = compressed data, EDX = end of compressed data, EDI = output
+; Out: EDI = end of output. Clobbers EAX, EBX, ECX, ESI.
+lz4_decompress:
+.sequence:
+    cmp esi, edx
+    jae .done
+    movzx ebx, byte [esi]   ; Token: literal length << 4 | match length - 4
+    inc esi
+
+    mov ecx, ebx
+    shr ecx, 4
+    cmp ecx, 15
+    jne .copy_literals
+.literal_length:
+    movzx eax, byte [esi]   ; Saturated nibble: add bytes until one is < 255
+    inc esi
+    add ecx, eax
+    cmp al, 255
+    je .literal_length
+.copy_literals:
+    rep movsb
+    cmp esi, edx
+    jae .done               ; The last sequence has literals only
+
+    movzx eax, word [esi]   ; Match offset
+    add esi, 2
+    mov ecx, ebx
+    and ecx, 0x0F
+    cmp ecx, 15
+    jne .copy_match
+.match_length:
+    movzx ebx, byte [esi]
+    inc esi
+    add ecx, ebx
+    cmp bl, 255
+    je .match_length
+.copy_match:
+    add ecx, 4              ; Minimum match length
+    push esi
+    mov esi, edi
+    sub esi, eax
+    rep movsb               ; Byte copy, so overlapping matches repeat correctly
+    pop esi
+    jmp .sequence
+.done:
+    ret
+
+; Pad stage 2 to its fixed sector count; the kernel starts at KERNEL_LBA
+times (1 + STAGE2_SECTORS) * 512 - ($-$$) db 0
@@ -0,0 +1,41 @@
+#ifndef BOOTINFO_H
+#define BOOTINFO_H
+
+#include <stdint.h>
+
+#define BOOT_INFO_MAGIC 0x49544F42 // 'BOTI'
+
+// Filled in by boot.asm stage 2 and passed to kmain. Offsets must match the
+// BI_* definitions in boot.asm.
+typedef struct {
+    uint32_t magic;
+    uint32_t boot_drive;         // BIOS drive number we booted from
+    uint32_t kernel_size;        // Bytes of kernel.bin read from disk
+    uint32_t reserved;
+    uint64_t tsc_boot;           // TSC at the start of stage 1
+    uint64_t tsc_kernel_loaded;  // TSC once the kernel image was read from disk
+    uint32_t lz4_packed_size;    // Compressed payload bytes (0 if the image was not compressed)
+    uint32_t lz4_unpacked_size;  // Bytes produced by the stage 2 decompressor
+    uint64_t lz4_cycles;         // TSC cycles spent decompressing
+    uint32_t e820_count;         // Entries in the BIOS memory map (0 if E820 is unsupported)
+    uint32_t e820_map;           // Physical address of the e820_entry_t array
+    uint32_t initrd_addr;        // Physical address of the initrd image, page aligned
+    uint32_t initrd_size;        // Image bytes (0 if there is none)
+} __attribute__((packed)) boot_info_t;
+
+// BIOS INT 15h E820 memory map entry
+#define E820_MAX_ENTRIES 64
+#define E820_USABLE      1
+#define E820_RESERVED    2
+#define E820_ACPI        3 // ACPI reclaimable
+#define E820_NVS         4
+#define E820_BAD         5
+
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t acpi;               // ACPI 3.0 extended attributes
+} __attribute__((packed)) e820_entry_t;
+
+#endif // BOOTINFO_H
@@ -0,0 +1,53 @@
+#include "clock.h"
+#include "pit.h"  // For pit_calibrate_tsc
+#include "cpu.h"
+
+#define CLOCK_CALIBRATE_MS 50
+
+static uint64_t tsc_base = 0;  // TSC value that corresponds to ktime 0
+static uint32_t tsc_khz = 0;
+
+// ns = (cycles * mult) >> shift
+static uint32_t clock_mult = 0;
+static uint32_t clock_shift = 0;
+
+void clock_init(void) {
+    uint64_t hz = pit_calibrate_tsc(CLOCK_CALIBRATE_MS);
+    tsc_khz = (uint32_t)div_u64_u32(hz, 1000);
+
+    // Pick the largest shift (best precision) whose multiplier fits 32 bits
+    uint32_t shift = 32;
+    uint64_t mult;
+    while ((mult = div_u64_u32((uint64_t)NSEC_PER_MSEC << shift, tsc_khz)) > 0xFFFFFFFFULL) {
+        shift--;
+    }
+    clock_mult = (uint32_t)mult;
+    clock_shift = shift;
+    tsc_base = rdtsc();
+}
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return mul_u64_u32_shr(cycles, clock_mult, clock_shift);
+}
+
+uint64_t clock_tsc_to_ns(uint64_t tsc) {
+    if (tsc < tsc_base) {
+        return 0; // Taken before clock_init
+    }
+    return clock_cycles_to_ns(tsc - tsc_base);
+}
+
+uint64_t ktime_ns(void) {
+    return clock_tsc_to_ns(rdtsc());
+}
+
+uint32_t clock_tsc_khz(void) {
+    return tsc_khz;
+}
+
+void clock_delay_us(uint32_t us) {
+    uint64_t end = rdtsc() + div_u64_u32((uint64_t)us * tsc_khz, 1000);
+    while (rdtsc() < end) {
+        cpu_relax();
+    }
+}
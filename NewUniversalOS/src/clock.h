@@ -0,0 +1,19 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+#define NSEC_PER_SEC  1000000000U
+#define NSEC_PER_MSEC 1000000U
+#define NSEC_PER_USEC 1000U
+
+// TSC clocksource. clock_init calibrates the TSC against PIT channel 2 and
+// must run before anything asks for the time (ktime_ns returns 0 until then).
+void clock_init(void);
+uint64_t ktime_ns(void);                // Nanoseconds since clock_init
+uint64_t clock_tsc_to_ns(uint64_t tsc); // Convert an absolute rdtsc() value
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+uint32_t clock_tsc_khz(void);
+void clock_delay_us(uint32_t us);       // Busy-wait on the TSC (safe with interrupts off)
+
+#endif // CLOCK_H
@@ -0,0 +1,120 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+#define EFLAGS_IF 0x200 // Interrupt enable flag
+
+// Save EFLAGS and disable interrupts. Pair with irq_restore().
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile ("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Restore the interrupt flag saved by irq_save()
+static inline void irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+        asm volatile ("sti" : : : "memory");
+    }
+}
+
+static inline int irq_enabled(void) {
+    uint32_t flags;
+    asm volatile ("pushfl; popl %0" : "=r"(flags));
+    return (flags & EFLAGS_IF) != 0;
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    asm volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+static inline uint32_t read_cr0(void) {
+    uint32_t v;
+    asm volatile ("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(uint32_t v) {
+    asm volatile ("mov %0, %%cr0" : : "r"(v) : "memory");
+}
+
+static inline uint32_t read_cr2(void) {
+    uint32_t v;
+    asm volatile ("mov %%cr2, %0" : "=r"(v));
+    return v;
+}
+
+static inline uint32_t read_cr3(void) {
+    uint32_t v;
+    asm volatile ("mov %%cr3, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr3(uint32_t v) {
+    asm volatile ("mov %0, %%cr3" : : "r"(v) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t v;
+    asm volatile ("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(uint32_t v) {
+    asm volatile ("mov %0, %%cr4" : : "r"(v) : "memory");
+}
+
+static inline void invlpg(uint32_t addr) {
+    asm volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t v) {
+    asm volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)v), "d"((uint32_t)(v >> 32)) : "memory");
+}
+
+// Spin-wait hint: lets a sibling hyperthread run and saves power
+static inline void cpu_relax(void) {
+    asm volatile ("pause" : : : "memory");
+}
+
+// 64-by-32 bit division without libgcc's __udivdi3 (we link with -nostdlib)
+static inline uint64_t div_u64_u32(uint64_t n, uint32_t d) {
+    uint32_t hi = (uint32_t)(n >> 32);
+    uint32_t q_hi = hi / d;
+    uint32_t r = hi % d;
+    uint32_t q_lo;
+    asm ("divl %3" : "=a"(q_lo), "=d"(r) : "a"((uint32_t)n), "rm"(d), "1"(r));
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+// (a * mul) >> shift without overflowing 64 bits; shift must be <= 32
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, unsigned int shift) {
+    uint32_t a_hi = (uint32_t)(a >> 32);
+    uint64_t ret = ((uint64_t)(uint32_t)a * mul) >> shift;
+    if (a_hi) {
+        ret += ((uint64_t)a_hi * mul) << (32 - shift);
+    }
+    return ret;
+}
+
+// Index of the lowest set bit of a non-zero 64-bit value. __builtin_ctzll
+// would pull in libgcc's __ctzdi2 on i386.
+static inline unsigned int ctz64(uint64_t v) {
+    uint32_t lo = (uint32_t)v;
+    return lo ? (unsigned int)__builtin_ctz(lo) : 32 + (unsigned int)__builtin_ctz((uint32_t)(v >> 32));
+}
+
+#endif // CPU_H
@@ -0,0 +1,131 @@
+#include "dbgcon.h"
+#include "serial.h"
+#include "sched.h"
+#include "clock.h"
+#include "klib.h"
+#include "klog.h"
+#include "cpu.h"
+
+#define DBGCON_PRIORITY     24 // Just above idle
+#define DBGCON_POLL_NS      (100 * NSEC_PER_MSEC)
+#define DBGCON_DRAIN_NS     NSEC_PER_MSEC
+#define DBGCON_MAX_DEFERRED 4
+#define DBGCON_RECORD_OVERHEAD 10
+
+typedef struct {
+    char key;
+    dbgcon_fn_t fn;
+    const char* help;
+} dbgcon_cmd_t;
+
+typedef struct {
+    char key;              // 0: slot free
+    uint64_t when;         // ktime_ns() to run at
+} dbgcon_deferred_t;
+
+static dbgcon_cmd_t commands[DBGCON_MAX_COMMANDS];
+static uint32_t command_count = 0;
+static dbgcon_deferred_t deferred[DBGCON_MAX_DEFERRED];
+static uint8_t rec_buf[DBGCON_RECORD_MAX + DBGCON_RECORD_OVERHEAD];
+
+int dbgcon_register(char key, dbgcon_fn_t fn, const char* help) {
+    if (command_count == DBGCON_MAX_COMMANDS || key == '?') {
+        return -1;
+    }
+    for (uint32_t i = 0; i < command_count; i++) {
+        if (commands[i].key == key) {
+            return -1;
+        }
+    }
+    commands[command_count++] = (dbgcon_cmd_t){ key, fn, help };
+    return 0;
+}
+
+static void dbgcon_run(char key) {
+    if (key == '?') {
+        for (uint32_t i = 0; i < command_count; i++) {
+            klog(KLOG_INFO, "dbgcon: '%c' %s\n", commands[i].key, commands[i].help);
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < command_count; i++) {
+        if (commands[i].key == key) {
+            commands[i].fn();
+            return;
+        }
+    }
+}
+
+void dbgcon_run_after(char key, uint64_t ns) {
+    uint32_t flags = irq_save();
+    for (uint32_t i = 0; i < DBGCON_MAX_DEFERRED; i++) {
+        if (!deferred[i].key) {
+            deferred[i].key = key;
+            deferred[i].when = ktime_ns() + ns;
+            break;
+        }
+    }
+    irq_restore(flags);
+}
+
+static void dbgcon_thread(void* arg) {
+    (void)arg;
+    for (;;) {
+        char key;
+        while (serial_read(&key, 1)) {
+            dbgcon_run(key);
+        }
+        uint64_t now = ktime_ns();
+        for (uint32_t i = 0; i < DBGCON_MAX_DEFERRED; i++) {
+            if (deferred[i].key && now >= deferred[i].when) {
+                key = deferred[i].key;
+                deferred[i].key = 0;
+                dbgcon_run(key);
+            }
+        }
+        thread_sleep(DBGCON_POLL_NS);
+    }
+}
+
+void dbgcon_start(void) {
+    if (!thread_create("dbgcon", dbgcon_thread, 0, DBGCON_PRIORITY)) {
+        klog(KLOG_WARN, "dbgcon: could not start the command thread\n");
+    }
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+    return p + 4;
+}
+
+void dbgcon_send_record(uint32_t magic, uint8_t type, const void* payload, uint32_t len) {
+    uint8_t* p = put32(rec_buf, magic);
+    p[0] = type;
+    p[1] = 0;
+    p[2] = (uint8_t)len;
+    p[3] = (uint8_t)(len >> 8);
+    memcpy(p + 4, payload, len);
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        sum += p[4 + i];
+    }
+    p[4 + len] = (uint8_t)sum;
+    p[5 + len] = (uint8_t)(sum >> 8);
+
+    // Wait for room for the whole record. The only other writer is the
+    // idle thread's klog drain, which cannot run between the check and the
+    // write, so the space is still there when serial_write() runs.
+    uint32_t total = len + DBGCON_RECORD_OVERHEAD;
+    serial_stats_t st;
+    for (;;) {
+        serial_get_stats(&st);
+        if (SERIAL_TX_BUF_SIZE - st.tx_pending >= total) {
+            break;
+        }
+        thread_sleep(DBGCON_DRAIN_NS);
+    }
+    serial_write((const char*)rec_buf, total);
+}
@@ -0,0 +1,28 @@
+#ifndef DBGCON_H
+#define DBGCON_H
+
+#include <stdint.h>
+
+// Single-key debug commands typed on the serial port. A low-priority thread
+// polls for them and runs the handler, which may sleep. '?' lists them.
+
+#define DBGCON_MAX_COMMANDS 16
+#define DBGCON_RECORD_MAX   1024 // Payload bytes per binary record
+
+typedef void (*dbgcon_fn_t)(void);
+
+// Returns 0, or -1 if the key is taken or the table is full
+int dbgcon_register(char key, dbgcon_fn_t fn, const char* help);
+void dbgcon_start(void); // Needs the scheduler and timers
+
+// Run a command once, as if it had been typed, ns from now
+void dbgcon_run_after(char key, uint64_t ns);
+
+// Binary dumps share the serial port with klog. Each record goes out in a
+// single serial_write(), so log lines can only come between records:
+//   u32 magic, u8 type, u8 0, u16 length, payload, u16 sum of payload bytes
+// all little-endian. Call from thread context: it sleeps while the TX ring
+// drains. len is at most DBGCON_RECORD_MAX.
+void dbgcon_send_record(uint32_t magic, uint8_t type, const void* payload, uint32_t len);
+
+#endif // DBGCON_H
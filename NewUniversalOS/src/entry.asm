@@ -0,0 +1,56 @@
+bits 32
+
+; Kernel image header and entry point. The linker script places
+; .kernel_header at the very start of kernel.bin (0x100000), where the boot
+; loader looks for it. Field offsets must match boot.asm.
+
+%define KERNEL_MAGIC 0x4B534F55 ; 'UOSK'
+%define KERNEL_HEADER_VERSION 1
+%define KERNEL_STACK_SIZE 16384
+
+extern kmain
+extern _kernel_start, _bss_start, _kernel_end ; From linker.ld
+
+section .kernel_header
+global kernel_header
+kernel_header:
+    dd KERNEL_MAGIC             ; 0:  magic
+    dd KERNEL_HEADER_VERSION    ; 4:  header version
+    dd _kernel_start            ; 8:  load address
+    dd 0                        ; 12: image size in bytes (stamped by tools/mkkernel.py)
+    dd _kernel_end              ; 16: end of .bss (first free byte after the kernel)
+    dd _start                   ; 20: entry point
+    dd 0                        ; 24: flags (bit 0: LZ4 payload follows, set by mkkernel.py --lz4)
+    dd 0                        ; 28: compressed payload size (LZ4 images only)
+    dd 0                        ; 32: decompressed size (LZ4 images only)
+    times 64 - ($ - kernel_header) db 0 ; Reserved
+
+section .text
+global _start
+; Entered from boot.asm in protected mode with EBX = boot_info_t*
+_start:
+    cld
+    ; The loader only copies the file contents, so clear .bss ourselves
+    ; (the kernel stack lives there too, so do this before using it)
+    mov edi, _bss_start
+    mov ecx, _kernel_end
+    sub ecx, edi
+    xor eax, eax
+    rep stosb
+
+    mov esp, kernel_stack_top
+    xor ebp, ebp                ; Ends the frame-pointer chain for stack walks
+    push ebx                    ; kmain(boot_info_t* boot_info)
+    call kmain
+
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+section .bss
+align 16
+global kernel_stack, kernel_stack_top ; The idle thread's stack, for bounds checks
+kernel_stack:
+    resb KERNEL_STACK_SIZE
+kernel_stack_top:
@@ -0,0 +1,64 @@
+#include "gdt.h"
+#include "smp.h"
+
+#define GDT_ENTRIES (GDT_TSS_BASE + SMP_MAX_CPUS)
+
+#define GDT_ACCESS_CODE 0x9A // Present, DPL 0, code, readable
+#define GDT_ACCESS_DATA 0x92 // Present, DPL 0, data, writable
+#define GDT_ACCESS_USER 0x60 // DPL 3, or'ed into the above
+#define GDT_ACCESS_TSS  0x89 // Present, DPL 0, available 32-bit TSS
+#define GDT_GRAN_4K     0xC0 // 4 KB granularity, 32-bit
+#define GDT_GRAN_BYTE   0x40 // Byte granularity, 32-bit
+
+static gdt_entry_t gdt[GDT_ENTRIES] __attribute__((aligned(8)));
+static tss_t tss[SMP_MAX_CPUS];
+gdt_ptr_t gdt_descriptor;
+
+static void gdt_set(uint32_t i, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    gdt[i].limit_low = (uint16_t)limit;
+    gdt[i].base_low = (uint16_t)base;
+    gdt[i].base_mid = (uint8_t)(base >> 16);
+    gdt[i].access = access;
+    gdt[i].granularity = gran | ((limit >> 16) & 0x0F);
+    gdt[i].base_high = (uint8_t)(base >> 24);
+}
+
+void gdt_load_cpu(uint32_t cpu) {
+    asm volatile ("lgdt %0" : : "m"(gdt_descriptor));
+    asm volatile ("ljmp %0, $1f\n1:" : : "i"(GDT_KERNEL_CODE));
+    asm volatile ("mov %0, %%ds\n"
+                  "mov %0, %%es\n"
+                  "mov %0, %%fs\n"
+                  "mov %0, %%ss\n"
+                  "mov %1, %%gs"
+                  : : "r"(GDT_KERNEL_DATA), "r"(GDT_PERCPU(cpu)) : "memory");
+    asm volatile ("ltr %w0" : : "r"(GDT_TSS(cpu)));
+}
+
+void gdt_set_kernel_stack(uint32_t esp0) {
+    tss[cpu_index()].esp0 = esp0;
+}
+
+uint32_t* gdt_kernel_stack_slot(uint32_t cpu) {
+    return &tss[cpu].esp0;
+}
+
+void gdt_init(void) {
+    gdt_set(0, 0, 0, 0, 0);
+    gdt_set(1, 0, 0xFFFFF, GDT_ACCESS_CODE, GDT_GRAN_4K);
+    gdt_set(2, 0, 0xFFFFF, GDT_ACCESS_DATA, GDT_GRAN_4K);
+    gdt_set(3, 0, 0xFFFFF, GDT_ACCESS_CODE | GDT_ACCESS_USER, GDT_GRAN_4K);
+    gdt_set(4, 0, 0xFFFFF, GDT_ACCESS_DATA | GDT_ACCESS_USER, GDT_GRAN_4K);
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        percpu[cpu].self = &percpu[cpu];
+        percpu[cpu].index = cpu;
+        gdt_set(GDT_PERCPU_BASE + cpu, (uint32_t)&percpu[cpu], sizeof(percpu_t) - 1,
+                GDT_ACCESS_DATA, GDT_GRAN_BYTE);
+        tss[cpu].ss0 = GDT_KERNEL_DATA;
+        tss[cpu].iomap_base = sizeof(tss_t);
+        gdt_set(GDT_TSS_BASE + cpu, (uint32_t)&tss[cpu], sizeof(tss_t) - 1, GDT_ACCESS_TSS, 0);
+    }
+    gdt_descriptor.limit = sizeof(gdt) - 1;
+    gdt_descriptor.base = (uint32_t)gdt;
+    gdt_load_cpu(0);
+}
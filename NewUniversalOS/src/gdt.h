@@ -0,0 +1,62 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+#include "smp.h" // For SMP_MAX_CPUS
+
+// Kernel GDT, replacing the boot loader's. The first three entries match
+// the loader's, so the selectors stay the same. The ring-3 segments follow
+// them, in the order SYSENTER/SYSEXIT derive them from the kernel code
+// selector. Then comes one data segment per CPU, based at that CPU's
+// percpu_t and loaded into GS, and one TSS per CPU.
+
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE   0x1B // Index 3, RPL 3
+#define GDT_USER_DATA   0x23 // Index 4, RPL 3
+#define GDT_PERCPU_BASE 5    // Index of CPU 0's GS segment
+#define GDT_PERCPU(cpu) ((GDT_PERCPU_BASE + (cpu)) * 8)
+#define GDT_TSS_BASE    (GDT_PERCPU_BASE + SMP_MAX_CPUS) // Index of CPU 0's TSS
+#define GDT_TSS(cpu)    ((GDT_TSS_BASE + (cpu)) * 8)
+
+typedef struct {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t  base_mid;
+    uint8_t  access;      // P, DPL, S, type
+    uint8_t  granularity; // G, D/B, limit 16-19
+    uint8_t  base_high;
+} __attribute__((packed)) gdt_entry_t;
+
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) gdt_ptr_t;
+
+// Only the ring-0 stack fields are used: there is no hardware task switching
+typedef struct {
+    uint32_t prev_task;
+    uint32_t esp0;        // Stack the CPU switches to on entry from ring 3
+    uint32_t ss0;
+    uint32_t unused[22];  // esp1 through the LDT selector
+    uint16_t trap;
+    uint16_t iomap_base;  // Past the limit: no I/O permission bitmap
+} tss_t; // 104 bytes; every field is naturally aligned
+
+extern gdt_ptr_t gdt_descriptor; // For the AP trampoline
+
+// Build the GDT and load it on the boot CPU. Must run before anything
+// reads per-CPU data (trace_cpu(), this_cpu()).
+void gdt_init(void);
+
+// Load the GDT and this CPU's segments, GS and the task register included
+void gdt_load_cpu(uint32_t cpu);
+
+// Kernel stack for the next entry from ring 3 on this CPU. The scheduler
+// sets it to the top of each thread's stack as it switches the thread in.
+void gdt_set_kernel_stack(uint32_t esp0);
+
+// Where a CPU's TSS keeps that stack pointer, for SYSENTER (see syscall.asm)
+uint32_t* gdt_kernel_stack_slot(uint32_t cpu);
+
+#endif // GDT_H
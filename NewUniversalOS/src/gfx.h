@@ -0,0 +1,44 @@
+#ifndef GFX_H
+#define GFX_H
+
+#include <stdint.h>
+
+// 8-bit indexed raster graphics. Drawing goes to an off-screen back buffer;
+// every change made there is recorded as a damaged rectangle, and
+// gfx_flip() copies only those rectangles to the framebuffer.
+
+#define GFX_MODE13_FB     0xA0000 // 320x200x8 framebuffer set up by boot.asm
+#define GFX_MODE13_WIDTH  320
+#define GFX_MODE13_HEIGHT 200
+#define GFX_MAX_DAMAGE    16      // Rectangles tracked before they are merged into one
+
+typedef struct {
+    int32_t x, y;
+    int32_t w, h;
+} gfx_rect_t;
+
+typedef struct {
+    uint8_t* pixels;
+    int32_t width, height;
+    int32_t pitch;         // Bytes from one row to the next
+} gfx_surface_t;
+
+// Use the framebuffer at fb (already mapped, e.g. GFX_MODE13_FB or a linear
+// VBE framebuffer mapped with map_page) and allocate a back buffer of the
+// same size. Returns 0 on success, -1 if out of memory.
+int gfx_init(uint8_t* fb, int32_t width, int32_t height, int32_t pitch);
+gfx_surface_t* gfx_back_buffer(void);
+
+// Drawing is clipped to the surface. On the back buffer it also damages
+// the area drawn.
+void gfx_fill_rect(gfx_surface_t* s, int32_t x, int32_t y, int32_t w, int32_t h, uint8_t color);
+void gfx_blit(gfx_surface_t* dst, int32_t dx, int32_t dy,
+              const gfx_surface_t* src, int32_t sx, int32_t sy, int32_t w, int32_t h);
+
+// Intersection of a and b in out; returns 0 if they do not overlap
+int gfx_intersect(const gfx_rect_t* a, const gfx_rect_t* b, gfx_rect_t* out);
+
+void gfx_damage(const gfx_rect_t* r); // Mark back buffer pixels changed behind gfx_*'s back
+uint32_t gfx_flip(void);              // Copy the damage to the screen; returns pixels copied
+
+#endif // GFX_H
@@ -0,0 +1,93 @@
+#include "home.h"
+#include "gfx.h"
+#include "sched.h"
+#include "clock.h"
+#include "klog.h"
+#include "cpu.h"
+
+#define HOME_FRAME_NS      (NSEC_PER_SEC / 60)
+#define HOME_PRIORITY      20  // Below the default, above idle
+#define HOME_REPORT_FRAMES 600 // Log frame times every 10 s
+
+// Palette indices (default VGA palette)
+#define COLOR_GREEN      2
+#define COLOR_RED        4
+#define COLOR_LIGHT_GRAY 7
+#define COLOR_DARK_GRAY  8
+#define COLOR_WHITE      15
+
+typedef struct {
+    gfx_rect_t rect;
+    uint8_t color;
+} home_item_t;
+
+// Painted in order, later items on top
+static const home_item_t layout[] = {
+    { {   0,   0, 320,  20 }, COLOR_LIGHT_GRAY }, // Status bar
+    { {   0,  20, 320, 130 }, COLOR_DARK_GRAY  }, // Main content area
+    { {   0, 150, 320,  50 }, COLOR_LIGHT_GRAY }, // Dock
+    { {  20,  30,  40,  40 }, COLOR_RED        }, // Icon 1 (placeholder app)
+    { {  70,  30,  40,  40 }, COLOR_GREEN      }, // Icon 2 (placeholder app)
+};
+
+// Activity indicator sliding along the status bar, so every frame has
+// something to repaint
+#define ACTIVITY_W    16
+#define ACTIVITY_H    4
+#define ACTIVITY_Y    8
+#define ACTIVITY_STEP 2
+
+// Repaint the static layout inside area only
+static void home_repaint(gfx_surface_t* s, const gfx_rect_t* area) {
+    for (uint32_t i = 0; i < sizeof(layout) / sizeof(layout[0]); i++) {
+        gfx_rect_t r;
+        if (gfx_intersect(&layout[i].rect, area, &r)) {
+            gfx_fill_rect(s, r.x, r.y, r.w, r.h, layout[i].color);
+        }
+    }
+}
+
+static void home_thread(void* arg) {
+    (void)arg;
+    gfx_surface_t* s = gfx_back_buffer();
+    gfx_rect_t screen = { 0, 0, s->width, s->height };
+
+    uint64_t t0 = rdtsc();
+    home_repaint(s, &screen);
+    uint32_t pixels = gfx_flip();
+    klog(KLOG_INFO, "home: full redraw of %u pixels in %u us\n",
+         pixels, (uint32_t)div_u64_u32(clock_cycles_to_ns(rdtsc() - t0), NSEC_PER_USEC));
+
+    gfx_rect_t activity = { 0, ACTIVITY_Y, ACTIVITY_W, ACTIVITY_H };
+    uint64_t total = 0;
+    uint32_t max = 0, frames = 0, frame_pixels = 0;
+    for (;;) {
+        t0 = rdtsc();
+        // Uncover the old indicator position, then draw the new one
+        home_repaint(s, &activity);
+        activity.x += ACTIVITY_STEP;
+        if (activity.x >= s->width) {
+            activity.x = 0;
+        }
+        gfx_fill_rect(s, activity.x, activity.y, activity.w, activity.h, COLOR_WHITE);
+        frame_pixels += gfx_flip();
+
+        uint32_t cycles = (uint32_t)(rdtsc() - t0);
+        total += cycles;
+        if (cycles > max) max = cycles;
+        if (++frames == HOME_REPORT_FRAMES) {
+            klog(KLOG_INFO, "home: %u frames, avg %u ns, max %u ns, %u pixels flipped per frame\n",
+                 frames, (uint32_t)clock_cycles_to_ns(div_u64_u32(total, frames)),
+                 (uint32_t)clock_cycles_to_ns(max), frame_pixels / frames);
+            total = 0;
+            max = frames = frame_pixels = 0;
+        }
+        thread_sleep(HOME_FRAME_NS);
+    }
+}
+
+void home_start(void) {
+    if (!thread_create("home", home_thread, 0, HOME_PRIORITY)) {
+        klog(KLOG_WARN, "home: could not start the home screen thread\n");
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef HOME_H
+#define HOME_H
+
+// The graphical home screen: status bar, content area, dock and app icons.
+// A thread draws it once in full and then only repaints what changes each
+// frame, logging frame times as it goes. Needs gfx_init() and the scheduler.
+void home_start(void);
+
+#endif // HOME_H
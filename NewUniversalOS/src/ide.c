@@ -0,0 +1,585 @@
+#include "ide.h"
+#include "idt.h"    // For register_irq_handler
+#include "ports.h"
+#include "sched.h"
+#include "timer.h"
+#include "clock.h"
+#include "paging.h" // For virt_to_phys
+#include "klib.h"
+#include "klog.h"
+#include "dbgcon.h"
+#include "cpu.h"
+
+// Compatibility-mode task file and control ports
+#define ATA_PRIMARY_CMD    0x1F0
+#define ATA_PRIMARY_CTRL   0x3F6
+#define ATA_SECONDARY_CMD  0x170
+#define ATA_SECONDARY_CTRL 0x376
+
+// Task file registers, from the command block base
+#define ATA_REG_DATA    0
+#define ATA_REG_ERROR   1
+#define ATA_REG_COUNT   2
+#define ATA_REG_LBA0    3
+#define ATA_REG_LBA1    4
+#define ATA_REG_LBA2    5
+#define ATA_REG_DEVICE  6
+#define ATA_REG_STATUS  7 // Reading it acknowledges INTRQ
+#define ATA_REG_COMMAND 7
+
+#define ATA_DEVICE_LBA   0xE0 // LBA addressing; bit 4 picks the slave
+#define ATA_CTRL_SRST    0x04
+#define ATA_STATUS_ERR   0x01
+#define ATA_STATUS_DRQ   0x08
+#define ATA_STATUS_DF    0x20
+#define ATA_STATUS_BSY   0x80
+
+#define ATA_CMD_READ_PIO      0x20
+#define ATA_CMD_READ_PIO_EXT  0x24
+#define ATA_CMD_READ_DMA_EXT  0x25
+#define ATA_CMD_WRITE_PIO     0x30
+#define ATA_CMD_WRITE_PIO_EXT 0x34
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_DMA      0xC8
+#define ATA_CMD_WRITE_DMA     0xCA
+#define ATA_CMD_FLUSH         0xE7
+#define ATA_CMD_FLUSH_EXT     0xEA
+#define ATA_CMD_IDENTIFY      0xEC
+
+#define ATA_LBA28_LIMIT 0x10000000u
+
+// IDENTIFY words
+#define ID_CAPABILITIES  49
+#define ID_CAP_DMA       (1u << 8)
+#define ID_CAP_LBA       (1u << 9)
+#define ID_MODEL         27 // 20 words, bytes swapped
+#define ID_LBA28_SECTORS 60
+#define ID_COMMAND_SETS  83
+#define ID_CMD_LBA48     (1u << 10)
+#define ID_LBA48_SECTORS 100
+
+// Bus-master registers, per channel (the secondary's are 8 bytes on)
+#define BM_COMMAND 0
+#define BM_STATUS  2
+#define BM_PRDT    4
+#define BM_CHANNEL_STRIDE 8
+
+#define BM_CMD_START     0x01
+#define BM_CMD_READ      0x08 // Device to memory
+#define BM_STATUS_ERROR  0x02 // Write one to clear
+#define BM_STATUS_IRQ    0x04 // Write one to clear
+
+#define PRD_EOT 0x8000 // Last entry of the table
+
+#define IDE_BAR_BUS_MASTER 4
+#define IDE_TIMEOUT_NS     (2ULL * NSEC_PER_SEC)
+
+typedef struct {
+    uint32_t addr;   // Physical; the region may not cross a 64 KB boundary
+    uint16_t bytes;  // 0 means 64 KB
+    uint16_t flags;
+} prd_t;
+
+typedef struct {
+    uint16_t cmd;
+    uint16_t ctrl;
+    uint16_t bm;                // Bus-master register base, 0 if no DMA
+    uint8_t irq;
+    uint8_t busy;               // A thread owns the channel
+    prd_t* prd;                 // One page: up to IDE_MAX_SECTORS * 512 bytes in 4 KB entries
+    volatile uint8_t dma_active;
+    volatile uint8_t done;      // Set by the IRQ handler
+    volatile uint8_t timed_out; // Set by the timeout timer
+    volatile uint8_t bm_status; // Bus-master status at completion
+    wait_queue_t done_wq;       // The thread waiting for the transfer
+    wait_queue_t busy_wq;       // Threads waiting for the channel
+} ide_channel_t;
+
+typedef struct {
+    ide_channel_t* ch;
+    uint8_t slave;
+    uint8_t present;
+    uint8_t lba48;
+    uint8_t dma;        // Cleared for good after a failed DMA transfer
+    uint32_t sectors;   // Capped at 2^32 - 1
+    char model[41];
+    blockdev_t bdev;
+} ide_drive_t;
+
+typedef struct {
+    uint32_t dma_ops;
+    uint32_t pio_ops;
+    uint32_t dma_errors;
+    uint32_t pio_errors;
+    uint32_t irqs;
+} ide_stats_t;
+
+static const pci_id_t ide_ids[] = {
+    { 0x8086, 0x1230 }, // PIIX
+    { 0x8086, 0x7010 }, // PIIX3 (QEMU's pc machine)
+    { 0x8086, 0x7111 }, // PIIX4
+    { PCI_ID_END, PCI_ID_END },
+};
+
+static const char* const drive_names[IDE_MAX_DRIVES] = { "ide0", "ide1", "ide2", "ide3" };
+
+static ide_channel_t channels[2];
+static ide_drive_t drives[IDE_MAX_DRIVES];
+static ide_stats_t stats;
+static int dma_allowed = 1; // ide_bench clears it to time PIO on a DMA drive
+
+// 400 ns for the drive to post its status after a select or a command
+static void ata_delay(const ide_channel_t* ch) {
+    for (int i = 0; i < 4; i++) {
+        inb(ch->ctrl);
+    }
+}
+
+// Poll the alternate status (which leaves INTRQ alone) until BSY clears,
+// then for DRQ if need_drq. Returns 0, or -1 on an error or a timeout.
+static int ata_poll(const ide_channel_t* ch, int need_drq) {
+    uint64_t deadline = ktime_ns() + IDE_TIMEOUT_NS;
+    for (;;) {
+        uint8_t st = inb(ch->ctrl);
+        if (!(st & ATA_STATUS_BSY)) {
+            if (st & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+                return -1;
+            }
+            if (!need_drq || (st & ATA_STATUS_DRQ)) {
+                return 0;
+            }
+        }
+        if (ktime_ns() > deadline) {
+            return -1;
+        }
+        cpu_relax();
+    }
+}
+
+static void ata_reset(ide_channel_t* ch) {
+    outb(ch->ctrl, ATA_CTRL_SRST);
+    clock_delay_us(5);
+    outb(ch->ctrl, 0); // Also clears nIEN: the drive interrupts
+    clock_delay_us(2000);
+    ata_poll(ch, 0);
+}
+
+static void ata_select(const ide_drive_t* d, uint8_t lba_high) {
+    outb(d->ch->cmd + ATA_REG_DEVICE, ATA_DEVICE_LBA | (d->slave << 4) | (lba_high & 0x0F));
+    ata_delay(d->ch);
+}
+
+// Select the drive and load the task file. LBA48 only when the range needs it.
+static int ata_command(const ide_drive_t* d, uint32_t lba, uint32_t count, uint8_t cmd28, uint8_t cmd48) {
+    const ide_channel_t* ch = d->ch;
+    int ext = d->lba48 && lba + count > ATA_LBA28_LIMIT;
+    ata_select(d, ext ? 0 : (uint8_t)(lba >> 24));
+    if (ata_poll(ch, 0) != 0) {
+        return -1;
+    }
+    if (ext) {
+        // High bytes first: each register is a two-deep FIFO
+        outb(ch->cmd + ATA_REG_COUNT, (uint8_t)(count >> 8));
+        outb(ch->cmd + ATA_REG_LBA0, (uint8_t)(lba >> 24));
+        outb(ch->cmd + ATA_REG_LBA1, 0);
+        outb(ch->cmd + ATA_REG_LBA2, 0);
+    }
+    outb(ch->cmd + ATA_REG_COUNT, (uint8_t)count); // 256 is written as 0 in LBA28
+    outb(ch->cmd + ATA_REG_LBA0, (uint8_t)lba);
+    outb(ch->cmd + ATA_REG_LBA1, (uint8_t)(lba >> 8));
+    outb(ch->cmd + ATA_REG_LBA2, (uint8_t)(lba >> 16));
+    outb(ch->cmd + ATA_REG_COMMAND, ext ? cmd48 : cmd28);
+    return 0;
+}
+
+static int pio_rw(const ide_drive_t* d, uint32_t lba, uint32_t count, char* const* bufs, int write) {
+    const ide_channel_t* ch = d->ch;
+    if (ata_command(d, lba, count, write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO,
+                    write ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_READ_PIO_EXT) != 0) {
+        return -1;
+    }
+    int rc = 0;
+    for (uint32_t i = 0; i < count && rc == 0; i++) {
+        char* p = bufs[i / IDE_SECTORS_PER_BLOCK] + (i % IDE_SECTORS_PER_BLOCK) * ATA_SECTOR_SIZE;
+        ata_delay(ch);
+        rc = ata_poll(ch, 1);
+        if (rc == 0) {
+            if (write) {
+                outsw(ch->cmd + ATA_REG_DATA, p, ATA_SECTOR_SIZE / 2);
+            } else {
+                insw(ch->cmd + ATA_REG_DATA, p, ATA_SECTOR_SIZE / 2);
+            }
+        }
+    }
+    if (rc == 0 && write) {
+        ata_delay(ch);
+        rc = ata_poll(ch, 0);
+    }
+    inb(ch->cmd + ATA_REG_STATUS); // Drop INTRQ, or the next edge never comes
+    return rc;
+}
+
+static void ide_timeout(void* arg) {
+    ide_channel_t* ch = arg;
+    ch->timed_out = 1;
+    wait_queue_wake_all(&ch->done_wq);
+}
+
+static int dma_rw(const ide_drive_t* d, uint32_t lba, uint32_t count, char* const* bufs, int write) {
+    ide_channel_t* ch = d->ch;
+    uint32_t bytes = count * ATA_SECTOR_SIZE;
+    uint32_t n = 0;
+    for (uint32_t off = 0; off < bytes; off += BCACHE_BLOCK_SIZE, n++) {
+        uint32_t len = bytes - off < BCACHE_BLOCK_SIZE ? bytes - off : BCACHE_BLOCK_SIZE;
+        ch->prd[n].addr = virt_to_phys((uint32_t)bufs[n]);
+        ch->prd[n].bytes = (uint16_t)len;
+        ch->prd[n].flags = off + len == bytes ? PRD_EOT : 0;
+    }
+
+    outb(ch->bm + BM_COMMAND, 0);
+    outb(ch->bm + BM_STATUS, inb(ch->bm + BM_STATUS) | BM_STATUS_ERROR | BM_STATUS_IRQ);
+    outl(ch->bm + BM_PRDT, virt_to_phys((uint32_t)ch->prd));
+    ch->done = 0;
+    ch->timed_out = 0;
+    ch->dma_active = 1;
+    if (ata_command(d, lba, count, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA,
+                    write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT) != 0) {
+        ch->dma_active = 0;
+        return -1;
+    }
+    outb(ch->bm + BM_COMMAND, BM_CMD_START | (write ? 0 : BM_CMD_READ));
+
+    timer_id_t timer = timer_add(IDE_TIMEOUT_NS, ide_timeout, ch);
+    uint32_t flags = irq_save();
+    while (!ch->done && !ch->timed_out) {
+        wait_queue_sleep(&ch->done_wq);
+    }
+    irq_restore(flags);
+    if (timer) {
+        timer_cancel(timer);
+    }
+
+    outb(ch->bm + BM_COMMAND, 0);
+    ch->dma_active = 0;
+    uint8_t st = inb(ch->cmd + ATA_REG_STATUS);
+    if (ch->timed_out || (ch->bm_status & BM_STATUS_ERROR) || (st & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+        return -1;
+    }
+    return 0;
+}
+
+static void ide_irq_handler(registers_t* regs, void* ctx) {
+    (void)regs;
+    ide_channel_t* ch = ctx;
+    uint8_t bm_status = ch->bm ? inb(ch->bm + BM_STATUS) : 0;
+    inb(ch->cmd + ATA_REG_STATUS); // Acknowledge the drive
+    stats.irqs++;
+    if (ch->dma_active && (bm_status & BM_STATUS_IRQ)) {
+        outb(ch->bm + BM_STATUS, bm_status); // Clears IRQ (and ERROR), keeps the capability bits
+        ch->bm_status = bm_status;
+        ch->done = 1;
+        wait_queue_wake_all(&ch->done_wq);
+    }
+    // PIO transfers are polled; their per-sector interrupts only need the acknowledge
+}
+
+static void channel_acquire(ide_channel_t* ch) {
+    uint32_t flags = irq_save();
+    while (ch->busy) {
+        wait_queue_sleep(&ch->busy_wq);
+    }
+    ch->busy = 1;
+    irq_restore(flags);
+}
+
+static void channel_release(ide_channel_t* ch) {
+    uint32_t flags = irq_save();
+    ch->busy = 0;
+    wait_queue_wake_one(&ch->busy_wq);
+    irq_restore(flags);
+}
+
+int ide_rw(uint32_t drive, uint32_t lba, uint32_t count, char* const* bufs, int write) {
+    if (drive >= IDE_MAX_DRIVES || !drives[drive].present) {
+        return -1;
+    }
+    ide_drive_t* d = &drives[drive];
+    if (count == 0 || count > IDE_MAX_SECTORS || lba >= d->sectors || count > d->sectors - lba) {
+        return -1;
+    }
+
+    channel_acquire(d->ch);
+    int rc = -1;
+    if (d->dma && dma_allowed) {
+        rc = dma_rw(d, lba, count, bufs, write);
+        if (rc == 0) {
+            stats.dma_ops++;
+        } else {
+            stats.dma_errors++;
+            d->dma = 0;
+            klog(KLOG_WARN, "ide%u: DMA %s failed at sector %u, falling back to PIO\n",
+                 drive, write ? "write" : "read", lba);
+            ata_reset(d->ch);
+        }
+    }
+    if (rc != 0) {
+        rc = pio_rw(d, lba, count, bufs, write);
+        if (rc == 0) {
+            stats.pio_ops++;
+        } else {
+            stats.pio_errors++;
+            klog(KLOG_WARN, "ide%u: PIO %s failed at sector %u\n", drive, write ? "write" : "read", lba);
+            ata_reset(d->ch);
+        }
+    }
+    channel_release(d->ch);
+    return rc;
+}
+
+static int ide_blockdev_rw(blockdev_t* dev, uint32_t block, uint32_t count, char* const* bufs, int write) {
+    ide_drive_t* d = dev->priv;
+    return ide_rw((uint32_t)(d - drives), block * IDE_SECTORS_PER_BLOCK, count * IDE_SECTORS_PER_BLOCK, bufs, write);
+}
+
+static int ide_blockdev_flush(blockdev_t* dev) {
+    ide_drive_t* d = dev->priv;
+    channel_acquire(d->ch);
+    ata_select(d, 0);
+    int rc = ata_poll(d->ch, 0);
+    if (rc == 0) {
+        outb(d->ch->cmd + ATA_REG_COMMAND, d->lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH);
+        ata_delay(d->ch);
+        rc = ata_poll(d->ch, 0);
+        inb(d->ch->cmd + ATA_REG_STATUS);
+    }
+    channel_release(d->ch);
+    return rc;
+}
+
+blockdev_t* ide_blockdev(uint32_t drive) {
+    return drive < IDE_MAX_DRIVES && drives[drive].present ? &drives[drive].bdev : 0;
+}
+
+// IDENTIFY DEVICE by polling. Leaves present clear for empty slots, ATAPI
+// devices and disks without LBA.
+static void identify(ide_drive_t* d) {
+    ide_channel_t* ch = d->ch;
+    uint16_t id[256];
+
+    ata_select(d, 0);
+    outb(ch->cmd + ATA_REG_COUNT, 0);
+    outb(ch->cmd + ATA_REG_LBA0, 0);
+    outb(ch->cmd + ATA_REG_LBA1, 0);
+    outb(ch->cmd + ATA_REG_LBA2, 0);
+    outb(ch->cmd + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay(ch);
+    if (inb(ch->ctrl) == 0) {
+        return; // Nothing there
+    }
+    uint64_t deadline = ktime_ns() + IDE_TIMEOUT_NS;
+    while ((inb(ch->ctrl) & ATA_STATUS_BSY) && ktime_ns() < deadline) {
+        cpu_relax();
+    }
+    if (inb(ch->cmd + ATA_REG_LBA1) || inb(ch->cmd + ATA_REG_LBA2)) {
+        inb(ch->cmd + ATA_REG_STATUS);
+        return; // ATAPI or SATA signature: not an ATA disk
+    }
+    if (ata_poll(ch, 1) != 0) {
+        inb(ch->cmd + ATA_REG_STATUS);
+        return;
+    }
+    insw(ch->cmd + ATA_REG_DATA, id, 256);
+    inb(ch->cmd + ATA_REG_STATUS);
+    if (!(id[ID_CAPABILITIES] & ID_CAP_LBA)) {
+        return;
+    }
+
+    d->sectors = id[ID_LBA28_SECTORS] | ((uint32_t)id[ID_LBA28_SECTORS + 1] << 16);
+    if (id[ID_COMMAND_SETS] & ID_CMD_LBA48) {
+        d->lba48 = 1;
+        d->sectors = id[ID_LBA48_SECTORS] | ((uint32_t)id[ID_LBA48_SECTORS + 1] << 16);
+        if (id[ID_LBA48_SECTORS + 2] || id[ID_LBA48_SECTORS + 3]) {
+            d->sectors = 0xFFFFFFFF; // Only the first 2 TB are addressable with 32-bit sector numbers
+        }
+    }
+    // Timings and transfer mode are left as the BIOS programmed them
+    d->dma = ch->bm && (id[ID_CAPABILITIES] & ID_CAP_DMA);
+    for (int i = 0; i < 20; i++) {
+        d->model[i * 2] = (char)(id[ID_MODEL + i] >> 8);
+        d->model[i * 2 + 1] = (char)id[ID_MODEL + i];
+    }
+    int len = 40;
+    while (len > 0 && (d->model[len - 1] == ' ' || d->model[len - 1] == '\0')) {
+        len--;
+    }
+    d->model[len] = '\0';
+    d->present = 1;
+}
+
+static int setup_channel(ide_channel_t* ch, uint32_t first_drive) {
+    int found = 0;
+    if (inb(ch->cmd + ATA_REG_STATUS) == 0xFF) {
+        return 0; // Floating bus: no channel, or nothing on it
+    }
+    if (ch->bm) {
+        ch->prd = (prd_t*)alloc_pages(0); // Page aligned, so it cannot cross 64 KB
+        if (!ch->prd) {
+            ch->bm = 0;
+        }
+    }
+    outb(ch->ctrl, 0); // Interrupts on (nIEN clear)
+    for (uint32_t i = 0; i < 2; i++) {
+        ide_drive_t* d = &drives[first_drive + i];
+        d->ch = ch;
+        d->slave = (uint8_t)i;
+        identify(d);
+        if (!d->present) {
+            continue;
+        }
+        found++;
+        d->bdev.name = drive_names[first_drive + i];
+        d->bdev.blocks = d->sectors / IDE_SECTORS_PER_BLOCK;
+        d->bdev.rw = ide_blockdev_rw;
+        d->bdev.flush = ide_blockdev_flush;
+        d->bdev.priv = d;
+        d->bdev.ra_next = 0xFFFFFFFF;
+        klog(KLOG_INFO, "ide%u: %s, %u MB, %s\n", first_drive + i, d->model,
+             d->sectors / (1024 * 1024 / ATA_SECTOR_SIZE), d->dma ? "DMA" : "PIO");
+    }
+    if (found) {
+        register_irq_handler(IRQ_VECTOR(ch->irq), ide_irq_handler, ch);
+        irq_unmask(ch->irq);
+    }
+    return found;
+}
+
+static int ide_probe(pci_device_t* dev) {
+    const pci_bar_t* bar = &dev->bar[IDE_BAR_BUS_MASTER];
+    uint16_t bm = bar->is_io && bar->size ? (uint16_t)bar->base : 0;
+    pci_enable(dev, PCI_COMMAND_IO | (bm ? PCI_COMMAND_MASTER : 0));
+
+    // PIIX channels always run in compatibility mode
+    channels[0] = (ide_channel_t){ .cmd = ATA_PRIMARY_CMD, .ctrl = ATA_PRIMARY_CTRL, .bm = bm,
+                                   .irq = IDE_PRIMARY_IRQ };
+    channels[1] = (ide_channel_t){ .cmd = ATA_SECONDARY_CMD, .ctrl = ATA_SECONDARY_CTRL,
+                                   .bm = bm ? bm + BM_CHANNEL_STRIDE : 0, .irq = IDE_SECONDARY_IRQ };
+    int found = setup_channel(&channels[0], 0) + setup_channel(&channels[1], 2);
+    if (!found) {
+        return -1;
+    }
+    dbgcon_register('i', ide_report, "log IDE drives and transfer counters");
+    return 0;
+}
+
+const pci_driver_t ide_driver = { "piix-ide", ide_ids, ide_probe };
+
+void ide_report(void) {
+    for (uint32_t i = 0; i < IDE_MAX_DRIVES; i++) {
+        if (drives[i].present) {
+            klog(KLOG_INFO, "ide%u: %u sectors, %s\n", i, drives[i].sectors, drives[i].dma ? "DMA" : "PIO");
+        }
+    }
+    klog(KLOG_INFO, "ide: %u DMA and %u PIO transfers, %u interrupts\n", stats.dma_ops, stats.pio_ops, stats.irqs);
+    klog(KLOG_INFO, "ide: %u DMA errors, %u PIO errors\n", stats.dma_errors, stats.pio_errors);
+}
+
+#ifdef CONFIG_BENCH
+#include "bench.h"
+
+#define IDE_BENCH_SPAN_BYTES  (8 * 1024 * 1024) // Sequential passes cover this much of the disk
+#define IDE_BENCH_SEQ_SECTORS 128               // 64 KB per sequential transfer
+#define IDE_BENCH_RANDOM_OPS  512               // 4 KB transfers at random blocks
+#define IDE_BENCH_PAGES       (IDE_BENCH_SEQ_SECTORS / IDE_SECTORS_PER_BLOCK)
+
+typedef struct {
+    const char* seq_read;
+    const char* rand_read;
+    const char* seq_write;
+    int dma;
+} ide_bench_mode_t;
+
+static const ide_bench_mode_t bench_modes[] = {
+    { "ide.dma_seq_read", "ide.dma_rand_read", "ide.dma_seq_write", 1 },
+    { "ide.pio_seq_read", "ide.pio_rand_read", "ide.pio_seq_write", 0 },
+};
+
+int ide_bench_drive(int* writable) {
+    for (int i = IDE_MAX_DRIVES - 1; i >= 0; i--) {
+        if (drives[i].present) {
+            *writable = i != 0;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Report a pass as cycles per transfer, then as KB/s and IOPS
+static void bench_pass(const char* name, uint32_t drive, uint32_t sectors, int random, int write, char* const* bufs) {
+    uint32_t span = drives[drive].sectors < IDE_BENCH_SPAN_BYTES / ATA_SECTOR_SIZE ?
+                    drives[drive].sectors : IDE_BENCH_SPAN_BYTES / ATA_SECTOR_SIZE;
+    uint32_t slots = span / sectors;
+    uint32_t ops = random ? IDE_BENCH_RANDOM_OPS : slots;
+    uint32_t seed = 12345;
+    if (slots == 0) {
+        return;
+    }
+
+    uint64_t t0 = rdtsc();
+    for (uint32_t i = 0; i < ops; i++) {
+        uint32_t slot = i;
+        if (random) {
+            seed = seed * 1103515245 + 12345;
+            slot = (seed >> 8) % slots;
+        }
+        if (ide_rw(drive, slot * sectors, sectors, bufs, write) != 0) {
+            klog(KLOG_WARN, "ide bench: %s failed\n", name);
+            return;
+        }
+    }
+    uint64_t cycles = rdtsc() - t0;
+    bench_report(name, sectors * ATA_SECTOR_SIZE / 1024, ops, cycles);
+
+    uint64_t us = div_u64_u32(clock_cycles_to_ns(cycles), NSEC_PER_USEC);
+    if (us) {
+        uint32_t kbps = (uint32_t)div_u64_u32((uint64_t)ops * sectors * ATA_SECTOR_SIZE / 1024 * 1000000, (uint32_t)us);
+        uint32_t iops = (uint32_t)div_u64_u32((uint64_t)ops * 1000000, (uint32_t)us);
+        klog(KLOG_INFO, "ide bench: %s %u KB/s, %u IOPS\n", name, kbps, iops);
+    }
+}
+
+void ide_bench(void) {
+    int writable;
+    int drive = ide_bench_drive(&writable);
+    if (drive < 0) {
+        klog(KLOG_INFO, "ide bench: no disk, skipped\n");
+        return;
+    }
+    char* bufs[IDE_BENCH_PAGES];
+    uint32_t n = 0;
+    for (; n < IDE_BENCH_PAGES; n++) {
+        if (!(bufs[n] = (char*)alloc_pages(0))) {
+            break;
+        }
+    }
+
+    if (n == IDE_BENCH_PAGES) {
+        for (uint32_t m = 0; m < sizeof(bench_modes) / sizeof(bench_modes[0]); m++) {
+            const ide_bench_mode_t* mode = &bench_modes[m];
+            if (mode->dma && !drives[drive].dma) {
+                klog(KLOG_INFO, "ide bench: ide%u has no DMA\n", drive);
+                continue;
+            }
+            dma_allowed = mode->dma;
+            bench_pass(mode->seq_read, drive, IDE_BENCH_SEQ_SECTORS, 0, 0, bufs);
+            bench_pass(mode->rand_read, drive, IDE_SECTORS_PER_BLOCK, 1, 0, bufs);
+            if (writable) {
+                bench_pass(mode->seq_write, drive, IDE_BENCH_SEQ_SECTORS, 0, 1, bufs);
+            }
+        }
+        dma_allowed = 1;
+    }
+    while (n) {
+        free_pages((phys_addr_t)bufs[--n], 0);
+    }
+}
+#endif
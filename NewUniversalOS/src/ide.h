@@ -0,0 +1,41 @@
+#ifndef IDE_H
+#define IDE_H
+
+#include <stdint.h>
+#include "pci.h"
+#include "bcache.h" // For blockdev_t
+
+// ATA disks on a PIIX IDE controller. Both channels run in compatibility
+// mode (ports 0x1F0/0x3F6 on IRQ14, 0x170/0x376 on IRQ15). Transfers use
+// bus-master DMA through a PRD table, one entry per page-sized buffer, and
+// the thread sleeps until the channel interrupt; drives or controllers
+// without DMA, or a DMA transfer that fails, fall back to polled PIO.
+
+#define IDE_MAX_DRIVES  4   // Primary master and slave, then secondary
+#define ATA_SECTOR_SIZE 512
+#define IDE_SECTORS_PER_BLOCK (BCACHE_BLOCK_SIZE / ATA_SECTOR_SIZE)
+#define IDE_MAX_SECTORS 256 // Per command: the LBA28 limit, 32 pages of PRDs
+
+#define IDE_PRIMARY_IRQ   14
+#define IDE_SECONDARY_IRQ 15
+
+extern const pci_driver_t ide_driver;
+
+// The cache-facing device for drive (0-3), or 0 if there is no ATA disk there
+blockdev_t* ide_blockdev(uint32_t drive);
+
+// Move count sectors (at most IDE_MAX_SECTORS) starting at lba between the
+// drive and bufs, filling each page-sized buffer before moving on to the
+// next. Returns 0, or -1 on an error. Sleeps; call from a thread.
+int ide_rw(uint32_t drive, uint32_t lba, uint32_t count, char* const* bufs, int write);
+
+void ide_report(void); // klog drives, modes and counters
+
+#ifdef CONFIG_BENCH
+void ide_bench(void); // PIO against DMA, sequential and random
+// The disk the benchmarks may use: the highest-numbered one, writable only
+// if it is not the boot disk (drive 0). Returns -1 if there is none.
+int ide_bench_drive(int* writable);
+#endif
+
+#endif // IDE_H
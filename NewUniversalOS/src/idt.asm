@@ -1,16 +1,8 @@
 bits 32
 
 %define KERNEL_CODE_SEGMENT 0x08 ; From GDT
-
-; Macro to create an IDT entry
-; Args: address, selector, flags
-%macro IDT_ENTRY 3
-    dw %1 & 0xFFFF          ; Offset low
-    dw %2                   ; Selector
-    db 0                    ; Reserved (IST)
-    db %3                   ; Type/Attributes (P, DPL, S, GateType)
-    dw (%1 >> 16) & 0xFFFF  ; Offset high
-%endmacro
+%define KERNEL_DATA_SEGMENT 0x10 ; From GDT
+%define TSS_TO_PERCPU_SELECTOR (8 * 8) ; GDT_TSS(cpu) - GDT_PERCPU(cpu), SMP_MAX_CPUS entries apart (gdt.h)
 
 global idt_load
 extern isr_handler_c ; C function to handle interrupts
@@ -21,10 +13,10 @@ idt_load:
     ret
 
 ; ISR Macros (modified for clarity and to pass registers_t* to C handler)
+; The gates are interrupt gates, so the CPU has already cleared IF on entry.
 %macro ISR_NO_ERRCODE 1
 global isr%1
 isr%1:
-    cli
     push byte 0     ; Dummy error code
     push byte %1    ; Interrupt number
     jmp common_isr_stub
@@ -33,7 +25,6 @@ isr%1:
 %macro ISR_ERRCODE 1
 global isr%1
 isr%1:
-    cli
     ; Error code is already on stack
     push byte %1    ; Interrupt number (comes after error code on stack)
     jmp common_isr_stub
@@ -44,47 +35,50 @@ isr%1:
 %macro IRQ_HANDLER_STUB 2
 global isr%1
 isr%1:
-    cli
     push byte 0     ; Push a dummy error code
-    push byte %2    ; Push the interrupt number
+    push dword %2   ; Push the interrupt number (dword: vectors above 127 would sign-extend)
     jmp common_isr_stub
 %endmacro
 
 common_isr_stub:
     pushad          ; Pushes eax, ecx, edx, ebx, esp, ebp, esi, edi (esp is original value)
+    cld             ; C code expects DF clear; memmove may have been copying downwards
+    push gs         ; Per-CPU segment in the kernel, whatever user code left there otherwise
     
+    xor eax, eax
     mov ax, ds      ; Save original data segment
     push eax
     
-    mov ax, 0x10    ; Load kernel data segment (selector 0x10)
+    ; Only reload segments if we interrupted code running with other selectors;
+    ; kernel code already has DS/ES = KERNEL_DATA_SEGMENT and its own GS.
+    cmp ax, KERNEL_DATA_SEGMENT
+    je .segments_ready
+    mov ax, KERNEL_DATA_SEGMENT
     mov ds, ax
     mov es, ax
-    mov fs, ax
+    str ax          ; This CPU's TSS selector, which maps onto its GS segment
+    sub ax, TSS_TO_PERCPU_SELECTOR
     mov gs, ax
+.segments_ready:
     
     push esp        ; Pass pointer to the stack (which now looks like registers_t) to isr_handler_c
     call isr_handler_c
     add esp, 4      ; Clean up stack pointer argument
     
-    pop ebx         ; Restore original data segment (saved in eax, but pushad saved ds in order, so pop to ebx temporarily)
-    mov ds, bx      ; (Corrected: pop into a register then mov to ds)
-    mov es, bx      ; Also restore es, fs, gs if they were changed, or ensure they are valid.
-    mov fs, bx      ; For simplicity, assume they all take kernel data segment for now after interrupt.
-    mov gs, bx      ; This part needs care; kernel should operate in its own segments.
-                    ; The C handler will run with kernel DS. Upon iret, original segments are restored if CPL changes.
+    pop eax         ; Original data segment
+    pop ecx         ; Original GS
+    cmp ax, KERNEL_DATA_SEGMENT
+    je .segments_restored
+    mov ds, ax
+    mov es, ax
+    mov gs, cx
+.segments_restored:
 
     popad           ; Pop all general registers
-    
-    ; Clean up interrupt number and error code from stack
-    ; Error code (if present) is below int_num. int_num is at [esp+4], err_code at [esp] for isr_handler_c
-    ; After popad, esp points to the pushed interrupt number.
-    ; Then error code is below it.
     add esp, 8      ; Pop interrupt number and error code
     
-    sti             ; Re-enable interrupts (IF THIS IS DESIRED FOR ALL ISRs - often not for exceptions)
-                    ; For exceptions, iret should restore previous IF state.
-                    ; For IRQs, this is usually done by the handler or just before iret.
-                    ; Let's make it default for now, can be refined.
+    ; No sti here: iret restores the interrupted EFLAGS, including IF, so
+    ; exceptions taken with interrupts off come back with them still off.
     iret            ; Return from interrupt
 
 ; ISR Definitions (Exceptions 0-31)
@@ -125,9 +119,25 @@ ISR_NO_ERRCODE  31  ; Reserved
 ; IRQ Handler Stubs (INT 32-47)
 IRQ_HANDLER_STUB 32, 32  ; ISR stub for INT 32 (IRQ 0 - Timer)
 IRQ_HANDLER_STUB 33, 33  ; ISR stub for INT 33 (IRQ 1 - Keyboard)
-; Add more for IRQ2 through IRQ15 later if needed:
-; ...
-; IRQ_HANDLER_STUB 47, 47  ; ISR stub for INT 47 (IRQ 15)
+IRQ_HANDLER_STUB 34, 34  ; ISR stub for INT 34 (IRQ 2 - Cascade, never raised)
+IRQ_HANDLER_STUB 35, 35  ; ISR stub for INT 35 (IRQ 3 - COM2)
+IRQ_HANDLER_STUB 36, 36  ; ISR stub for INT 36 (IRQ 4 - COM1)
+IRQ_HANDLER_STUB 37, 37  ; ISR stub for INT 37 (IRQ 5 - LPT2)
+IRQ_HANDLER_STUB 38, 38  ; ISR stub for INT 38 (IRQ 6 - Floppy)
+IRQ_HANDLER_STUB 39, 39  ; ISR stub for INT 39 (IRQ 7 - LPT1 / spurious)
+IRQ_HANDLER_STUB 40, 40  ; ISR stub for INT 40 (IRQ 8 - RTC)
+IRQ_HANDLER_STUB 41, 41  ; ISR stub for INT 41 (IRQ 9)
+IRQ_HANDLER_STUB 42, 42  ; ISR stub for INT 42 (IRQ 10)
+IRQ_HANDLER_STUB 43, 43  ; ISR stub for INT 43 (IRQ 11)
+IRQ_HANDLER_STUB 44, 44  ; ISR stub for INT 44 (IRQ 12 - PS/2 mouse)
+IRQ_HANDLER_STUB 45, 45  ; ISR stub for INT 45 (IRQ 13 - FPU)
+IRQ_HANDLER_STUB 46, 46  ; ISR stub for INT 46 (IRQ 14 - Primary ATA)
+IRQ_HANDLER_STUB 47, 47  ; ISR stub for INT 47 (IRQ 15 - Secondary ATA / spurious)
+
+; Local APIC vectors. Their gates are installed with idt_set_gate.
+IRQ_HANDLER_STUB 240, 240 ; Cross-CPU call IPI (SMP_CALL_VECTOR)
+IRQ_HANDLER_STUB 254, 254 ; LAPIC error
+IRQ_HANDLER_STUB 255, 255 ; LAPIC spurious
 
 
 ; PIC Remapping
@@ -211,19 +221,47 @@ master_eoi:
     popad
     ret
 
-; IDT Table (256 entries)
-idt_data:
+; IDT Table (256 entries), built at assemble time.
+; ELF relocations cannot split a symbol address into its low and high
+; halves, so each gate is emitted with the full handler address in its first
+; dword and the selector in its last word. idt_fixup swaps those two words
+; once at boot, which leaves the standard gate layout:
+;   offset 0-15 | selector | 0 | flags | offset 16-31
+%macro IDT_GATE 1
+    dd %1                   ; Offset 0-31 (high half swapped out by idt_fixup)
+    db 0                    ; Reserved
+    db 0x8E                 ; P=1, DPL=0, 32-bit interrupt gate
+    dw KERNEL_CODE_SEGMENT  ; Selector (swapped into place by idt_fixup)
+%endmacro
+
+section .data
+align 8
+global idt_table
+idt_table:
     %assign i 0
-    %rep 256
-        ; Default: points to a generic handler or is marked not present
-        ; For now, let's point defined ISRs and leave others as 0 (non-present/invalid)
-        ; or point them to a default handler that just halts.
-        ; We'll set these up properly from C code.
-        ; This is just space reservation.
-        IDT_ENTRY 0, 0, 0 ; Placeholder, will be filled by C code
+    %rep 48                 ; Exceptions 0-31 and IRQs 0-15 (vectors 32-47)
+        IDT_GATE isr%[i]
+        %assign i i+1
     %endrep
-idt_end:
+    times (256 - 48) dq 0   ; Not present until someone calls idt_set_gate
+idt_table_end:
 
-idt_ptr_struct:
-    dw idt_end - idt_data - 1 ; IDT Limit
-    dd idt_data               ; IDT Base Address
\ No newline at end of file
+global idt_descriptor
+idt_descriptor:
+    dw idt_table_end - idt_table - 1 ; IDT Limit
+    dd idt_table                     ; IDT Base Address
+
+section .text
+global idt_fixup
+; Swap the selector and offset-high words of every gate (see IDT_GATE).
+; Must run exactly once, before idt_load.
+idt_fixup:
+    mov edx, idt_table
+    mov ecx, 48
+.next_gate:
+    mov ax, [edx + 2]       ; Offset 16-31
+    xchg ax, [edx + 6]      ; <-> selector
+    mov [edx + 2], ax
+    add edx, 8
+    loop .next_gate
+    ret
@@ -6,6 +6,7 @@
 // Structure to hold register values passed from ISR stubs
 typedef struct {
     uint32_t ds;                                            // Data segment selector
+    uint32_t gs;                                            // Interrupted GS (per-CPU segment in the kernel)
     uint32_t edi, esi, ebp, esp_dummy, ebx, edx, ecx, eax;   // Pushed by pusha. esp_dummy is stack pointer before pusha.
     uint32_t int_no, err_code;                              // Interrupt number and error code (if any)
     uint32_t eip, cs, eflags, useresp, ss;                  // Pushed by the processor automatically
@@ -26,12 +27,35 @@ typedef struct {
     uint32_t base;        // Base address of the IDT
 } __attribute__((packed)) idt_ptr_t;
 
+#define IRQ_BASE_VECTOR 32                    // PIC IRQ0 is remapped to INT 32
+#define IRQ_VECTOR(irq) (IRQ_BASE_VECTOR + (irq))
+
+// Interrupt handler registered for one vector. ctx is the pointer passed to
+// register_irq_handler. For ISA IRQs (vectors 32-47) the dispatcher sends the
+// EOI afterwards; handlers of local APIC vectors send their own.
+typedef void (*irq_handler_t)(registers_t* regs, void* ctx);
+
 // This function will be implemented in C (interrupts.c) and called from common_isr_stub
 extern void isr_handler_c(registers_t* regs); // Changed to pointer as per previous correction
 
+// Dispatch table (interrupts.c)
+void register_irq_handler(uint8_t vector, irq_handler_t fn, void* ctx);
+registers_t* irq_get_regs(void);          // Interrupted context while an IRQ handler runs, else 0
+uint32_t irq_get_count(uint8_t vector);   // Times the vector was dispatched
+uint32_t irq_get_spurious_count(void);    // Spurious IRQ7/IRQ15 seen (not counted per vector)
+void irq_dump_counts(void);               // klog every vector with a non-zero count
+void irq_unmask(uint8_t irq);             // At the I/O APIC once apic_init() has run, else the 8259s
+void irq_mask(uint8_t irq);
+
 // This function will be implemented in idt.asm and called from C to load the IDT
 extern void idt_load(void* idt_ptr); // Argument is idt_ptr_t*
 
+// The IDT itself is assembled into idt.asm with gates for vectors 0-47.
+// idt_fixup puts the gates into their final layout and must run once, before idt_load.
+extern idt_entry_t idt_table[256];
+extern idt_ptr_t idt_descriptor;
+extern void idt_fixup(void);
+
 // ISR stubs (implemented in idt.asm)
 extern void isr0(); extern void isr1(); extern void isr2(); extern void isr3();
 extern void isr4(); extern void isr5(); extern void isr6(); extern void isr7();
@@ -41,9 +65,11 @@ extern void isr16(); extern void isr17(); extern void isr18(); extern void isr19
 extern void isr20(); extern void isr21(); extern void isr22(); extern void isr23();
 extern void isr24(); extern void isr25(); extern void isr26(); extern void isr27();
 extern void isr28(); extern void isr29(); extern void isr30(); extern void isr31();
-extern void isr32(); // For IRQ0 (Timer)
-extern void isr33(); // For IRQ1 (Keyboard)
-// extern void isr34(); ... // For future IRQs
+extern void isr32(); extern void isr33(); extern void isr34(); extern void isr35(); // IRQ0-3
+extern void isr36(); extern void isr37(); extern void isr38(); extern void isr39(); // IRQ4-7
+extern void isr40(); extern void isr41(); extern void isr42(); extern void isr43(); // IRQ8-11
+extern void isr44(); extern void isr45(); extern void isr46(); extern void isr47(); // IRQ12-15
+extern void isr240(); extern void isr254(); extern void isr255(); // Local APIC (see apic.h, smp.h)
 
 // PIC Remapping function (implemented in idt.asm)
 extern void pic_remap(void);
@@ -54,5 +80,6 @@ extern void pic_send_eoi(unsigned char irq_num);
 
 // Function to initialize IDT (will be in kernel.c)
 void idt_init(void); 
+void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags);
 
 #endif // IDT_H
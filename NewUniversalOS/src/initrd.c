@@ -0,0 +1,184 @@
+#include "initrd.h"
+#include "klib.h"
+#include "klog.h"
+#include "dbgcon.h"
+
+// Set once by initrd_init and only read afterwards, so no locking
+static const char* image = 0;
+static const initrd_entry_t* entries = 0;
+static uint32_t count = 0;
+static uint32_t image_size = 0;
+
+static const char* strip_slash(const char* path, uint32_t* len) {
+    while (*path == '/') path++;
+    uint32_t n = 0;
+    while (path[n]) n++;
+    *len = n;
+    return path;
+}
+
+// Bytewise order, as mkinitrd.py sorts
+static int name_cmp(const initrd_entry_t* e, const char* name, uint32_t len) {
+    uint32_t n = e->name_len < len ? e->name_len : len;
+    int c = memcmp(image + e->name_off, name, n);
+    if (c) return c;
+    return e->name_len < len ? -1 : e->name_len > len;
+}
+
+static int fits(uint32_t off, uint32_t len, uint32_t limit) {
+    return off <= limit && len <= limit - off;
+}
+
+int initrd_init(phys_addr_t addr, uint32_t size) {
+    const initrd_header_t* h = (const initrd_header_t*)addr;
+    if (!addr || size < sizeof(*h) || h->magic != INITRD_MAGIC) {
+        klog(KLOG_INFO, "initrd: none\n");
+        return -1;
+    }
+    if (h->version != INITRD_VERSION || h->image_size > size ||
+        (h->index_off & 3) || h->count > (h->image_size >> 4) ||
+        !fits(h->index_off, h->count * sizeof(initrd_entry_t), h->image_size)) {
+        klog(KLOG_ERROR, "initrd: bad header at 0x%08x (version %u, %u files)\n",
+             addr, h->version, h->count);
+        return -1;
+    }
+
+    // Check every entry once here, so lookups can trust the index
+    image = (const char*)addr;
+    image_size = h->image_size;
+    entries = (const initrd_entry_t*)(image + h->index_off);
+    for (uint32_t i = 0; i < h->count; i++) {
+        const initrd_entry_t* e = &entries[i];
+        if (e->name_len >= image_size || !fits(e->name_off, e->name_len + 1, image_size) ||
+            image[e->name_off + e->name_len] ||
+            !fits(e->data_off, e->size, image_size) ||
+            (i && name_cmp(&entries[i - 1], image + e->name_off, e->name_len) >= 0)) {
+            klog(KLOG_ERROR, "initrd: bad or unsorted entry %u\n", i);
+            image = 0;
+            entries = 0;
+            return -1;
+        }
+    }
+    count = h->count;
+    dbgcon_register('f', initrd_report, "log initrd files and size");
+    return 0;
+}
+
+const void* initrd_lookup(const char* path, uint32_t* size) {
+    uint32_t len;
+    const char* name = strip_slash(path, &len);
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = name_cmp(&entries[mid], name, len);
+        if (c == 0) {
+            if (size) *size = entries[mid].size;
+            return image + entries[mid].data_off;
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0;
+}
+
+uint32_t initrd_count(void) {
+    return count;
+}
+
+const void* initrd_get(uint32_t i, const char** name, uint32_t* size) {
+    if (i >= count) {
+        return 0;
+    }
+    if (name) *name = image + entries[i].name_off;
+    if (size) *size = entries[i].size;
+    return image + entries[i].data_off;
+}
+
+void initrd_report(void) {
+    uint32_t bytes = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        bytes += entries[i].size;
+    }
+    klog(KLOG_INFO, "initrd: %u files, %u KB of data in a %u KB image at 0x%08x\n",
+         count, bytes >> 10, image_size >> 10, (uint32_t)image);
+}
+
+#ifdef CONFIG_BENCH
+#include "bench.h"
+
+#define INITRD_BENCH_STRIDE 7919 // Prime step through the index, so lookups do not follow name order
+#define INITRD_LINEAR_OPS   256
+#define INITRD_MAX_NAME     128
+
+// Same as initrd_lookup but walking the index front to back, for comparison
+static const void* lookup_linear(const char* path, uint32_t* size) {
+    uint32_t len;
+    const char* name = strip_slash(path, &len);
+    for (uint32_t i = 0; i < count; i++) {
+        if (name_cmp(&entries[i], name, len) == 0) {
+            *size = entries[i].size;
+            return image + entries[i].data_off;
+        }
+    }
+    return 0;
+}
+
+void initrd_bench(void) {
+    if (count == 0) {
+        klog(KLOG_INFO, "initrd bench: no files, skipped\n");
+        return;
+    }
+    uint32_t size, found = 0;
+
+    // Every file once, in a scattered order
+    uint64_t t0 = rdtsc();
+    for (uint32_t i = 0, j = 0; i < count; i++, j = (j + INITRD_BENCH_STRIDE) % count) {
+        found += initrd_lookup(image + entries[j].name_off, &size) != 0;
+    }
+    bench_report("initrd.lookup_hit", count, count, rdtsc() - t0);
+
+    // Names one byte past real ones miss only at the bottom of the search
+    static char miss[INITRD_MAX_NAME + 2];
+    uint32_t misses = 0;
+    uint64_t cycles = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const initrd_entry_t* e = &entries[i];
+        if (e->name_len > INITRD_MAX_NAME) continue;
+        memcpy(miss, image + e->name_off, e->name_len);
+        miss[e->name_len] = '~';
+        miss[e->name_len + 1] = 0;
+        t0 = rdtsc();
+        found += initrd_lookup(miss, &size) != 0;
+        cycles += rdtsc() - t0;
+        misses++;
+    }
+    bench_report("initrd.lookup_miss", count, misses, cycles);
+
+    uint32_t linear = count < INITRD_LINEAR_OPS ? count : INITRD_LINEAR_OPS;
+    t0 = rdtsc();
+    for (uint32_t i = 0, j = 0; i < linear; i++, j = (j + INITRD_BENCH_STRIDE) % count) {
+        found += lookup_linear(image + entries[j].name_off, &size) != 0;
+    }
+    bench_report("initrd.lookup_linear", count, linear, rdtsc() - t0);
+
+    // Open and read every file in place; a copying initrd would pay for a
+    // memcpy and an allocation here
+    uint32_t bytes = 0, sum = 0;
+    t0 = rdtsc();
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* p = initrd_lookup(image + entries[i].name_off, &size);
+        for (uint32_t k = 0; k < size; k++) {
+            sum += p[k];
+        }
+        bytes += size;
+    }
+    cycles = rdtsc() - t0;
+    bench_report("initrd.read_byte", 0, bytes, cycles);
+    klog(KLOG_INFO, "initrd bench: %u/%u found, read %u KB at %u KB/s\n",
+         found, count + linear, bytes >> 10, bench_kb_per_sec(bytes, cycles));
+    klog(KLOG_INFO, "initrd bench: checksum %08x\n", sum);
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include <stdint.h>
+#include "pmm.h" // For phys_addr_t
+
+// Read-only initial ramdisk. The Makefile packs INITRD_DIR with
+// tools/mkinitrd.py and appends it to the disk image after the kernel; the
+// loader copies it to the first page above the kernel's .bss and reports
+// it in boot_info. It stays where it was loaded: lookups binary-search a
+// sorted index and hand out pointers straight into the image, so nothing
+// is copied or allocated per file.
+//
+// Layout (little endian, offsets from the start of the image):
+//   header       initrd_header_t
+//   index        count initrd_entry_t, sorted bytewise by name
+//   names        NUL-terminated paths without a leading '/'
+//   data         file contents, each INITRD_ALIGN aligned
+
+#define INITRD_MAGIC   0x49534F55 // 'UOSI'
+#define INITRD_VERSION 1
+#define INITRD_ALIGN   16
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;       // Files in the index
+    uint32_t image_size;  // Bytes, header included
+    uint32_t index_off;
+    uint32_t names_off;
+    uint32_t data_off;
+    uint32_t reserved;
+} initrd_header_t;
+
+typedef struct {
+    uint32_t name_off;    // Offset of the name in the image
+    uint32_t name_len;    // Without the NUL
+    uint32_t data_off;    // Offset of the contents in the image
+    uint32_t size;
+} initrd_entry_t;
+
+// Check the image the loader left at addr and make it searchable. Returns 0,
+// or -1 (and leaves the initrd empty) if it is missing or malformed.
+// Needs the identity map; the frames must stay reserved (see pmm_init).
+int initrd_init(phys_addr_t addr, uint32_t size);
+
+// Find path (a leading '/' is ignored) in O(log n). Returns a pointer to its
+// contents inside the image and stores the length in *size, or returns 0 if
+// there is no such file. The contents are read-only and never move.
+const void* initrd_lookup(const char* path, uint32_t* size);
+
+uint32_t initrd_count(void);
+
+// The i-th file in name order: its contents, and its NUL-terminated name and
+// length through name/size (either may be 0). Returns 0 past the end.
+const void* initrd_get(uint32_t i, const char** name, uint32_t* size);
+
+void initrd_report(void); // klog the file count and size
+
+#ifdef CONFIG_BENCH
+void initrd_bench(void); // Lookup cost and read throughput over every file
+#endif
+
+#endif // INITRD_H
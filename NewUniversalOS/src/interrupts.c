@@ -1,7 +1,10 @@
 #include "idt.h"
-#include "vga_text.h"
-#include "serial.h"   // For serial_print_* functions
-#include "ports.h"    // For inb function
+#include "klog.h"
+#include "sched.h"    // For sched_irq_exit
+#include "ports.h"    // For inb/outb (PIC registers)
+#include "trace.h"
+#include "apic.h"     // For the I/O APIC once it replaces the PICs
+#include "user.h"     // For user_fault
 #include <stdint.h>   // For uintN_t types
 
 // Array of exception messages
@@ -15,110 +18,142 @@ const char *exception_messages[] = {
     "Hypervisor Injection Exception", "VMM Communication Exception", "Security Exception", "Reserved"
 };
 
-volatile uint32_t timer_ticks = 0;
-char spinner_chars[] = {'-', '\\', '|', '/'}; // Note: double backslash for literal backslash
-uint8_t spinner_idx = 0;
-const int VGA_WIDTH_CONST_INT = 80; 
+#define PIC_MASTER_CMD  0x20
+#define PIC_MASTER_DATA 0x21
+#define PIC_SLAVE_CMD   0xA0
+#define PIC_SLAVE_DATA  0xA1
+#define PIC_READ_ISR    0x0B // OCW3: next read of the command port returns the ISR
+#define PIC_CASCADE_IRQ 2
 
-void isr_handler_c(registers_t* regs) {
-    char default_attr = 0x0F; // White on Black for general messages
-    char irq_attr = 0x0A;     // Green on Black for IRQ messages
+// Dispatch table, indexed directly by vector
+static irq_handler_t irq_handlers[256];
+static void* irq_handler_ctx[256];
+static uint32_t irq_counts[256];
+static uint32_t irq_spurious_count = 0;
+static registers_t* irq_regs = 0; // Frame of the interrupt being handled
 
-    if (regs->int_no == 32) { // Timer Interrupt (IRQ0)
-        timer_ticks++;
+void register_irq_handler(uint8_t vector, irq_handler_t fn, void* ctx) {
+    irq_handler_ctx[vector] = ctx;
+    irq_handlers[vector] = fn;
+}
 
-        // Serial print for timer ticks
-        if ((timer_ticks % 100) == 0) { // Approx every second if PIT is 100Hz
-            serial_print_string("Timer tick: ");
-            serial_print_dec(timer_ticks);
-            serial_print_string(" (Serial)\n");
-        }
+registers_t* irq_get_regs(void) {
+    return irq_regs;
+}
+
+uint32_t irq_get_count(uint8_t vector) {
+    return irq_counts[vector];
+}
 
-        // VGA spinner logic
-        if ((timer_ticks % 20) == 0) { 
-            int old_row, old_col;
-            vga_get_cursor_pos(&old_row, &old_col);
-            vga_set_cursor_pos(0, VGA_WIDTH_CONST_INT - 1); 
-            vga_print_char(spinner_chars[spinner_idx], 0x0E); // Yellow on Black
-            vga_set_cursor_pos(old_row, old_col);     
-            spinner_idx = (spinner_idx + 1) % 4;
+uint32_t irq_get_spurious_count(void) {
+    return irq_spurious_count;
+}
+
+void irq_dump_counts(void) {
+    for (int v = 0; v < 256; v++) {
+        if (irq_counts[v]) {
+            klog(KLOG_INFO, "Vector %u: %u\n", v, irq_counts[v]);
         }
-        
-        pic_send_eoi(0); // Send EOI for IRQ0
-        return;          // Return from interrupt for IRQs
-    } else if (regs->int_no == 33) { // Keyboard Interrupt (IRQ1)
-        uint8_t scancode = inb(0x60); // Read scancode from keyboard controller data port
-
-        // Print to serial
-        serial_print_string("Keyboard Scancode (IRQ1): ");
-        serial_print_hex((uint32_t)scancode); // Cast to uint32_t for serial_print_hex
-        serial_print_string("\n");
-
-        // Also print to VGA (optional, but good for consistency if VGA was working)
-        // Example:
-        // vga_set_cursor_pos(6, 0); // Or some other designated line for keyboard
-        // vga_print_string("Keyboard Scancode: ", 0x0B); // Light Cyan on Black
-        // vga_print_hex(scancode, 0x0B);
-        // vga_print_string("\n", 0x0B);
-
-        pic_send_eoi(1); // Send EOI for IRQ1 (keyboard is on master PIC, IRQ number 1)
-        return; 
     }
-    
-    // For non-timer/non-keyboard interrupts, print messages starting from row 5 to VGA
-    // and also to serial.
-    vga_set_cursor_pos(5, 0); 
-    
-    vga_print_string("Received Interrupt: ", default_attr);
-    vga_print_dec(regs->int_no, default_attr);
-    serial_print_string("Received Interrupt: "); 
-    serial_print_dec(regs->int_no);
-    
-    if (regs->int_no < 32) { // CPU Exception
-        vga_print_string(" (", default_attr);
-        serial_print_string(" (");
-        if (regs->int_no < sizeof(exception_messages)/sizeof(const char*)) {
-            vga_print_string(exception_messages[regs->int_no], default_attr);
-            serial_print_string(exception_messages[regs->int_no]);
-        } else {
-            vga_print_string("Unknown Exception", default_attr);
-            serial_print_string("Unknown Exception");
+    klog(KLOG_INFO, "Spurious IRQs: %u\n", irq_spurious_count);
+}
+
+void irq_unmask(uint8_t irq) {
+    if (apic_enabled()) {
+        ioapic_unmask_irq(irq);
+        return;
+    }
+    uint16_t port = irq < 8 ? PIC_MASTER_DATA : PIC_SLAVE_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+    if (irq >= 8) {
+        irq_unmask(PIC_CASCADE_IRQ); // Slave IRQs arrive through the cascade line
+    }
+}
+
+void irq_mask(uint8_t irq) {
+    if (apic_enabled()) {
+        ioapic_mask_irq(irq);
+        return;
+    }
+    uint16_t port = irq < 8 ? PIC_MASTER_DATA : PIC_SLAVE_DATA;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+static void irq_eoi(uint8_t irq) {
+    if (apic_enabled()) {
+        lapic_eoi();
+    } else {
+        pic_send_eoi(irq);
+    }
+}
+
+// IRQ7 and IRQ15 are raised as spurious interrupts when a request goes away
+// before the PIC can deliver it. Those have no ISR bit set and must not get an EOI.
+static int pic_irq_is_spurious(uint8_t irq) {
+    uint16_t cmd = irq < 8 ? PIC_MASTER_CMD : PIC_SLAVE_CMD;
+    outb(cmd, PIC_READ_ISR);
+    return !(inb(cmd) & (1 << (irq & 7)));
+}
+
+static void unhandled_exception(registers_t* regs) {
+    if ((regs->cs & 3) == 3) {
+        user_fault(regs); // Only the task dies
+    }
+    klog(KLOG_ERROR, "Received Interrupt: %u (%s)\n", regs->int_no,
+         exception_messages[regs->int_no]);
+    klog(KLOG_ERROR, "Error Code: 0x%08x EIP: 0x%08x\n", regs->err_code, regs->eip);
+    klog(KLOG_ERROR, "System Halted!\n");
+
+    // Interrupts stay off from here on: write everything out synchronously
+    klog_panic_dump();
+    asm volatile ("cli; hlt");
+}
+
+void isr_handler_c(registers_t* regs) {
+    uint8_t vector = (uint8_t)regs->int_no;
+    irq_handler_t handler = irq_handlers[vector];
+    uint64_t entry_tsc = trace_irq_enter(vector);
+
+    if (vector >= IRQ_BASE_VECTOR && vector < IRQ_VECTOR(16)) { // ISA IRQ
+        uint8_t irq = vector - IRQ_BASE_VECTOR;
+        if ((irq == 7 || irq == 15) && !apic_enabled() && pic_irq_is_spurious(irq)) {
+            irq_spurious_count++;
+            if (irq == 15) {
+                pic_send_eoi(PIC_CASCADE_IRQ); // The master did see a real cascade request
+            }
+            trace_irq_exit(vector, entry_tsc);
+            return;
         }
-        vga_print_string(")", default_attr);
-        serial_print_string(")");
-
-        vga_print_string("\nError Code: ", default_attr);
-        vga_print_hex(regs->err_code, default_attr);
-        serial_print_string("\nError Code: ");
-        serial_print_hex(regs->err_code);
-
-        vga_print_string("\nSystem Halted!\n", 0x0C); // Red on Black for halt message
-        serial_print_string("\nSystem Halted!\n");
-        
-        asm volatile ("cli; hlt");
-    } else if (regs->int_no > 33 && regs->int_no < 48) { // Adjusted condition to exclude 33
-        vga_print_string(" (IRQ ", irq_attr);
-        vga_print_dec(regs->int_no - 32, irq_attr); 
-        vga_print_string(")\n", irq_attr);
-
-        serial_print_string(" (IRQ ");
-        serial_print_dec(regs->int_no - 32);
-        serial_print_string(")\n");
-
-        pic_send_eoi((unsigned char)(regs->int_no - 32));
-        return; 
-    } else { 
-        vga_print_string(" (Unknown Interrupt Type)\n", default_attr);
-        serial_print_string(" (Unknown Interrupt Type)\n");
-
-        if (regs->int_no >= 32 && regs->int_no < 48) { // If it's an IRQ we didn't specifically handle
-             pic_send_eoi((unsigned char)(regs->int_no - 32)); // Still send EOI
-             return; 
+        irq_counts[vector]++;
+        registers_t* outer_regs = irq_regs;
+        irq_regs = regs;
+        if (handler) {
+            handler(regs, irq_handler_ctx[vector]);
         } else {
-            // If it's an unexpected interrupt number not from PICs and not an exception,
-            vga_print_string("Unexpected interrupt vector. System Halted!\n", 0x0C);
-            serial_print_string("Unexpected interrupt vector. System Halted!\n");
-            asm volatile("cli; hlt");
+            klog(KLOG_WARN, "Received Interrupt: %u (IRQ %u, no handler)\n", vector, irq);
         }
+        irq_regs = outer_regs;
+        irq_eoi(irq);
+        trace_event(TRACE_IRQ_EOI, irq);
+        trace_irq_exit(vector, entry_tsc);
+        sched_irq_exit(); // May switch threads; we come back here when this one runs again
+        return;
+    }
+
+    irq_counts[vector]++;
+    if (handler) {
+        handler(regs, irq_handler_ctx[vector]);
+        trace_irq_exit(vector, entry_tsc);
+        return;
     }
-}
\ No newline at end of file
+
+    if (vector < 32) { // CPU Exception
+        unhandled_exception(regs);
+    }
+
+    // An unexpected interrupt number not from the IRQ lines and not an exception
+    klog(KLOG_ERROR, "Received Interrupt: %u (Unknown Interrupt Type)\n", vector);
+    klog(KLOG_ERROR, "Unexpected interrupt vector. System Halted!\n");
+    klog_panic_dump();
+    asm volatile("cli; hlt");
+}
@@ -0,0 +1,221 @@
+#include "kbd.h"
+#include "idt.h"   // For register_irq_handler
+#include "ports.h" // For inb
+#include "sched.h"
+#include "klog.h"
+#include "cpu.h"   // For irq_save/irq_restore
+
+#define KBD_DATA_PORT   0x60
+#define KBD_STATUS_PORT 0x64
+#define KBD_STATUS_OUTPUT_FULL 0x01
+
+#define KBD_PRIORITY 2 // Decode right away so the raw ring stays short
+
+// Controller replies that are not key codes
+#define KBD_REPLY_ERROR  0x00
+#define KBD_REPLY_ACK    0xFA
+#define KBD_REPLY_RESEND 0xFE
+#define KBD_REPLY_ERROR2 0xFF
+
+#define KBD_PREFIX_E0    0xE0
+#define KBD_PREFIX_E1    0xE1 // Pause: E1 1D 45 E1 9D C5, ignored
+#define KBD_BREAK        0x80
+#define KBD_FAKE_LSHIFT  (0x80 | KEY_LSHIFT) // E0 2A / E0 AA around Print Screen and friends
+#define KBD_FAKE_RSHIFT  (0x80 | KEY_RSHIFT)
+
+// Raw scancodes. The IRQ1 handler is the only producer and the decoder
+// thread the only consumer, so each index has a single writer and the
+// ring needs no lock: the release store of head publishes the byte, the
+// release store of tail hands its slot back.
+static volatile uint8_t sc_ring[KBD_SCANCODE_RING];
+static volatile uint32_t sc_head = 0; // Next slot to fill (IRQ1)
+static volatile uint32_t sc_tail = 0; // Next byte to decode (decoder thread)
+static wait_queue_t decoder_wq = WAIT_QUEUE_INIT;
+
+// Decoded events; readers are threads, so this ring is guarded with irq_save
+static kbd_event_t ev_ring[KBD_EVENT_RING];
+static uint32_t ev_head = 0;
+static uint32_t ev_tail = 0;
+static wait_queue_t reader_wq = WAIT_QUEUE_INIT;
+
+static kbd_stats_t stats;
+
+// Decoder state, only touched by the decoder thread
+static uint8_t prefix = 0;  // KBD_PREFIX_E0 after an E0 byte
+static uint8_t e1_skip = 0; // Bytes of a Pause sequence still to swallow
+static uint8_t mods = 0;
+static uint32_t keys_down[256 / 32];
+
+// US layout for set-1 codes 0x00-0x39
+static const char keymap[] =
+    "\0\0331234567890-=\b\tqwertyuiop[]\n\0asdfghjkl;'`\0\\zxcvbnm,./\0*\0 ";
+static const char keymap_shift[] =
+    "\0\033!@#$%^&*()_+\b\tQWERTYUIOP{}\n\0ASDFGHJKL:\"~\0|ZXCVBNM<>?\0*\0 ";
+// Keypad 0x47-0x53 with Num Lock on
+static const char keymap_keypad[] = "789-456+1230.";
+
+static void kbd_irq_handler(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+    uint8_t sc = inb(KBD_DATA_PORT);
+    uint32_t head = sc_head;
+    stats.scancodes++;
+    if (head - __atomic_load_n(&sc_tail, __ATOMIC_ACQUIRE) == KBD_SCANCODE_RING) {
+        stats.scancodes_dropped++;
+        return;
+    }
+    sc_ring[head & (KBD_SCANCODE_RING - 1)] = sc;
+    __atomic_store_n(&sc_head, head + 1, __ATOMIC_RELEASE);
+    wait_queue_wake_one(&decoder_wq);
+}
+
+static uint8_t kbd_modifier(uint8_t key) {
+    switch (key) {
+    case KEY_LSHIFT: return KBD_MOD_LSHIFT;
+    case KEY_RSHIFT: return KBD_MOD_RSHIFT;
+    case KEY_LCTRL:  return KBD_MOD_LCTRL;
+    case KEY_RCTRL:  return KBD_MOD_RCTRL;
+    case KEY_LALT:   return KBD_MOD_LALT;
+    case KEY_RALT:   return KBD_MOD_RALT;
+    default:         return 0;
+    }
+}
+
+static uint8_t kbd_ascii(uint8_t key) {
+    if (key == KEY_KP_ENTER) return '\n';
+    if (key == KEY_KP_SLASH) return '/';
+    if (key >= 0x47 && key <= 0x53) {
+        return (mods & KBD_MOD_NUM) ? keymap_keypad[key - 0x47] : 0;
+    }
+    if (key >= sizeof(keymap) - 1) {
+        return 0;
+    }
+
+    char c = keymap[key];
+    int shift = (mods & KBD_MOD_SHIFT) != 0;
+    if (c >= 'a' && c <= 'z') {
+        if (mods & KBD_MOD_CTRL) return (uint8_t)(c & 0x1F);
+        if (shift != ((mods & KBD_MOD_CAPS) != 0)) c = keymap_shift[key];
+    } else if (shift) {
+        c = keymap_shift[key];
+    }
+    return (uint8_t)c;
+}
+
+static void kbd_push_event(uint8_t key, uint8_t flags) {
+    kbd_event_t ev;
+    ev.key = key;
+    ev.flags = flags;
+    ev.mods = mods;
+    ev.ascii = (flags & KBD_EV_RELEASE) ? 0 : kbd_ascii(key);
+
+    uint32_t irq = irq_save();
+    if (ev_head - ev_tail == KBD_EVENT_RING) {
+        stats.events_dropped++;
+    } else {
+        ev_ring[ev_head & (KBD_EVENT_RING - 1)] = ev;
+        ev_head++;
+        stats.events++;
+        wait_queue_wake_one(&reader_wq);
+    }
+    irq_restore(irq);
+}
+
+static void kbd_decode(uint8_t sc) {
+    if (e1_skip) {
+        e1_skip--;
+        return;
+    }
+    switch (sc) {
+    case KBD_REPLY_ERROR:
+    case KBD_REPLY_ACK:
+    case KBD_REPLY_RESEND:
+    case KBD_REPLY_ERROR2:
+        return;
+    case KBD_PREFIX_E0:
+        prefix = KBD_PREFIX_E0;
+        return;
+    case KBD_PREFIX_E1:
+        e1_skip = 2;
+        return;
+    }
+
+    uint8_t key = sc & ~KBD_BREAK;
+    if (prefix) {
+        key |= 0x80;
+        prefix = 0;
+        if (key == KBD_FAKE_LSHIFT || key == KBD_FAKE_RSHIFT) {
+            return;
+        }
+    }
+
+    uint32_t bit = 1u << (key & 31);
+    uint32_t* word = &keys_down[key >> 5];
+    if (sc & KBD_BREAK) {
+        *word &= ~bit;
+        mods &= ~kbd_modifier(key);
+        kbd_push_event(key, KBD_EV_RELEASE);
+        return;
+    }
+
+    uint8_t flags = (*word & bit) ? KBD_EV_REPEAT : 0;
+    *word |= bit;
+    mods |= kbd_modifier(key);
+    if (!flags) {
+        if (key == KEY_CAPSLOCK) mods ^= KBD_MOD_CAPS;
+        if (key == KEY_NUMLOCK) mods ^= KBD_MOD_NUM;
+    }
+    kbd_push_event(key, flags);
+}
+
+static void kbd_decoder_thread(void* arg) {
+    (void)arg;
+    for (;;) {
+        uint32_t flags = irq_save();
+        while (sc_tail == __atomic_load_n(&sc_head, __ATOMIC_ACQUIRE)) {
+            wait_queue_sleep(&decoder_wq);
+        }
+        irq_restore(flags);
+
+        // Decode with interrupts on; IRQ1 keeps filling the ring meanwhile
+        uint32_t head = __atomic_load_n(&sc_head, __ATOMIC_ACQUIRE);
+        uint32_t tail = sc_tail;
+        while (tail != head) {
+            uint8_t sc = sc_ring[tail & (KBD_SCANCODE_RING - 1)];
+            __atomic_store_n(&sc_tail, ++tail, __ATOMIC_RELEASE);
+            kbd_decode(sc);
+        }
+    }
+}
+
+void kbd_init(void) {
+    // Throw away anything typed before we were listening
+    while (inb(KBD_STATUS_PORT) & KBD_STATUS_OUTPUT_FULL) {
+        inb(KBD_DATA_PORT);
+    }
+    register_irq_handler(IRQ_VECTOR(KBD_IRQ), kbd_irq_handler, 0);
+    if (!thread_create("kbd", kbd_decoder_thread, 0, KBD_PRIORITY)) {
+        klog(KLOG_WARN, "kbd: could not start the decoder thread\n");
+    }
+}
+
+int kbd_read_event(kbd_event_t* ev, uint32_t flags) {
+    uint32_t irq = irq_save();
+    while (ev_tail == ev_head) {
+        if (flags & KBD_NONBLOCK) {
+            irq_restore(irq);
+            return -1;
+        }
+        wait_queue_sleep(&reader_wq);
+    }
+    *ev = ev_ring[ev_tail & (KBD_EVENT_RING - 1)];
+    ev_tail++;
+    irq_restore(irq);
+    return 0;
+}
+
+void kbd_get_stats(kbd_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
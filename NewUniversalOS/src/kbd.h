@@ -0,0 +1,89 @@
+#ifndef KBD_H
+#define KBD_H
+
+#include <stdint.h>
+
+// PS/2 keyboard. The IRQ1 handler only moves scancodes from the controller
+// into a lock-free ring; a decoder thread turns them (scan code set 1, as
+// translated by the 8042) into key events for kbd_read_event().
+
+#define KBD_IRQ 1
+
+#define KBD_SCANCODE_RING 256 // Raw scancodes (power of two)
+#define KBD_EVENT_RING    128 // Decoded events (power of two)
+
+// Key codes: the set-1 make code, with 0x80 added for E0-prefixed keys
+#define KEY_ESC       0x01
+#define KEY_BACKSPACE 0x0E
+#define KEY_TAB       0x0F
+#define KEY_ENTER     0x1C
+#define KEY_LCTRL     0x1D
+#define KEY_LSHIFT    0x2A
+#define KEY_RSHIFT    0x36
+#define KEY_LALT      0x38
+#define KEY_SPACE     0x39
+#define KEY_CAPSLOCK  0x3A
+#define KEY_F1        0x3B // F1-F10 are consecutive
+#define KEY_NUMLOCK   0x45
+#define KEY_F11       0x57
+#define KEY_F12       0x58
+#define KEY_KP_ENTER  0x9C
+#define KEY_RCTRL     0x9D
+#define KEY_KP_SLASH  0xB5
+#define KEY_RALT      0xB8
+#define KEY_HOME      0xC7
+#define KEY_UP        0xC8
+#define KEY_PAGEUP    0xC9
+#define KEY_LEFT      0xCB
+#define KEY_RIGHT     0xCD
+#define KEY_END       0xCF
+#define KEY_DOWN      0xD0
+#define KEY_PAGEDOWN  0xD1
+#define KEY_INSERT    0xD2
+#define KEY_DELETE    0xD3
+
+// Modifier state, as it was after the event
+#define KBD_MOD_LSHIFT 0x01
+#define KBD_MOD_RSHIFT 0x02
+#define KBD_MOD_LCTRL  0x04
+#define KBD_MOD_RCTRL  0x08
+#define KBD_MOD_LALT   0x10
+#define KBD_MOD_RALT   0x20
+#define KBD_MOD_CAPS   0x40 // Caps Lock on
+#define KBD_MOD_NUM    0x80 // Num Lock on
+#define KBD_MOD_SHIFT  (KBD_MOD_LSHIFT | KBD_MOD_RSHIFT)
+#define KBD_MOD_CTRL   (KBD_MOD_LCTRL | KBD_MOD_RCTRL)
+#define KBD_MOD_ALT    (KBD_MOD_LALT | KBD_MOD_RALT)
+
+// Event flags
+#define KBD_EV_RELEASE 0x01
+#define KBD_EV_REPEAT  0x02 // Typematic repeat of a key already held down
+
+typedef struct {
+    uint8_t key;   // KEY_* code
+    uint8_t ascii; // Character for presses and repeats (US layout), or 0
+    uint8_t flags; // KBD_EV_*
+    uint8_t mods;  // KBD_MOD_*
+} kbd_event_t;
+
+typedef struct {
+    uint32_t scancodes;         // Bytes read from the controller
+    uint32_t scancodes_dropped; // Lost because the decoder fell a whole ring behind
+    uint32_t events;            // Key events decoded
+    uint32_t events_dropped;    // Lost because nobody was reading them
+} kbd_stats_t;
+
+// Flush the controller, install the IRQ1 handler and start the decoder
+// thread. Needs the scheduler; the caller unmasks KBD_IRQ.
+void kbd_init(void);
+
+// kbd_read_event flag: return -1 instead of sleeping when no event is queued
+#define KBD_NONBLOCK 0x1
+
+// Take the oldest key event. Returns 0, or -1 with KBD_NONBLOCK if there
+// is none. Without it, call from a thread: it sleeps until a key arrives.
+int kbd_read_event(kbd_event_t* ev, uint32_t flags);
+
+void kbd_get_stats(kbd_stats_t* out);
+
+#endif // KBD_H
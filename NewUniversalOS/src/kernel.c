@@ -2,125 +2,272 @@
 #include "vga_text.h"
 #include "idt.h"
 #include "pit.h"
+#include "clock.h"
+#include "timer.h"
+#include "pmm.h"
+#include "slab.h"
+#include "paging.h"
+#include "sched.h"
 #include "serial.h"
 #include "ports.h"    // For inb/outb for PIC unmasking
+#include "klog.h"
+#include "bootinfo.h"
+#include "cpu.h"      // For rdtsc
+#include "klib.h"
+#include "gfx.h"
+#include "home.h"
+#include "prof.h"
+#include "trace.h"
+#include "dbgcon.h"
+#include "bench.h"
+#include "kbd.h"
+#include "gdt.h"
+#include "smp.h"
+#include "syscall.h"
+#include "pci.h"
+#include "bcache.h"
+#include "initrd.h"
 
-// Global IDT and IDT pointer (definitions, not extern)
-idt_entry_t idt[256];
-idt_ptr_t idt_p;
-
-// Function to set an IDT entry (defined in kernel.c)
+// Override a gate of the assembled IDT (idt_table in idt.asm), e.g. to
+// install a handler for a vector above 47. Only valid after idt_fixup.
 void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags) {
-    idt[num].base_low = (base & 0xFFFF);
-    idt[num].base_high = (base >> 16) & 0xFFFF;
-    idt[num].selector = sel;
-    idt[num].always0 = 0;
-    idt[num].flags = flags;
+    idt_table[num].base_low = (base & 0xFFFF);
+    idt_table[num].base_high = (base >> 16) & 0xFFFF;
+    idt_table[num].selector = sel;
+    idt_table[num].always0 = 0;
+    idt_table[num].flags = flags;
 }
 
 // Initialize the IDT (defined in kernel.c)
+// The gates for exceptions 0-31 and IRQs 0-15 are built at assemble time;
+// all that is left is swizzling them into place and loading IDTR.
 void idt_init() {
-    idt_p.limit = (sizeof(idt_entry_t) * 256) - 1;
-    idt_p.base = (uint32_t)&idt;
+    idt_fixup();      // Put the assembled gates into hardware layout
+    pic_remap();      // Remap the PIC
+    idt_load(&idt_descriptor); // Load the IDT pointer
+}
+
+// Keyboard consumer. Nothing reads the keyboard yet, so this only counts
+// and hashes the characters typed; 'k' on the debug console reports them,
+// which is how tools/kbdburst.py checks that a burst of keys got through.
+#define KEYBOARD_PRIORITY 16
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME  16777619u
+
+static uint32_t typed_chars = 0;
+static uint32_t typed_hash = FNV_OFFSET; // FNV-1a over every character typed
 
-    unsigned char *idt_ptr_byte = (unsigned char *)&idt;
-    for(unsigned int i = 0; i < sizeof(idt_entry_t) * 256; i++) {
-        idt_ptr_byte[i] = 0;
+static void keyboard_thread(void* arg) {
+    (void)arg;
+    kbd_event_t ev;
+    for (;;) {
+        kbd_read_event(&ev, 0);
+        if (ev.ascii) {
+            typed_chars++;
+            typed_hash = (typed_hash ^ ev.ascii) * FNV_PRIME;
+        }
     }
+}
 
-    // ISRs 0-31 for exceptions
-    idt_set_gate(0, (uint32_t)isr0, 0x08, 0x8E);
-    idt_set_gate(1, (uint32_t)isr1, 0x08, 0x8E);
-    idt_set_gate(2, (uint32_t)isr2, 0x08, 0x8E);
-    idt_set_gate(3, (uint32_t)isr3, 0x08, 0x8E);
-    idt_set_gate(4, (uint32_t)isr4, 0x08, 0x8E);
-    idt_set_gate(5, (uint32_t)isr5, 0x08, 0x8E);
-    idt_set_gate(6, (uint32_t)isr6, 0x08, 0x8E);
-    idt_set_gate(7, (uint32_t)isr7, 0x08, 0x8E);
-    idt_set_gate(8, (uint32_t)isr8, 0x08, 0x8E);
-    idt_set_gate(9, (uint32_t)isr9, 0x08, 0x8E);
-    idt_set_gate(10, (uint32_t)isr10, 0x08, 0x8E);
-    idt_set_gate(11, (uint32_t)isr11, 0x08, 0x8E);
-    idt_set_gate(12, (uint32_t)isr12, 0x08, 0x8E);
-    idt_set_gate(13, (uint32_t)isr13, 0x08, 0x8E);
-    idt_set_gate(14, (uint32_t)isr14, 0x08, 0x8E);
-    idt_set_gate(15, (uint32_t)isr15, 0x08, 0x8E);
-    idt_set_gate(16, (uint32_t)isr16, 0x08, 0x8E);
-    idt_set_gate(17, (uint32_t)isr17, 0x08, 0x8E);
-    idt_set_gate(18, (uint32_t)isr18, 0x08, 0x8E);
-    idt_set_gate(19, (uint32_t)isr19, 0x08, 0x8E);
-    idt_set_gate(20, (uint32_t)isr20, 0x08, 0x8E);
-    idt_set_gate(21, (uint32_t)isr21, 0x08, 0x8E);
-    idt_set_gate(22, (uint32_t)isr22, 0x08, 0x8E);
-    idt_set_gate(23, (uint32_t)isr23, 0x08, 0x8E);
-    idt_set_gate(24, (uint32_t)isr24, 0x08, 0x8E);
-    idt_set_gate(25, (uint32_t)isr25, 0x08, 0x8E);
-    idt_set_gate(26, (uint32_t)isr26, 0x08, 0x8E);
-    idt_set_gate(27, (uint32_t)isr27, 0x08, 0x8E);
-    idt_set_gate(28, (uint32_t)isr28, 0x08, 0x8E);
-    idt_set_gate(29, (uint32_t)isr29, 0x08, 0x8E);
-    idt_set_gate(30, (uint32_t)isr30, 0x08, 0x8E);
-    idt_set_gate(31, (uint32_t)isr31, 0x08, 0x8E);
-    
-    // Setup IRQ0 (Timer) mapped to INT 32
-    idt_set_gate(32, (uint32_t)isr32, 0x08, 0x8E);
-    // Setup IRQ1 (Keyboard) mapped to INT 33
-    idt_set_gate(33, (uint32_t)isr33, 0x08, 0x8E); 
+static void keyboard_report(void) {
+    kbd_stats_t st;
+    kbd_get_stats(&st);
+    klog(KLOG_INFO, "kbd: %u scancodes (%u dropped), %u events (%u dropped)\n",
+         st.scancodes, st.scancodes_dropped, st.events, st.events_dropped);
+    klog(KLOG_INFO, "kbd: typed %u chars, hash %08x\n", typed_chars, typed_hash);
+}
 
-    pic_remap();      // Remap the PIC
-    idt_load(&idt_p); // Load the IDT pointer
+// Periodic work runs from timers that re-add themselves from their callback
+#define SPINNER_PERIOD_NS   (200 * NSEC_PER_MSEC)
+#define HEARTBEAT_PERIOD_NS (1000ULL * NSEC_PER_MSEC)
+#define PROFILE_DUMP_NS     (15ULL * NSEC_PER_SEC) // make profile captures 20 s
+
+static void spinner_timer(void* arg) {
+    static const char spinner_chars[] = {'-', '\\', '|', '/'};
+    static uint8_t spinner_idx = 0;
+    (void)arg;
+
+    vga_put_char_at(0, 79, spinner_chars[spinner_idx], 0x0E); // Top-right corner, yellow on black
+    spinner_idx = (spinner_idx + 1) % 4;
+
+    timer_add(SPINNER_PERIOD_NS, spinner_timer, 0);
 }
 
-// Kernel entry point
-void kmain() {
+static void heartbeat_timer(void* arg) {
+    (void)arg;
+    klog(KLOG_DEBUG, "Uptime %u ms\n", (uint32_t)div_u64_u32(ktime_ns(), NSEC_PER_MSEC));
+    timer_add(HEARTBEAT_PERIOD_NS, heartbeat_timer, 0);
+}
+
+// Copy of the loader's boot_info_t; the original lives in low memory that
+// later subsystems are free to reuse
+static boot_info_t boot_info;
+
+// Kernel entry point, called from _start in entry.asm
+void kmain(boot_info_t* info) {
+    uint64_t tsc_kmain = rdtsc();
+    if (info && info->magic == BOOT_INFO_MAGIC) {
+        boot_info = *info;
+    }
+
+    // Our own GDT, with a per-CPU GS segment: tracepoints find this CPU's
+    // ring through it, so this comes before anything that might trace
+    gdt_init();
+
+    // Enable SSE and pick the mem* routines this CPU runs fastest
+    klib_init();
+
     // Initialize VGA and clear screen
     vga_clear_screen(0x07); // White on black
 
     // Initialize COM1 serial port
+    trace_boot_phase("serial");
     serial_init();
-    serial_print_string("Serial COM1 Initialized.\n");
+    klog(KLOG_INFO, "Serial COM1 Initialized.\n");
+    if (boot_info.magic == BOOT_INFO_MAGIC) {
+        // Cycle counts are reported in units of 1024 to stay within 32 bits
+        klog(KLOG_INFO, "Boot: kernel %u bytes from drive 0x%02x, load %u Kcycles, loader->kmain %u Kcycles\n",
+             boot_info.kernel_size, boot_info.boot_drive,
+             (uint32_t)((boot_info.tsc_kernel_loaded - boot_info.tsc_boot) >> 10),
+             (uint32_t)((tsc_kmain - boot_info.tsc_boot) >> 10));
+        if (boot_info.lz4_packed_size) {
+            klog(KLOG_INFO, "Boot: LZ4 kernel %u -> %u bytes, decompressed in %u Kcycles\n",
+                 boot_info.lz4_packed_size, boot_info.lz4_unpacked_size,
+                 (uint32_t)(boot_info.lz4_cycles >> 10));
+        }
+    }
+
+    // Page frame allocator over the BIOS memory map. The map still sits in
+    // low memory where the loader left it; pmm_init never hands that out,
+    // nor the initrd above the kernel.
+    trace_boot_phase("pmm");
+    if (boot_info.magic == BOOT_INFO_MAGIC) {
+        pmm_init((const e820_entry_t*)boot_info.e820_map, boot_info.e820_count,
+                 boot_info.initrd_size ? boot_info.initrd_addr + boot_info.initrd_size : 0);
+    } else {
+        pmm_init(0, 0, 0);
+    }
+    trace_boot_phase("kmem");
+    kmem_init();
+    trace_boot_phase("sched");
+    sched_init(); // From here on kmain is the idle thread
 
     // Initialize Interrupt Descriptor Table and Programmable Interrupt Controllers
-    idt_init(); 
-    serial_print_string("IDT and PICs configured.\n");
-    vga_print_string("IDT and PICs configured.\n", 0x0A); // Green on Black for VGA
+    trace_boot_phase("idt");
+    BENCH_ONCE("boot.idt_init", idt_init());
+    klog(KLOG_INFO, "IDT and PICs configured.\n");
+
+    // Ring-3 entry points: the int 0x80 gate and SYSENTER. The APs program
+    // their own SYSENTER MSRs from this when they come up.
+    trace_boot_phase("syscall");
+    syscall_init();
+
+    // Identity map RAM with 4 MB pages and install the page-fault handler
+    trace_boot_phase("paging");
+    paging_init();
+
+    // The initrd is read in place where the loader left it, above the kernel
+    trace_boot_phase("initrd");
+    if (boot_info.magic == BOOT_INFO_MAGIC && initrd_init(boot_info.initrd_addr, boot_info.initrd_size) == 0) {
+        initrd_report();
+    }
 
     // Print 'K' to VGA and Serial
     vga_set_cursor_pos(0,0);
     vga_print_char('K', 0x2F); // Green background, White foreground
-    serial_print_string("K - Kernel booted.\n");
+    klog(KLOG_INFO, "K - Kernel booted.\n");
 
-    // Initialize Programmable Interval Timer (PIT)
-    pit_init(100); // Configure PIT to ~100Hz and unmask IRQ0
-    serial_print_string("PIT Initialized (100Hz), IRQ0 Unmasked.\n");
-    vga_print_string("PIT Initialized (100Hz), IRQ0 Unmasked.\n", 0x0A); // Green on Black for VGA
+    // Calibrate the TSC clocksource, then hand IRQ0 to the timer wheel.
+    // The PIT runs one-shot and is only armed when a timer is due.
+    trace_boot_phase("clock");
+    BENCH_ONCE("boot.clock_init", clock_init());
+
+    // Move from the 8259s to the I/O APIC if there is one. Nothing is
+    // unmasked yet, so every IRQ below is routed the new way.
+    trace_boot_phase("smp");
+    smp_init();
+    trace_boot_phase("timers");
+    timer_init();
+    BENCH_ONCE("boot.pit_init", pit_init());
+    klog(KLOG_INFO, "TSC %u kHz, PIT in one-shot mode, IRQ0 Unmasked.\n", clock_tsc_khz());
+    timer_add(SPINNER_PERIOD_NS, spinner_timer, 0);
+    timer_add(HEARTBEAT_PERIOD_NS, heartbeat_timer, 0);
     
-    // Unmask IRQ1 (Keyboard)
-    serial_print_string("Unmasking IRQ1 (Keyboard)...\n");
-    vga_print_string("Unmasking IRQ1 (Keyboard)...\n", 0x0A);
-    uint8_t pic_mask = inb(0x21); // Read current mask from Master PIC data port (0x21)
-    outb(0x21, pic_mask & 0xFD);   // Clear bit 1 (0xFD = 11111101b) to unmask IRQ1
+    // Unmask IRQ4 (COM1) so the serial TX/RX rings are serviced by interrupts
+    trace_boot_phase("irqs");
+    irq_unmask(COM1_IRQ);
        
     // Enable interrupts
     asm volatile ("sti");
-    serial_print_string("Interrupts Enabled.\n");
+    klog(KLOG_INFO, "Interrupts Enabled.\n");
+
+    // Unmask IRQ1 (Keyboard). Its handler only queues scancodes; they are
+    // decoded on a thread, so this has to wait until threads can run.
+    kbd_init();
+    irq_unmask(KBD_IRQ);
+    klog(KLOG_INFO, "IRQ1 (Keyboard) Unmasked.\n");
+
+    // Bring up the other CPUs; they idle until sent a cross-CPU call
+    trace_boot_phase("aps");
+    smp_boot_aps();
+    if (!thread_create("keyboard", keyboard_thread, 0, KEYBOARD_PRIORITY)) {
+        klog(KLOG_WARN, "kbd: could not start the keyboard thread\n");
+    }
+
+    // Find PCI devices and bind drivers; a virtio-console starts mirroring
+    // the log and IDE disks appear behind the block cache
+    trace_boot_phase("pci");
+    bcache_init();
+    pci_init();
+
+    // The loader left the display in mode 13h; draw the home screen there
+    if (gfx_init((uint8_t*)GFX_MODE13_FB, GFX_MODE13_WIDTH, GFX_MODE13_HEIGHT, GFX_MODE13_WIDTH) == 0) {
+        home_start();
+    } else {
+        klog(KLOG_WARN, "gfx: no memory for the back buffer\n");
+    }
+
+    // Single-key debug commands on the serial port ('?' lists them)
+    prof_init();
+    trace_init();
+    dbgcon_register('k', keyboard_report, "log keyboard counters and a hash of the text typed");
+    dbgcon_start();
+
+#ifdef CONFIG_PROFILE
+    // Sample everything from here on and dump once for make profile
+    prof_start(PROF_DEFAULT_HZ, PROF_STACKS);
+    dbgcon_run_after('p', PROFILE_DUMP_NS);
+#endif
+
+#ifdef CONFIG_BENCH
+    bench_start();
+#endif
 
     // The divide-by-zero test for Exception 0 should be commented out
     // to allow the timer interrupt (IRQ0 / INT 32) to be the primary interrupt tested.
     /*
-    vga_print_string("Attempting divide by zero...\n", 0x0F);
-    serial_print_string("Attempting divide by zero...\n");
+    klog(KLOG_INFO, "Attempting divide by zero...\n");
     int x = 5;
     int y = 0;
     int z = x / y; 
     if (z == 123) { // To use z, won't be reached
-        vga_print_string("This should not print!\n", 0x0C);
-        serial_print_string("This should not print!\n");
+        klog(KLOG_ERROR, "This should not print!\n");
     }
     */
 
-    // Idle loop
+    trace_boot_phase("idle");
+
+    // Idle loop, run whenever no other thread is ready: format and write out
+    // queued log records, then sleep until the next interrupt. The
+    // check-then-halt runs with interrupts off so a record logged in between
+    // still wakes us ("sti; hlt" is atomic).
     while (1) {
-        asm volatile ("hlt");
+        klog_drain();
+        asm volatile ("cli");
+        if (klog_pending()) {
+            asm volatile ("sti");
+            continue;
+        }
+        asm volatile ("sti; hlt");
     }
 }
\ No newline at end of file
@@ -0,0 +1,326 @@
+#include "klib.h"
+#include "klog.h"
+#include "cpu.h"
+#ifdef CONFIG_BENCH
+#include "pmm.h"
+#include "bench.h"
+#endif
+
+#define CR0_MP 0x00000002 // WAIT/FWAIT honours TS
+#define CR0_EM 0x00000004 // Set: no FPU, all FPU/SSE instructions trap
+#define CR0_TS 0x00000008
+#define CR4_OSFXSR     0x00000200 // OS saves state with FXSAVE, SSE enabled
+#define CR4_OSXMMEXCPT 0x00000400 // Unmasked SIMD exceptions raise #XM, not #UD
+
+#define CPUID_EDX_FXSR (1u << 24)
+#define CPUID_EDX_SSE  (1u << 25)
+#define CPUID_EDX_SSE2 (1u << 26)
+#define CPUID_7_EBX_ERMS (1u << 9) // Enhanced rep movsb/stosb
+
+// The XMM registers are not part of a thread's saved context, so every SSE
+// loop below runs with interrupts disabled and leaves nothing live in them
+// across an irq_restore(). Chunks keep the interrupts-off windows short.
+#define SSE_CHUNK 4096
+
+typedef void (*copy_fn_t)(void* dst, const void* src, size_t n);
+typedef void (*fill_fn_t)(void* dst, uint32_t pattern, size_t n); // pattern: byte repeated 4 times
+
+typedef uint32_t __attribute__((may_alias)) u32_alias_t;
+
+static int have_sse2 = 0;
+static int have_erms = 0;
+
+// --- String instruction variants ---
+
+static void copy_movsb(void* dst, const void* src, size_t n) {
+    asm volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+}
+
+static void copy_movsd(void* dst, const void* src, size_t n) {
+    size_t tail = n & 3;
+    n >>= 2;
+    asm volatile ("rep movsl\n\t"
+                  "mov %3, %%ecx\n\t"
+                  "rep movsb"
+                  : "+D"(dst), "+S"(src), "+c"(n) : "r"(tail) : "memory");
+}
+
+static void fill_stosb(void* dst, uint32_t pattern, size_t n) {
+    asm volatile ("rep stosb" : "+D"(dst), "+c"(n) : "a"(pattern) : "memory");
+}
+
+static void fill_stosd(void* dst, uint32_t pattern, size_t n) {
+    size_t tail = n & 3;
+    n >>= 2;
+    asm volatile ("rep stosl\n\t"
+                  "mov %2, %%ecx\n\t"
+                  "rep stosb"
+                  : "+D"(dst), "+c"(n) : "r"(tail), "a"(pattern) : "memory");
+}
+
+// --- SSE2 variants: 64 bytes per iteration into a 16-byte aligned destination ---
+
+// Bytes to copy or fill before dst is 16-byte aligned
+static inline size_t sse_head(const void* dst) {
+    return (size_t)(-(uintptr_t)dst & 15);
+}
+
+static void copy_sse2_loop(uint8_t* dst, const uint8_t* src, size_t n, int nontemporal) {
+    size_t head = sse_head(dst);
+    copy_movsb(dst, src, head);
+    dst += head;
+    src += head;
+    n -= head;
+
+    while (n >= 64) {
+        size_t len = n < SSE_CHUNK ? (n & ~(size_t)63) : SSE_CHUNK;
+        uint32_t flags = irq_save();
+        if (nontemporal) {
+            asm volatile ("1:\n\t"
+                          "prefetchnta 256(%1)\n\t"
+                          "movdqu   (%1), %%xmm0\n\t"
+                          "movdqu 16(%1), %%xmm1\n\t"
+                          "movdqu 32(%1), %%xmm2\n\t"
+                          "movdqu 48(%1), %%xmm3\n\t"
+                          "movntdq %%xmm0,   (%0)\n\t"
+                          "movntdq %%xmm1, 16(%0)\n\t"
+                          "movntdq %%xmm2, 32(%0)\n\t"
+                          "movntdq %%xmm3, 48(%0)\n\t"
+                          "add $64, %1\n\t"
+                          "add $64, %0\n\t"
+                          "sub $64, %2\n\t"
+                          "jnz 1b\n\t"
+                          "sfence"
+                          : "+r"(dst), "+r"(src), "+r"(len) : : "memory");
+        } else {
+            asm volatile ("1:\n\t"
+                          "movdqu   (%1), %%xmm0\n\t"
+                          "movdqu 16(%1), %%xmm1\n\t"
+                          "movdqu 32(%1), %%xmm2\n\t"
+                          "movdqu 48(%1), %%xmm3\n\t"
+                          "movdqa %%xmm0,   (%0)\n\t"
+                          "movdqa %%xmm1, 16(%0)\n\t"
+                          "movdqa %%xmm2, 32(%0)\n\t"
+                          "movdqa %%xmm3, 48(%0)\n\t"
+                          "add $64, %1\n\t"
+                          "add $64, %0\n\t"
+                          "sub $64, %2\n\t"
+                          "jnz 1b"
+                          : "+r"(dst), "+r"(src), "+r"(len) : : "memory");
+        }
+        irq_restore(flags);
+        n = n < SSE_CHUNK ? (n & 63) : n - SSE_CHUNK;
+    }
+    copy_movsb(dst, src, n);
+}
+
+static void copy_sse2(void* dst, const void* src, size_t n) {
+    copy_sse2_loop(dst, src, n, 0);
+}
+
+static void copy_sse2_nt(void* dst, const void* src, size_t n) {
+    copy_sse2_loop(dst, src, n, 1);
+}
+
+static void fill_sse2_nt(void* dst, uint32_t pattern, size_t n) {
+    uint8_t* d = dst;
+    size_t head = sse_head(d);
+    fill_stosb(d, pattern, head);
+    d += head;
+    n -= head;
+
+    while (n >= 64) {
+        size_t len = n < SSE_CHUNK ? (n & ~(size_t)63) : SSE_CHUNK;
+        uint32_t flags = irq_save();
+        asm volatile ("movd %2, %%xmm0\n\t"
+                      "pshufd $0, %%xmm0, %%xmm0\n\t"
+                      "1:\n\t"
+                      "movntdq %%xmm0,   (%0)\n\t"
+                      "movntdq %%xmm0, 16(%0)\n\t"
+                      "movntdq %%xmm0, 32(%0)\n\t"
+                      "movntdq %%xmm0, 48(%0)\n\t"
+                      "add $64, %0\n\t"
+                      "sub $64, %1\n\t"
+                      "jnz 1b\n\t"
+                      "sfence"
+                      : "+r"(d), "+r"(len) : "r"(pattern) : "memory");
+        irq_restore(flags);
+        n = n < SSE_CHUNK ? (n & 63) : n - SSE_CHUNK;
+    }
+    fill_stosb(d, pattern, n);
+}
+
+// Picked by klib_init() for KLIB_SMALL_SIZE <= n < KLIB_NT_THRESHOLD
+static copy_fn_t copy_medium = copy_movsd;
+static fill_fn_t fill_medium = fill_stosd;
+static const char* copy_medium_name = "rep movsd";
+
+void* memcpy(void* dst, const void* src, size_t n) {
+    if (n < KLIB_SMALL_SIZE) {
+        copy_movsd(dst, src, n);
+    } else if (n >= KLIB_NT_THRESHOLD && have_sse2) {
+        copy_sse2_nt(dst, src, n);
+    } else {
+        copy_medium(dst, src, n);
+    }
+    return dst;
+}
+
+void* memmove(void* dst, const void* src, size_t n) {
+    if ((uintptr_t)dst - (uintptr_t)src >= n) {
+        // dst is below src or past its end: a forward copy never reads a
+        // byte it has already overwritten
+        return memcpy(dst, src, n);
+    }
+
+    // Overlapping with dst above src: copy top down, the odd tail bytes
+    // first and then whole dwords. The interrupt stubs clear DF, so
+    // handlers running in the middle of this are unaffected.
+    uint8_t* d = (uint8_t*)dst + n - 1;
+    const uint8_t* s = (const uint8_t*)src + n - 1;
+    size_t tail = n & 3;
+    asm volatile ("std\n\t"
+                  "rep movsb\n\t"
+                  "sub $3, %%esi\n\t"
+                  "sub $3, %%edi\n\t"
+                  "mov %3, %%ecx\n\t"
+                  "rep movsl\n\t"
+                  "cld"
+                  : "+D"(d), "+S"(s), "+c"(tail) : "r"(n >> 2) : "memory");
+    return dst;
+}
+
+void* memset(void* dst, int c, size_t n) {
+    uint32_t pattern = (uint8_t)c * 0x01010101u;
+    if (n < KLIB_SMALL_SIZE) {
+        fill_stosd(dst, pattern, n);
+    } else if (n >= KLIB_NT_THRESHOLD && have_sse2) {
+        fill_sse2_nt(dst, pattern, n);
+    } else {
+        fill_medium(dst, pattern, n);
+    }
+    return dst;
+}
+
+void* memset16(void* dst, uint16_t value, size_t count) {
+    uint32_t pattern = value | (uint32_t)value << 16;
+    void* d = dst;
+    size_t pairs = count >> 1;
+    asm volatile ("rep stosl" : "+D"(d), "+c"(pairs) : "a"(pattern) : "memory");
+    if (count & 1) {
+        *(uint16_t*)d = value;
+    }
+    return dst;
+}
+
+int memcmp(const void* a, const void* b, size_t n) {
+    const uint8_t* p = a;
+    const uint8_t* q = b;
+    // Skip the equal prefix a dword at a time, then find the differing byte
+    while (n >= 4 && *(const u32_alias_t*)p == *(const u32_alias_t*)q) {
+        p += 4;
+        q += 4;
+        n -= 4;
+    }
+    for (; n; n--, p++, q++) {
+        if (*p != *q) {
+            return *p - *q;
+        }
+    }
+    return 0;
+}
+
+void klib_init(void) {
+    uint32_t max_leaf, a, b, c, d;
+    cpuid(0, &max_leaf, &b, &c, &d);
+    cpuid(1, &a, &b, &c, &d);
+    uint32_t features = d;
+    if (max_leaf >= 7) {
+        cpuid(7, &a, &b, &c, &d);
+        have_erms = (b & CPUID_7_EBX_ERMS) != 0;
+    }
+
+    if ((features & (CPUID_EDX_FXSR | CPUID_EDX_SSE | CPUID_EDX_SSE2)) ==
+        (CPUID_EDX_FXSR | CPUID_EDX_SSE | CPUID_EDX_SSE2)) {
+        write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP);
+        write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+        asm volatile ("fninit");
+        have_sse2 = 1;
+    }
+
+    // Fast-string microcode beats a 16-byte loop for everything that still
+    // fits in cache; without it, SSE2 wins over rep movsd
+    if (have_erms) {
+        copy_medium = copy_movsb;
+        fill_medium = fill_stosb;
+        copy_medium_name = "rep movsb (ERMS)";
+    } else if (have_sse2) {
+        copy_medium = copy_sse2;
+        copy_medium_name = "SSE2";
+    }
+    klog(KLOG_INFO, "klib: SSE2 %s, memcpy uses %s, non-temporal from %u KB\n",
+         have_sse2 ? "on" : "off", copy_medium_name,
+         have_sse2 ? KLIB_NT_THRESHOLD / 1024 : 0);
+}
+
+#ifdef CONFIG_BENCH
+#define BENCH_BUF_ORDER 8                // 1 MB, the largest size measured
+#define BENCH_BYTES     (4 * 1024 * 1024) // Copied per size and variant
+#define BENCH_RUNS      3                // Best of, to skip runs hit by interrupts
+
+static const struct {
+    const char* name;
+    copy_fn_t fn;
+    int needs_sse2;
+} bench_variants[] = {
+    { "movsb", copy_movsb,   0 },
+    { "movsd", copy_movsd,   0 },
+    { "sse2",  copy_sse2,    1 },
+    { "nt",    copy_sse2_nt, 1 },
+    { "auto",  0,            0 }, // memcpy() itself, with its size thresholds
+};
+
+void klib_bench(void) {
+    phys_addr_t src = alloc_pages(BENCH_BUF_ORDER);
+    phys_addr_t dst = alloc_pages(BENCH_BUF_ORDER);
+    if (!src || !dst) {
+        klog(KLOG_WARN, "klib bench: no memory for the buffers\n");
+        if (src) free_pages(src, BENCH_BUF_ORDER);
+        if (dst) free_pages(dst, BENCH_BUF_ORDER);
+        return;
+    }
+    memset((void*)src, 0x5A, PAGE_SIZE << BENCH_BUF_ORDER);
+
+    // Results in bytes per 100 cycles, printed as a decimal fraction
+    for (uint32_t size = 16; size <= (PAGE_SIZE << BENCH_BUF_ORDER); size <<= 2) {
+        uint32_t iters = BENCH_BYTES / size;
+        for (uint32_t v = 0; v < sizeof(bench_variants) / sizeof(bench_variants[0]); v++) {
+            if (bench_variants[v].needs_sse2 && !have_sse2) {
+                continue;
+            }
+            uint64_t best = ~0ULL;
+            for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+                uint64_t t0 = rdtsc();
+                for (uint32_t i = 0; i < iters; i++) {
+                    if (bench_variants[v].fn) {
+                        bench_variants[v].fn((void*)dst, (const void*)src, size);
+                    } else {
+                        memcpy((void*)dst, (const void*)src, size);
+                    }
+                }
+                uint64_t cycles = rdtsc() - t0;
+                if (cycles < best) best = cycles;
+            }
+            uint32_t per100 = (uint32_t)div_u64_u32((uint64_t)BENCH_BYTES * 100, (uint32_t)best ? (uint32_t)best : 1);
+            klog(KLOG_INFO, "klib bench: %7u B %s: %u.%02u B/cycle\n",
+                 size, bench_variants[v].name, per100 / 100, per100 % 100);
+            if (!bench_variants[v].fn) {
+                bench_report("klib.memcpy", size, iters, best);
+            }
+        }
+    }
+
+    free_pages(src, BENCH_BUF_ORDER);
+    free_pages(dst, BENCH_BUF_ORDER);
+}
+#endif
@@ -0,0 +1,28 @@
+#ifndef KLIB_H
+#define KLIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Freestanding memory routines. These are also the symbols gcc calls for
+// struct copies and large initialisers. Until klib_init() has run they use
+// plain string instructions; afterwards the medium and large size paths are
+// picked from what CPUID reports (ERMS, SSE2).
+
+#define KLIB_SMALL_SIZE   64          // Below this, always plain rep movsd/stosd
+#define KLIB_NT_THRESHOLD (256 * 1024) // From here on, SSE2 copies bypass the cache
+
+// Enable SSE (CR0/CR4) if the CPU has it and select the implementations
+void klib_init(void);
+
+void* memcpy(void* dst, const void* src, size_t n);
+void* memmove(void* dst, const void* src, size_t n);
+void* memset(void* dst, int c, size_t n);
+void* memset16(void* dst, uint16_t value, size_t count); // count is in 16-bit units
+int memcmp(const void* a, const void* b, size_t n);
+
+#ifdef CONFIG_BENCH
+void klib_bench(void); // Bytes per cycle of each copy variant from 16 B to 1 MB
+#endif
+
+#endif // KLIB_H
@@ -0,0 +1,214 @@
+#include "klog.h"
+#include "vga_text.h"
+#include "serial.h"
+#include "clock.h"    // For clock_tsc_to_ns
+#include "cpu.h"      // For rdtsc, div_u64_u32
+#include <stdarg.h>
+
+#define KLOG_LINE_MAX 160
+
+// The ring lives in .bss and is never cleared, so after a panic halt the
+// most recent records can still be inspected from a debugger.
+klog_record_t klog_ring[KLOG_RING_SIZE];
+volatile uint32_t klog_head = 0; // Next position to reserve (writers)
+static uint32_t klog_tail = 0;   // Next position to drain (idle loop only)
+static uint32_t klog_lost_count = 0;
+static klog_sink_t klog_sink = 0;
+static int klog_sync = 0;        // Set once we are halting: write through synchronously
+
+static const char level_attr[] = {
+    0x07, // KLOG_DEBUG: grey
+    0x0F, // KLOG_INFO:  white
+    0x0E, // KLOG_WARN:  yellow
+    0x0C, // KLOG_ERROR: red
+};
+
+void klog(int level, const char* fmt, ...) {
+    // Reserving a slot is a single atomic add, so interrupt handlers that
+    // nest inside another klog() call simply take the next slot.
+    uint32_t pos = __atomic_fetch_add(&klog_head, 1, __ATOMIC_RELAXED);
+    klog_record_t* rec = &klog_ring[pos & (KLOG_RING_SIZE - 1)];
+
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED); // Invalidate while we fill it in
+    rec->tsc = rdtsc();
+    rec->fmt = fmt;
+    rec->level = (uint8_t)level;
+
+    // Capture one 32-bit argument per conversion, up to KLOG_MAX_ARGS
+    va_list ap;
+    va_start(ap, fmt);
+    uint8_t n = 0;
+    for (const char* p = fmt; *p && n < KLOG_MAX_ARGS; p++) {
+        if (*p != '%') continue;
+        p++;
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p == '\0') break;
+        if (*p == '%') continue;
+        rec->args[n++] = va_arg(ap, uint32_t);
+    }
+    va_end(ap);
+    rec->nargs = n;
+
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE); // Publish
+}
+
+// Render an unsigned number into buf (no terminator), returns the length
+static int klog_fmt_num(char* buf, uint32_t n, uint32_t base, int width, char pad) {
+    static const char digits[] = "0123456789abcdef";
+    char tmp[12];
+    int len = 0;
+    do {
+        tmp[len++] = digits[n % base];
+        n /= base;
+    } while (n);
+    int out = 0;
+    while (width-- > len) buf[out++] = pad;
+    while (len) buf[out++] = tmp[--len];
+    return out;
+}
+
+// Format one record into line. Returns the line length.
+static int klog_format(const klog_record_t* rec, char* line) {
+    int len = 0;
+    int arg = 0;
+    char num[24];
+
+    // Timestamps are converted at drain time: [seconds.microseconds] since clock_init
+    uint64_t us = div_u64_u32(clock_tsc_to_ns(rec->tsc), NSEC_PER_USEC);
+    uint32_t sec = (uint32_t)div_u64_u32(us, 1000000);
+    line[len++] = '[';
+    len += klog_fmt_num(&line[len], sec, 10, 5, ' ');
+    line[len++] = '.';
+    len += klog_fmt_num(&line[len], (uint32_t)(us - (uint64_t)sec * 1000000), 10, 6, '0');
+    line[len++] = ']';
+    line[len++] = ' ';
+
+    for (const char* p = rec->fmt; *p && len < KLOG_LINE_MAX - 1; p++) {
+        if (*p != '%') {
+            line[len++] = *p;
+            continue;
+        }
+        p++;
+        char pad = ' ';
+        int width = 0;
+        if (*p == '0') {
+            pad = '0';
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') width = width * 10 + (*p++ - '0');
+        if (*p == '\0') break;
+        if (*p == '%') {
+            line[len++] = '%';
+            continue;
+        }
+
+        uint32_t v = arg < rec->nargs ? rec->args[arg] : 0;
+        arg++;
+        const char* s = num;
+        int n = 0;
+        switch (*p) {
+            case 'u': n = klog_fmt_num(num, v, 10, width, pad); break;
+            case 'x': n = klog_fmt_num(num, v, 16, width, pad); break;
+            case 'd':
+                if ((int32_t)v < 0) {
+                    num[0] = '-';
+                    n = 1 + klog_fmt_num(&num[1], -(int32_t)v, 10, width - 1, pad);
+                } else {
+                    n = klog_fmt_num(num, v, 10, width, pad);
+                }
+                break;
+            case 'c': num[0] = (char)v; n = 1; break;
+            case 's':
+                s = v ? (const char*)v : "(null)";
+                while (s[n]) n++;
+                break;
+            default: num[0] = '?'; n = 1; break;
+        }
+        for (int i = 0; i < n && len < KLOG_LINE_MAX - 1; i++) {
+            line[len++] = s[i];
+        }
+    }
+    line[len] = '\0';
+    return len;
+}
+
+static void klog_emit(const klog_record_t* rec) {
+    char line[KLOG_LINE_MAX];
+    int len = klog_format(rec, line);
+    vga_print_string(line, level_attr[rec->level & 3]);
+    serial_write(line, len);
+    // The sink may take locks or wait on a device; a panic must not
+    if (klog_sink && !klog_sync) {
+        klog_sink(line, len);
+    }
+    if (klog_sync) {
+        serial_flush();
+    }
+}
+
+// Copy the record at ring position pos. Returns 0 if it is not (or no
+// longer) the record for that position.
+static int klog_read(uint32_t pos, klog_record_t* out) {
+    const klog_record_t* rec = &klog_ring[pos & (KLOG_RING_SIZE - 1)];
+    if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+        return 0;
+    }
+    *out = *rec;
+    // A writer may have lapped us while we were copying
+    return __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) == pos + 1;
+}
+
+int klog_pending(void) {
+    return klog_tail != klog_head;
+}
+
+void klog_drain(void) {
+    klog_record_t rec;
+    while (klog_tail != klog_head) {
+        uint32_t head = klog_head;
+        if (head - klog_tail > KLOG_RING_SIZE) {
+            // Writers wrapped the ring; skip to the oldest surviving record
+            klog_lost_count += head - klog_tail - KLOG_RING_SIZE;
+            klog_tail = head - KLOG_RING_SIZE;
+        }
+        if (!klog_read(klog_tail, &rec)) {
+            if (head - klog_tail >= KLOG_RING_SIZE) {
+                klog_lost_count++; // Overwritten under us
+                klog_tail++;
+                continue;
+            }
+            break; // Still being written (we interrupted the writer); retry later
+        }
+        klog_emit(&rec);
+        klog_tail++;
+    }
+}
+
+void klog_panic_dump(void) {
+    klog_record_t rec;
+    asm volatile ("cli");
+    klog_sync = 1;
+    klog_drain();
+    vga_flush(); // The flush timer will not fire with interrupts off
+
+    uint32_t head = klog_head;
+    uint32_t n = head < KLOG_PANIC_TAIL ? head : KLOG_PANIC_TAIL;
+    serial_print_string("--- last log records ---\n");
+    for (uint32_t pos = head - n; pos != head; pos++) {
+        if (klog_read(pos, &rec)) {
+            char line[KLOG_LINE_MAX];
+            serial_write(line, klog_format(&rec, line));
+            serial_flush();
+        }
+    }
+    serial_print_string("--- end of log ---\n");
+    serial_flush(); // Interrupts are off, so push the TX ring out by polling
+}
+
+uint32_t klog_lost(void) {
+    return klog_lost_count;
+}
+
+void klog_set_sink(klog_sink_t fn) {
+    klog_sink = fn;
+}
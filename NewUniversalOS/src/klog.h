@@ -0,0 +1,45 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+
+// Log levels (also select the VGA colour of the drained line)
+#define KLOG_DEBUG 0
+#define KLOG_INFO  1
+#define KLOG_WARN  2
+#define KLOG_ERROR 3
+
+#define KLOG_MAX_ARGS   4
+#define KLOG_RING_SIZE  256 // Records, must be a power of two
+#define KLOG_PANIC_TAIL 16  // Records replayed by klog_panic_dump()
+
+// One binary log record. Nothing is formatted at klog() time: the format
+// string pointer doubles as the format id and the arguments are stored raw.
+typedef struct {
+    volatile uint32_t seq;          // Ring position + 1 once the record is complete
+    const char* fmt;                // Must point at a string literal (it is read later)
+    uint64_t tsc;                   // rdtsc() when the record was written
+    uint8_t level;
+    uint8_t nargs;
+    uint16_t reserved;
+    uint32_t args[KLOG_MAX_ARGS];
+} klog_record_t;
+
+// Append a record to the ring. Never blocks and does no port I/O, so it is
+// safe to call from interrupt handlers. Supported conversions: %u %d %x %c %s %%
+// with an optional zero flag and width (e.g. %08x). %s arguments must stay
+// valid until the record is drained.
+void klog(int level, const char* fmt, ...);
+
+int klog_pending(void);       // Non-zero if records are waiting to be drained
+void klog_drain(void);        // Format pending records and write them to VGA and serial
+void klog_panic_dump(void);   // Drain, then replay the last KLOG_PANIC_TAIL records synchronously
+uint32_t klog_lost(void);     // Records overwritten before they could be drained
+
+// Optional extra output: once set, klog_drain also hands every formatted
+// line to fn (e.g. virtcon_write). Skipped once klog_panic_dump has started,
+// so a sink that is stuck or holds a lock cannot hang the panic path.
+typedef void (*klog_sink_t)(const char* line, uint32_t len);
+void klog_set_sink(klog_sink_t fn);
+
+#endif // KLOG_H
@@ -0,0 +1,291 @@
+#include "paging.h"
+#include "idt.h"  // For register_irq_handler
+#include "klog.h"
+#include "cpu.h"
+#include "bench.h"
+#include "user.h" // For user_fault
+
+#define CR0_WP  0x00010000 // Honour read-only pages in ring 0 too
+#define CR0_PG  0x80000000
+#define CR4_PSE 0x00000010
+#define CR4_PGE 0x00000080
+
+#define CPUID_EDX_PSE (1u << 3)
+#define CPUID_EDX_PGE (1u << 13)
+
+// Page fault error code bits
+#define PF_PRESENT 0x1 // Protection violation (clear: page not present)
+#define PF_WRITE   0x2
+#define PF_USER    0x4
+
+#define PAGE_FAULT_VECTOR 14
+
+#define PDE_INDEX(v) ((v) >> 22)
+#define PTE_INDEX(v) (((v) >> PAGE_SHIFT) & 0x3FF)
+#define PTE_FRAME(e) ((e) & ~(PAGE_SIZE - 1))
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint32_t flags;
+} demand_region_t;
+
+static uint32_t page_directory[1024] __attribute__((aligned(PAGE_SIZE)));
+static int have_pse = 0;
+static int have_pge = 0;
+static demand_region_t demand_regions[PAGING_MAX_DEMAND_REGIONS];
+static uint32_t demand_region_count = 0;
+static uint32_t mmio_next = KERNEL_MMIO_BASE; // Next free page of the MMIO window
+static paging_stats_t stats;
+
+static inline void zero_page(phys_addr_t frame) {
+    uint32_t dst = frame;
+    uint32_t n = PAGE_SIZE / 4;
+    asm volatile ("rep stosl" : "+D"(dst), "+c"(n) : "a"(0) : "memory");
+}
+
+// Page table covering virt, or 0 if virt is inside a 4 MB mapping (or there
+// is no table and create is 0, or no frame is left for one). Page tables
+// come from the page allocator, so they are reachable through the identity map.
+static uint32_t* page_table_for(uint32_t virt, int create) {
+    uint32_t pde = page_directory[PDE_INDEX(virt)];
+    if (pde & PTE_PRESENT) {
+        return (pde & PDE_LARGE) ? 0 : (uint32_t*)PTE_FRAME(pde);
+    }
+    if (!create) {
+        return 0;
+    }
+    phys_addr_t table = alloc_pages(0);
+    if (!table) {
+        return 0;
+    }
+    zero_page(table);
+    // The directory entry stays permissive; the PTEs decide the access rights
+    page_directory[PDE_INDEX(virt)] = table | PTE_PRESENT | PTE_WRITE | PTE_USER;
+    stats.page_tables++;
+    return (uint32_t*)table;
+}
+
+int map_page(uint32_t virt, phys_addr_t phys, uint32_t flags) {
+    uint32_t irq = irq_save();
+    uint32_t* table = page_table_for(virt, 1);
+    if (!table) {
+        irq_restore(irq);
+        return -1;
+    }
+    table[PTE_INDEX(virt)] = PTE_FRAME(phys) | (flags & (PAGE_SIZE - 1)) | PTE_PRESENT;
+    invlpg(virt);
+    irq_restore(irq);
+    return 0;
+}
+
+phys_addr_t unmap_page(uint32_t virt) {
+    uint32_t irq = irq_save();
+    uint32_t* table = page_table_for(virt, 0);
+    phys_addr_t old = 0;
+    if (table && (table[PTE_INDEX(virt)] & PTE_PRESENT)) {
+        old = PTE_FRAME(table[PTE_INDEX(virt)]);
+        table[PTE_INDEX(virt)] = 0;
+        invlpg(virt);
+    }
+    irq_restore(irq);
+    return old;
+}
+
+phys_addr_t virt_to_phys(uint32_t virt) {
+    uint32_t pde = page_directory[PDE_INDEX(virt)];
+    if (!(pde & PTE_PRESENT)) {
+        return 0;
+    }
+    if (pde & PDE_LARGE) {
+        return (pde & ~(LARGE_PAGE_SIZE - 1)) | (virt & (LARGE_PAGE_SIZE - 1));
+    }
+    uint32_t pte = ((uint32_t*)PTE_FRAME(pde))[PTE_INDEX(virt)];
+    return (pte & PTE_PRESENT) ? PTE_FRAME(pte) | (virt & (PAGE_SIZE - 1)) : 0;
+}
+
+uint32_t paging_map_mmio(phys_addr_t phys, uint32_t size, uint32_t flags) {
+    uint32_t offset = phys & (PAGE_SIZE - 1);
+    uint32_t pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t irq = irq_save();
+    uint32_t virt = mmio_next;
+    if (pages > (0u - virt) / PAGE_SIZE) {
+        irq_restore(irq);
+        return 0;
+    }
+    mmio_next += pages * PAGE_SIZE; // Never given back; device mappings last forever
+    irq_restore(irq);
+
+    for (uint32_t i = 0; i < pages; i++) {
+        if (map_page(virt + i * PAGE_SIZE, (phys & ~(PAGE_SIZE - 1)) + i * PAGE_SIZE, flags) != 0) {
+            return 0;
+        }
+    }
+    return virt + offset;
+}
+
+int paging_add_demand_zero(uint32_t start, uint32_t size, uint32_t flags) {
+    if ((start | size) & (PAGE_SIZE - 1) || demand_region_count == PAGING_MAX_DEMAND_REGIONS) {
+        return -1;
+    }
+    uint32_t irq = irq_save();
+    demand_regions[demand_region_count++] = (demand_region_t){ start, start + size, flags };
+    irq_restore(irq);
+    return 0;
+}
+
+// Vector 14. Faults on not-present pages inside a demand-zero region are
+// satisfied with a fresh zeroed frame; anything else kills the task if it
+// came from ring 3 and is fatal otherwise.
+static void page_fault_handler(registers_t* regs, void* ctx) {
+    (void)ctx;
+    uint32_t addr = read_cr2();
+    stats.page_faults++;
+
+    if (!(regs->err_code & PF_PRESENT)) {
+        for (uint32_t i = 0; i < demand_region_count; i++) {
+            const demand_region_t* r = &demand_regions[i];
+            if (addr < r->start || addr >= r->end) continue;
+            phys_addr_t frame = alloc_pages(0);
+            if (frame) {
+                zero_page(frame);
+                if (map_page(addr & ~(PAGE_SIZE - 1), frame, r->flags) == 0) {
+                    stats.demand_zero_fills++;
+                    return; // Retry the faulting instruction
+                }
+                free_pages(frame, 0);
+            }
+            klog(KLOG_ERROR, "Out of memory backing 0x%08x\n", addr);
+            break;
+        }
+    }
+    if (regs->err_code & PF_USER) {
+        klog(KLOG_WARN, "Page fault in user mode at 0x%08x, error 0x%x\n", addr, regs->err_code);
+        user_fault(regs);
+    }
+
+    klog(KLOG_ERROR, "Page fault at 0x%08x, error 0x%x (%s), EIP: 0x%08x\n", addr, regs->err_code,
+         (regs->err_code & PF_PRESENT) ? "protection" : "not present", regs->eip);
+    klog(KLOG_ERROR, "System Halted!\n");
+    klog_panic_dump();
+    asm volatile ("cli; hlt");
+}
+
+void paging_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    have_pse = (d & CPUID_EDX_PSE) != 0;
+    have_pge = (d & CPUID_EDX_PGE) != 0;
+    uint32_t global = have_pge ? PTE_GLOBAL : 0;
+
+    // Identity map all usable RAM, rounded up to whole 4 MB pages
+    uint32_t end = pmm_phys_end();
+    if (end < LARGE_PAGE_SIZE) end = LARGE_PAGE_SIZE;
+    end = (end + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+    for (uint32_t addr = 0; addr < end; addr += LARGE_PAGE_SIZE) {
+        if (have_pse) {
+            page_directory[PDE_INDEX(addr)] = addr | PDE_LARGE | global | PTE_WRITE | PTE_PRESENT;
+            stats.large_pages++;
+        } else {
+            for (uint32_t page = addr; page < addr + LARGE_PAGE_SIZE; page += PAGE_SIZE) {
+                map_page(page, page, global | PTE_WRITE);
+            }
+        }
+    }
+
+    register_irq_handler(PAGE_FAULT_VECTOR, page_fault_handler, 0);
+
+    if (have_pse) {
+        write_cr4(read_cr4() | CR4_PSE);
+    }
+    write_cr3((uint32_t)page_directory);
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+    if (have_pge) {
+        write_cr4(read_cr4() | CR4_PGE);
+    }
+
+    klog(KLOG_INFO, "Paging enabled: %u MB identity mapped with %s pages%s\n",
+         end >> 20, have_pse ? "4 MB" : "4 KB", have_pge ? ", global" : "");
+}
+
+void paging_get_stats(paging_stats_t* out) {
+    uint32_t irq = irq_save();
+    *out = stats;
+    irq_restore(irq);
+}
+
+#ifdef CONFIG_BENCH
+#define BENCH_BLOCKS 4  // 4 MB blocks walked, if that much memory is free
+#define BENCH_PASSES 8
+#define BENCH_FAULT_PAGES 256
+
+// Touch one word per page of every block, varying the offset within the
+// page so both walks hit the same cache lines. Returns cycles per touch.
+static uint32_t paging_walk(const uint32_t* base, uint32_t blocks) {
+    uint32_t pages = LARGE_PAGE_SIZE / PAGE_SIZE;
+    write_cr3(read_cr3()); // Start with cold non-global TLB entries
+    uint64_t t0 = rdtsc();
+    for (uint32_t pass = 0; pass < BENCH_PASSES; pass++) {
+        for (uint32_t b = 0; b < blocks; b++) {
+            for (uint32_t p = 0; p < pages; p++) {
+                (void)*(volatile uint32_t*)(base[b] + p * PAGE_SIZE + ((p * 64) & (PAGE_SIZE - 1)));
+            }
+        }
+    }
+    uint64_t cycles = rdtsc() - t0;
+    return (uint32_t)div_u64_u32(cycles, BENCH_PASSES * blocks * pages);
+}
+
+void paging_bench(void) {
+    phys_addr_t block[BENCH_BLOCKS];
+    uint32_t n = 0;
+    while (n < BENCH_BLOCKS && (block[n] = alloc_pages(PMM_MAX_ORDER))) {
+        n++;
+    }
+    if (n == 0) {
+        klog(KLOG_WARN, "paging bench: no 4 MB block free\n");
+        return;
+    }
+
+    // Map the same frames a second time through 4 KB pages in the vmap window
+    uint32_t window[BENCH_BLOCKS];
+    for (uint32_t b = 0; b < n; b++) {
+        window[b] = KERNEL_VMAP_BASE + b * LARGE_PAGE_SIZE;
+        for (uint32_t off = 0; off < LARGE_PAGE_SIZE; off += PAGE_SIZE) {
+            map_page(window[b] + off, block[b] + off, PTE_WRITE);
+        }
+    }
+
+    uint32_t large = paging_walk(block, n);
+    uint32_t small = paging_walk(window, n);
+    klog(KLOG_INFO, "paging bench: %u MB walk, %u cycles/page with 4 MB pages, %u with 4 KB pages\n",
+         n * 4, large, small);
+    bench_report("paging.walk_4m", 0, 1, large);
+    bench_report("paging.walk_4k", 0, 1, small);
+
+    for (uint32_t b = 0; b < n; b++) {
+        for (uint32_t off = 0; off < LARGE_PAGE_SIZE; off += PAGE_SIZE) {
+            unmap_page(window[b] + off);
+        }
+        free_pages(block[b], PMM_MAX_ORDER);
+    }
+
+    // Demand-zero fault cost: first touch of fresh pages right behind the window
+    uint32_t region = KERNEL_VMAP_BASE + BENCH_BLOCKS * LARGE_PAGE_SIZE;
+    if (paging_add_demand_zero(region, BENCH_FAULT_PAGES * PAGE_SIZE, PTE_WRITE) == 0) {
+        uint32_t fills = stats.demand_zero_fills;
+        uint64_t t0 = rdtsc();
+        for (uint32_t p = 0; p < BENCH_FAULT_PAGES; p++) {
+            *(volatile uint32_t*)(region + p * PAGE_SIZE) = p;
+        }
+        uint64_t cycles = rdtsc() - t0;
+        klog(KLOG_INFO, "paging bench: %u demand-zero faults, %u cycles each\n",
+             stats.demand_zero_fills - fills, (uint32_t)div_u64_u32(cycles, BENCH_FAULT_PAGES));
+        bench_report("paging.demand_zero_fault", 0, BENCH_FAULT_PAGES, cycles);
+        for (uint32_t p = 0; p < BENCH_FAULT_PAGES; p++) {
+            phys_addr_t frame = unmap_page(region + p * PAGE_SIZE);
+            if (frame) free_pages(frame, 0);
+        }
+    }
+}
+#endif
@@ -0,0 +1,66 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+#include "pmm.h" // For phys_addr_t, PAGE_SIZE
+
+// Page table entry bits (also used for page directory entries)
+#define PTE_PRESENT  0x001
+#define PTE_WRITE    0x002
+#define PTE_USER     0x004
+#define PTE_PWT      0x008
+#define PTE_PCD      0x010 // Cache disable, for MMIO
+#define PTE_ACCESSED 0x020
+#define PTE_DIRTY    0x040
+#define PDE_LARGE    0x080 // 4 MB page (needs CR4.PSE)
+#define PTE_GLOBAL   0x100 // Survives CR3 reloads (needs CR4.PGE)
+
+#define LARGE_PAGE_SIZE 0x400000
+
+// RAM is identity mapped with 4 MB global pages from 0 up to the end of
+// usable memory (at most PMM_PHYS_LIMIT). 4 KB mappings made with map_page()
+// go above that: ring-3 tasks get the range just below the window (see
+// user.h), the window is free for the kernel to use and the range from
+// KERNEL_MMIO_BASE up is left for device registers.
+#define KERNEL_VMAP_BASE 0xD0000000u
+#define KERNEL_VMAP_END  0xE0000000u
+#define KERNEL_MMIO_BASE 0xE0000000u
+
+// Build the identity map and turn paging on. Needs pmm_init() first.
+void paging_init(void);
+
+// Map one 4 KB page, allocating the page table if needed. Returns 0 on
+// success, -1 if virt lies in a 4 MB mapping or no page table could be allocated.
+int map_page(uint32_t virt, phys_addr_t phys, uint32_t flags);
+
+// Remove a 4 KB mapping. Returns the frame it pointed at, or 0 if there was none.
+// The frame itself is not freed.
+phys_addr_t unmap_page(uint32_t virt);
+
+// Map [phys, phys + size) into the next free pages from KERNEL_MMIO_BASE
+// up and return the address phys now appears at, or 0 if the window is full
+// or out of page tables. Pass PTE_WRITE | PTE_PCD for device registers.
+uint32_t paging_map_mmio(phys_addr_t phys, uint32_t size, uint32_t flags);
+
+// Physical address behind virt, or 0 if it is not mapped
+phys_addr_t virt_to_phys(uint32_t virt);
+
+// Let the page-fault handler back [start, start + size) with zeroed frames
+// on first touch. At most PAGING_MAX_DEMAND_REGIONS can be registered.
+#define PAGING_MAX_DEMAND_REGIONS 8
+int paging_add_demand_zero(uint32_t start, uint32_t size, uint32_t flags);
+
+typedef struct {
+    uint32_t large_pages;      // 4 MB identity mappings
+    uint32_t page_tables;      // Page tables allocated for 4 KB mappings
+    uint32_t page_faults;
+    uint32_t demand_zero_fills;
+} paging_stats_t;
+
+void paging_get_stats(paging_stats_t* out);
+
+#ifdef CONFIG_BENCH
+void paging_bench(void); // Walk the same frames through 4 MB and 4 KB mappings
+#endif
+
+#endif // PAGING_H
@@ -0,0 +1,235 @@
+#include "pci.h"
+#include "ports.h"
+#include "spinlock.h"
+#include "klog.h"
+#include "dbgcon.h"
+#include "virtcon.h"
+#include "ide.h"
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+#define PCI_CONFIG_ENABLE  0x80000000u
+
+#define PCI_HEADER_MULTIFUNCTION 0x80
+#define PCI_HEADER_BRIDGE        0x01 // PCI-to-PCI bridge
+#define PCI_CLASS_BRIDGE         0x06
+#define PCI_SUBCLASS_PCI_BRIDGE  0x04
+
+#define PCI_BAR_IO        0x1
+#define PCI_BAR_TYPE_MASK 0x6
+#define PCI_BAR_TYPE_64   0x4
+#define PCI_BAR_PREFETCH  0x8
+
+// Drivers in match order: the first one whose ID list names a device and
+// whose probe succeeds gets it
+static const pci_driver_t* const pci_drivers[] = {
+    &virtcon_driver,
+    &ide_driver,
+};
+
+static pci_device_t devices[PCI_MAX_DEVICES];
+static uint32_t device_count = 0;
+static uint32_t devices_missed = 0;      // Functions found once the table was full
+static spinlock_t config_lock = SPINLOCK_INIT; // Address and data port accesses come in pairs
+
+static inline uint32_t config_address(uint8_t bus, uint8_t dev, uint8_t func, uint8_t reg) {
+    return PCI_CONFIG_ENABLE | ((uint32_t)bus << 16) | ((uint32_t)dev << 11) | ((uint32_t)func << 8) | (reg & 0xFC);
+}
+
+static uint32_t config_read32(uint8_t bus, uint8_t dev, uint8_t func, uint8_t reg) {
+    uint32_t flags = spin_lock_irqsave(&config_lock);
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, dev, func, reg));
+    uint32_t v = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&config_lock, flags);
+    return v;
+}
+
+static void config_write32(uint8_t bus, uint8_t dev, uint8_t func, uint8_t reg, uint32_t v) {
+    uint32_t flags = spin_lock_irqsave(&config_lock);
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, dev, func, reg));
+    outl(PCI_CONFIG_DATA, v);
+    spin_unlock_irqrestore(&config_lock, flags);
+}
+
+uint32_t pci_read32(const pci_device_t* d, uint8_t reg) {
+    return config_read32(d->bus, d->dev, d->func, reg);
+}
+
+uint16_t pci_read16(const pci_device_t* d, uint8_t reg) {
+    return (uint16_t)(pci_read32(d, reg) >> ((reg & 2) * 8));
+}
+
+uint8_t pci_read8(const pci_device_t* d, uint8_t reg) {
+    return (uint8_t)(pci_read32(d, reg) >> ((reg & 3) * 8));
+}
+
+void pci_write32(const pci_device_t* d, uint8_t reg, uint32_t v) {
+    config_write32(d->bus, d->dev, d->func, reg, v);
+}
+
+// A 16-bit write through the data port, so the neighbouring register is
+// left alone (the status register next to the command register clears
+// bits written as 1)
+void pci_write16(const pci_device_t* d, uint8_t reg, uint16_t v) {
+    uint32_t flags = spin_lock_irqsave(&config_lock);
+    outl(PCI_CONFIG_ADDRESS, config_address(d->bus, d->dev, d->func, reg));
+    outw(PCI_CONFIG_DATA + (reg & 2), v);
+    spin_unlock_irqrestore(&config_lock, flags);
+}
+
+void pci_enable(const pci_device_t* d, uint16_t command) {
+    pci_write16(d, PCI_COMMAND, pci_read16(d, PCI_COMMAND) | command);
+}
+
+// Size each BAR by writing all ones and reading back which address bits
+// stick. Decoding is off meanwhile, so the device never answers at the
+// bogus address.
+static void decode_bars(pci_device_t* d) {
+    uint32_t nbars = (d->header_type & 0x7F) == PCI_HEADER_BRIDGE ? 2 : PCI_MAX_BARS;
+    uint16_t command = pci_read16(d, PCI_COMMAND);
+    pci_write16(d, PCI_COMMAND, command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+
+    for (uint32_t i = 0; i < nbars; i++) {
+        uint8_t reg = PCI_BAR0 + i * 4;
+        uint32_t orig = pci_read32(d, reg);
+        pci_write32(d, reg, 0xFFFFFFFF);
+        uint32_t mask = pci_read32(d, reg);
+        pci_write32(d, reg, orig);
+        pci_bar_t* bar = &d->bar[i];
+
+        if (orig & PCI_BAR_IO) {
+            mask &= 0xFFFC;
+            bar->is_io = 1;
+            bar->base = orig & 0xFFFC;
+            bar->size = mask ? (~mask & 0xFFFF) + 1 : 0;
+        } else {
+            mask &= ~0xFu;
+            bar->base = orig & ~0xFu;
+            bar->size = mask ? ~mask + 1 : 0;
+            bar->prefetchable = (orig & PCI_BAR_PREFETCH) != 0;
+            if ((orig & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64 && i + 1 < nbars) {
+                // We can only reach memory below 4 GB; the high half is
+                // only sized so it is not mistaken for a BAR of its own
+                bar->is_64 = 1;
+                uint8_t hi = reg + 4;
+                uint32_t orig_hi = pci_read32(d, hi);
+                if (orig_hi) {
+                    bar->base = 0; // Mapped above 4 GB: unusable
+                }
+                i++;
+            }
+        }
+        if (!bar->size) {
+            bar->base = 0;
+        }
+    }
+    pci_write16(d, PCI_COMMAND, command);
+}
+
+static void scan_bus(uint8_t bus);
+
+static void scan_function(uint8_t bus, uint8_t dev, uint8_t func) {
+    uint32_t id = config_read32(bus, dev, func, PCI_VENDOR_ID);
+    uint32_t class_reg = config_read32(bus, dev, func, PCI_REVISION);
+    uint8_t header = (uint8_t)(config_read32(bus, dev, func, PCI_HEADER_TYPE & 0xFC) >> 16);
+
+    if (device_count < PCI_MAX_DEVICES) {
+        pci_device_t* d = &devices[device_count++];
+        *d = (pci_device_t){ 0 };
+        d->bus = bus;
+        d->dev = dev;
+        d->func = func;
+        d->header_type = header;
+        d->vendor = (uint16_t)id;
+        d->device = (uint16_t)(id >> 16);
+        d->revision = (uint8_t)class_reg;
+        d->prog_if = (uint8_t)(class_reg >> 8);
+        d->subclass = (uint8_t)(class_reg >> 16);
+        d->class_code = (uint8_t)(class_reg >> 24);
+        d->irq_line = pci_read8(d, PCI_INTERRUPT_LINE);
+        d->irq_pin = pci_read8(d, PCI_INTERRUPT_PIN);
+        if ((header & 0x7F) == 0) {
+            d->subsystem = pci_read16(d, PCI_SUBSYSTEM_ID);
+        }
+        decode_bars(d);
+    } else {
+        devices_missed++;
+    }
+
+    if ((header & 0x7F) == PCI_HEADER_BRIDGE &&
+        (class_reg >> 24) == PCI_CLASS_BRIDGE && ((class_reg >> 16) & 0xFF) == PCI_SUBCLASS_PCI_BRIDGE) {
+        uint8_t secondary = (uint8_t)(config_read32(bus, dev, func, PCI_SECONDARY_BUS & 0xFC) >> 8);
+        if (secondary > bus) { // Firmware numbered it; guards against loops too
+            scan_bus(secondary);
+        }
+    }
+}
+
+static void scan_bus(uint8_t bus) {
+    for (uint8_t dev = 0; dev < 32; dev++) {
+        if ((uint16_t)config_read32(bus, dev, 0, PCI_VENDOR_ID) == 0xFFFF) {
+            continue;
+        }
+        uint8_t header = (uint8_t)(config_read32(bus, dev, 0, PCI_HEADER_TYPE & 0xFC) >> 16);
+        uint8_t funcs = (header & PCI_HEADER_MULTIFUNCTION) ? 8 : 1;
+        for (uint8_t func = 0; func < funcs; func++) {
+            if (func && (uint16_t)config_read32(bus, dev, func, PCI_VENDOR_ID) == 0xFFFF) {
+                continue;
+            }
+            scan_function(bus, dev, func);
+        }
+    }
+}
+
+static int driver_matches(const pci_driver_t* drv, const pci_device_t* d) {
+    for (const pci_id_t* id = drv->ids; id->vendor != PCI_ID_END; id++) {
+        if (id->vendor == d->vendor && id->device == d->device) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void bind_drivers(void) {
+    for (uint32_t i = 0; i < device_count; i++) {
+        pci_device_t* d = &devices[i];
+        for (uint32_t n = 0; n < sizeof(pci_drivers) / sizeof(pci_drivers[0]); n++) {
+            if (driver_matches(pci_drivers[n], d) && pci_drivers[n]->probe(d) == 0) {
+                d->driver = pci_drivers[n]->name;
+                klog(KLOG_INFO, "pci: %02x:%02x.%u bound to %s\n", d->bus, d->dev, d->func, d->driver);
+                break;
+            }
+        }
+    }
+}
+
+uint32_t pci_device_count(void) {
+    return device_count;
+}
+
+pci_device_t* pci_get_device(uint32_t i) {
+    return i < device_count ? &devices[i] : 0;
+}
+
+void pci_dump(void) {
+    for (uint32_t i = 0; i < device_count; i++) {
+        const pci_device_t* d = &devices[i];
+        klog(KLOG_INFO, "pci: %02x:%02x.%u class %04x\n", d->bus, d->dev, d->func,
+             ((uint32_t)d->class_code << 8) | d->subclass);
+        klog(KLOG_INFO, "pci:   id %04x:%04x, irq %u\n", d->vendor, d->device, d->irq_pin ? d->irq_line : 0);
+        for (uint32_t b = 0; b < PCI_MAX_BARS; b++) {
+            if (d->bar[b].size) {
+                klog(KLOG_INFO, "pci:   BAR%u %s 0x%08x size 0x%x\n", b, d->bar[b].is_io ? "io " : "mem",
+                     d->bar[b].base, d->bar[b].size);
+            }
+        }
+    }
+}
+
+void pci_init(void) {
+    scan_bus(0);
+    klog(KLOG_INFO, "pci: %u functions%s\n", device_count, devices_missed ? " (table full, some skipped)" : "");
+    pci_dump();
+    bind_drivers();
+    dbgcon_register('P', pci_dump, "list PCI functions and their BARs");
+}
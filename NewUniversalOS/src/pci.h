@@ -0,0 +1,82 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+// PCI configuration space through mechanism #1 (ports 0xCF8/0xCFC). At boot
+// pci_init walks every bus reachable from bus 0, records each function and
+// its BARs, then hands each device to the first driver in the match table
+// (pci.c) that lists its vendor and device ID.
+
+#define PCI_MAX_DEVICES 64
+#define PCI_MAX_BARS    6
+
+// Configuration space registers
+#define PCI_VENDOR_ID      0x00
+#define PCI_DEVICE_ID      0x02
+#define PCI_COMMAND        0x04
+#define PCI_STATUS         0x06
+#define PCI_REVISION       0x08 // Revision, prog IF, subclass, class
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_SUBSYSTEM_ID   0x2E
+#define PCI_SECONDARY_BUS  0x19 // Bridges (header type 1)
+#define PCI_INTERRUPT_LINE 0x3C
+#define PCI_INTERRUPT_PIN  0x3D
+
+#define PCI_COMMAND_IO     0x1
+#define PCI_COMMAND_MEMORY 0x2
+#define PCI_COMMAND_MASTER 0x4 // Bus master: the device may DMA
+
+#define PCI_ID_END 0xFFFF // Ends a pci_id_t list
+
+typedef struct {
+    uint32_t base;       // Port number or physical address (low 32 bits); 0 if unused
+    uint32_t size;
+    uint8_t is_io;
+    uint8_t prefetchable;
+    uint8_t is_64;       // Takes the next BAR slot too
+    uint8_t reserved;
+} pci_bar_t;
+
+typedef struct {
+    uint8_t bus, dev, func;
+    uint8_t header_type;
+    uint16_t vendor, device;
+    uint8_t class_code, subclass, prog_if, revision;
+    uint8_t irq_line;    // Legacy 8259 IRQ assigned by the BIOS (0xFF: none)
+    uint8_t irq_pin;     // INTA..INTD as 1..4, 0 if the function uses no interrupt
+    uint16_t subsystem;
+    pci_bar_t bar[PCI_MAX_BARS];
+    const char* driver;  // Name of the driver bound to it, else 0
+} pci_device_t;
+
+typedef struct {
+    uint16_t vendor;
+    uint16_t device;
+} pci_id_t;
+
+typedef struct {
+    const char* name;
+    const pci_id_t* ids; // Terminated by { PCI_ID_END, PCI_ID_END }
+    int (*probe)(pci_device_t* dev); // 0 if it took the device
+} pci_driver_t;
+
+uint32_t pci_read32(const pci_device_t* dev, uint8_t reg);
+uint16_t pci_read16(const pci_device_t* dev, uint8_t reg);
+uint8_t pci_read8(const pci_device_t* dev, uint8_t reg);
+void pci_write32(const pci_device_t* dev, uint8_t reg, uint32_t v);
+void pci_write16(const pci_device_t* dev, uint8_t reg, uint16_t v);
+
+// Set bits in the command register (e.g. PCI_COMMAND_IO | PCI_COMMAND_MASTER)
+void pci_enable(const pci_device_t* dev, uint16_t command);
+
+// Enumerate and bind drivers. Needs paging and kmem (drivers allocate);
+// call with interrupts enabled if drivers are to be able to sleep.
+void pci_init(void);
+
+uint32_t pci_device_count(void);
+pci_device_t* pci_get_device(uint32_t i);
+void pci_dump(void); // klog one line per function
+
+#endif // PCI_H
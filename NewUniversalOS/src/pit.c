@@ -1,30 +1,66 @@
 #include "pit.h"
 #include "ports.h" // For outb, inb
+#include "idt.h"   // For register_irq_handler
+#include "timer.h" // For timer_interrupt
+#include "cpu.h"   // For rdtsc
 
 #define PIT_CMD_PORT    0x43
 #define PIT_CHANNEL0_DATA_PORT 0x40
 // PIT_CHANNEL1_DATA_PORT 0x41
-// PIT_CHANNEL2_DATA_PORT 0x42
-
-#define PIC_MASTER_DATA 0x21 // For unmasking IRQ0
-
-void pit_init(uint32_t frequency) {
-    uint32_t divisor = 1193182 / frequency;
-    if (divisor == 0) divisor = 1; // Avoid division by zero if frequency is too high
-    if (divisor > 65535) divisor = 65535; // Max 16-bit divisor
-
-    // Send command byte: Channel 0, Access LSB then MSB, Mode 2 (Rate Generator)
-    // Command: 00110100b = 0x34
-    outb(PIT_CMD_PORT, 0x34);
-
-    // Send divisor LSB then MSB
-    uint8_t lsb = (uint8_t)(divisor & 0xFF);
-    uint8_t msb = (uint8_t)((divisor >> 8) & 0xFF);
-    outb(PIT_CHANNEL0_DATA_PORT, lsb);
-    outb(PIT_CHANNEL0_DATA_PORT, msb);
-
-    // Unmask IRQ0 (timer) on the master PIC
-    // Read current mask, clear bit 0 (IRQ0), write back
-    uint8_t current_mask = inb(PIC_MASTER_DATA);
-    outb(PIC_MASTER_DATA, current_mask & 0xFE); // 0xFE = 11111110b
-}
\ No newline at end of file
+#define PIT_CHANNEL2_DATA_PORT 0x42
+#define PIT_CHANNEL2_GATE_PORT 0x61 // Bit 0: gate, bit 1: speaker, bit 5: OUT2 (read)
+
+#define PIT_GATE2_ENABLE  0x01
+#define PIT_SPEAKER_DATA  0x02
+#define PIT_OUT2_HIGH     0x20
+
+#define PIT_MAX_COUNT 0xFFFF
+#define PIT_NS_TO_COUNT_MULT 5124678 // PIT_FREQUENCY / 1e9 * 2^32
+
+// Timer Interrupt (IRQ0). The PIT is only armed for the next timer deadline,
+// so every interrupt means something is (nearly) due.
+static void pit_irq_handler(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+    timer_interrupt();
+}
+
+void pit_init(void) {
+    register_irq_handler(IRQ_VECTOR(0), pit_irq_handler, 0);
+    irq_unmask(0);
+}
+
+void pit_set_oneshot(uint32_t ns) {
+    // Round up so the interrupt never arrives before the deadline
+    uint32_t count = (uint32_t)(((uint64_t)ns * PIT_NS_TO_COUNT_MULT + 0xFFFFFFFFULL) >> 32);
+    if (count == 0) count = 1;
+    if (count > PIT_MAX_COUNT) count = PIT_MAX_COUNT;
+
+    // Send command byte: Channel 0, Access LSB then MSB, Mode 0 (Interrupt On Terminal Count)
+    // Command: 00110000b = 0x30. IRQ0 is raised once when the count reaches zero.
+    outb(PIT_CMD_PORT, 0x30);
+    outb(PIT_CHANNEL0_DATA_PORT, (uint8_t)(count & 0xFF));
+    outb(PIT_CHANNEL0_DATA_PORT, (uint8_t)((count >> 8) & 0xFF));
+}
+
+uint64_t pit_calibrate_tsc(uint32_t ms) {
+    uint32_t count = PIT_FREQUENCY / 1000 * ms;
+    if (count > PIT_MAX_COUNT) count = PIT_MAX_COUNT;
+
+    // Gate channel 2 on with the speaker disconnected
+    uint8_t gate = inb(PIT_CHANNEL2_GATE_PORT);
+    outb(PIT_CHANNEL2_GATE_PORT, (gate & ~PIT_SPEAKER_DATA) | PIT_GATE2_ENABLE);
+
+    // Channel 2, LSB then MSB, mode 0: OUT2 goes high once the count expires
+    outb(PIT_CMD_PORT, 0xB0);
+    outb(PIT_CHANNEL2_DATA_PORT, (uint8_t)(count & 0xFF));
+    outb(PIT_CHANNEL2_DATA_PORT, (uint8_t)((count >> 8) & 0xFF));
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_CHANNEL2_GATE_PORT) & PIT_OUT2_HIGH));
+    uint64_t cycles = rdtsc() - start;
+
+    outb(PIT_CHANNEL2_GATE_PORT, gate);
+    // cycles / (count / PIT_FREQUENCY)
+    return div_u64_u32(cycles * PIT_FREQUENCY, count);
+}
@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 
-void pit_init(uint32_t frequency);
+#define PIT_FREQUENCY 1193182 // Input clock in Hz
 
-#endif // PIT_H
\ No newline at end of file
+void pit_init(void);                  // Hook IRQ0 up to the timer wheel
+void pit_set_oneshot(uint32_t ns);    // Raise IRQ0 once after ns (capped at ~54.9 ms)
+uint64_t pit_calibrate_tsc(uint32_t ms); // Measure the TSC rate (Hz) over ms using channel 2
+
+#endif // PIT_H
@@ -0,0 +1,331 @@
+#include "pmm.h"
+#include "klog.h"
+#include "cpu.h" // For irq_save/irq_restore
+#include "bench.h"
+
+#define PMM_MAX_PFN       (PMM_PHYS_LIMIT >> PAGE_SHIFT)
+
+#define PAGE_FREE     0x01 // Head of a block on a free list
+#define PAGE_RESERVED 0x02 // Never handed out (firmware, kernel image, mem_map)
+
+// Per-frame metadata. Only the first frame of a free block is on a list.
+typedef struct page {
+    struct page* next;
+    struct page* prev;
+    uint8_t order;  // Order of the free block this frame heads
+    uint8_t flags;
+    uint16_t reserved;
+} page_t;
+
+typedef struct {
+    page_t* head;
+    uint32_t count;
+} free_area_t;
+
+extern char _kernel_end[]; // End of .bss (linker.ld)
+
+static page_t* mem_map = 0;      // Indexed by pfn, from 0 up to max_pfn
+static uint32_t max_pfn = 0;
+static free_area_t free_area[PMM_MAX_ORDER + 1];
+static uint32_t free_orders = 0; // Bit n set: free_area[n] is non-empty
+static pmm_stats_t stats;
+
+// Used when the BIOS has no E820 support
+static const e820_entry_t fallback_map[] = {
+    { 0x100000, 15 * 0x100000, E820_USABLE, 1 },
+};
+
+static inline uint32_t page_to_pfn(page_t* page) {
+    return (uint32_t)(page - mem_map);
+}
+
+static void free_list_add(page_t* page, uint32_t order) {
+    free_area_t* area = &free_area[order];
+    page->flags |= PAGE_FREE;
+    page->order = (uint8_t)order;
+    page->prev = 0;
+    page->next = area->head;
+    if (area->head) {
+        area->head->prev = page;
+    }
+    area->head = page;
+    area->count++;
+    free_orders |= 1u << order;
+}
+
+static void free_list_del(page_t* page, uint32_t order) {
+    free_area_t* area = &free_area[order];
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        area->head = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+    page->flags &= ~PAGE_FREE;
+    if (--area->count == 0) {
+        free_orders &= ~(1u << order);
+    }
+}
+
+// Clip an E820 entry to the frames below PMM_PHYS_LIMIT.
+// Usable ranges are rounded inwards, everything else outwards.
+static void e820_pfn_range(const e820_entry_t* e, uint32_t* start, uint32_t* end) {
+    uint64_t base = e->base;
+    uint64_t limit = e->base + e->length;
+    if (e->type == E820_USABLE) {
+        base = (base + PAGE_SIZE - 1) >> PAGE_SHIFT;
+        limit >>= PAGE_SHIFT;
+    } else {
+        base >>= PAGE_SHIFT;
+        limit = (limit + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    }
+    *start = base < PMM_MAX_PFN ? (uint32_t)base : PMM_MAX_PFN;
+    *end = limit < PMM_MAX_PFN ? (uint32_t)limit : PMM_MAX_PFN;
+}
+
+// Free the frames [start, end) as the largest naturally aligned blocks
+static void pmm_add_range(uint32_t start, uint32_t end) {
+    while (start < end) {
+        uint32_t order = start ? (uint32_t)__builtin_ctz(start) : PMM_MAX_ORDER;
+        if (order > PMM_MAX_ORDER) order = PMM_MAX_ORDER;
+        while (start + (1u << order) > end) order--;
+        free_list_add(&mem_map[start], order);
+        stats.total_pages += 1u << order;
+        start += 1u << order;
+    }
+}
+
+void pmm_init(const e820_entry_t* map, uint32_t count, phys_addr_t keep_end) {
+    if (count == 0) {
+        klog(KLOG_WARN, "pmm: no E820 map, assuming 1-16 MB of RAM\n");
+        map = fallback_map;
+        count = sizeof(fallback_map) / sizeof(fallback_map[0]);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t start, end;
+        klog(KLOG_INFO, "E820: base 0x%x%08x, %u KB, type %u\n",
+             (uint32_t)(map[i].base >> 32), (uint32_t)map[i].base,
+             (uint32_t)(map[i].length >> 10), map[i].type);
+        e820_pfn_range(&map[i], &start, &end);
+        if (map[i].type == E820_USABLE && end > max_pfn) {
+            max_pfn = end;
+        }
+    }
+
+    // mem_map goes in the first frames after the kernel image and whatever
+    // the loader put above it. Make sure they are RAM before writing to them.
+    uint32_t meta_start = (uint32_t)_kernel_end;
+    if (keep_end > meta_start) meta_start = keep_end;
+    meta_start = (meta_start + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    uint32_t meta_end = meta_start + ((max_pfn * sizeof(page_t) + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    int meta_ok = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t start, end;
+        e820_pfn_range(&map[i], &start, &end);
+        if (map[i].type == E820_USABLE && start <= meta_start && end >= meta_end) {
+            meta_ok = 1;
+            break;
+        }
+    }
+    if (!meta_ok) {
+        klog(KLOG_ERROR, "pmm: no RAM for %u KB of frame metadata at 0x%08x\n",
+             (meta_end - meta_start) * (PAGE_SIZE >> 10), meta_start << PAGE_SHIFT);
+        max_pfn = 0;
+        return;
+    }
+    mem_map = (page_t*)(meta_start << PAGE_SHIFT);
+
+    // Start from all-reserved, open up usable ranges, then close anything
+    // the BIOS reports as reserved again (overlapping entries are not unusual)
+    for (uint32_t pfn = 0; pfn < max_pfn; pfn++) {
+        mem_map[pfn] = (page_t){ 0, 0, 0, PAGE_RESERVED, 0 };
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t start, end;
+            if ((map[i].type == E820_USABLE) != (pass == 0)) continue;
+            e820_pfn_range(&map[i], &start, &end);
+            if (end > max_pfn) end = max_pfn;
+            for (uint32_t pfn = start; pfn < end; pfn++) {
+                mem_map[pfn].flags = pass == 0 ? 0 : PAGE_RESERVED;
+            }
+        }
+    }
+    // Low memory, the kernel image, the initrd and mem_map itself. The
+    // kernel is linked at 1 MB and the loader puts the initrd right above
+    // it, so this is one contiguous range.
+    for (uint32_t pfn = 0; pfn < meta_end; pfn++) {
+        mem_map[pfn].flags = PAGE_RESERVED;
+    }
+
+    // Hand every run of available frames to the free lists
+    uint32_t pfn = meta_end;
+    while (pfn < max_pfn) {
+        while (pfn < max_pfn && (mem_map[pfn].flags & PAGE_RESERVED)) pfn++;
+        uint32_t start = pfn;
+        while (pfn < max_pfn && !(mem_map[pfn].flags & PAGE_RESERVED)) pfn++;
+        pmm_add_range(start, pfn);
+    }
+    stats.free_pages = stats.total_pages;
+
+    klog(KLOG_INFO, "pmm: %u KB free in %u frames, mem_map %u KB at 0x%08x\n",
+         stats.total_pages * (PAGE_SIZE >> 10), stats.total_pages,
+         (meta_end - meta_start) * (PAGE_SIZE >> 10), meta_start << PAGE_SHIFT);
+}
+
+phys_addr_t alloc_pages(uint32_t order) {
+    if (order > PMM_MAX_ORDER) {
+        return 0;
+    }
+    uint32_t flags = irq_save();
+    stats.alloc_calls++;
+
+    // Smallest non-empty free list that can hold the request
+    uint32_t avail = free_orders & ~((1u << order) - 1);
+    if (!avail) {
+        stats.alloc_failed++;
+        irq_restore(flags);
+        return 0;
+    }
+    uint32_t o = (uint32_t)__builtin_ctz(avail);
+    page_t* page = free_area[o].head;
+    free_list_del(page, o);
+
+    // Keep the lower half and put the upper halves back on the free lists
+    while (o > order) {
+        o--;
+        free_list_add(page + (1u << o), o);
+        stats.splits++;
+    }
+    page->order = (uint8_t)order;
+    stats.free_pages -= 1u << order;
+    irq_restore(flags);
+    return page_to_pfn(page) << PAGE_SHIFT;
+}
+
+void free_pages(phys_addr_t addr, uint32_t order) {
+    uint32_t pfn = addr >> PAGE_SHIFT;
+    if ((addr & (PAGE_SIZE - 1)) || order > PMM_MAX_ORDER || pfn >= max_pfn ||
+        (pfn & ((1u << order) - 1))) {
+        klog(KLOG_ERROR, "pmm: bad free of 0x%08x order %u\n", addr, order);
+        return;
+    }
+
+    // Check and free under the same irq_save, or an interrupt that frees the
+    // block in between would get it freed twice
+    uint32_t flags = irq_save();
+    if (mem_map[pfn].flags & (PAGE_FREE | PAGE_RESERVED)) {
+        irq_restore(flags);
+        klog(KLOG_ERROR, "pmm: double free of 0x%08x order %u\n", addr, order);
+        return;
+    }
+    stats.free_calls++;
+    stats.free_pages += 1u << order;
+
+    // Merge with the buddy for as long as it is a free block of the same order
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy_pfn = pfn ^ (1u << order);
+        if (buddy_pfn >= max_pfn) break;
+        page_t* buddy = &mem_map[buddy_pfn];
+        if (!(buddy->flags & PAGE_FREE) || buddy->order != order) break;
+        free_list_del(buddy, order);
+        stats.merges++;
+        pfn &= ~(1u << order);
+        order++;
+    }
+    free_list_add(&mem_map[pfn], order);
+    irq_restore(flags);
+}
+
+phys_addr_t pmm_phys_end(void) {
+    return max_pfn << PAGE_SHIFT;
+}
+
+void pmm_get_stats(pmm_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++) {
+        out->free_blocks[o] = free_area[o].count;
+    }
+    irq_restore(flags);
+}
+
+uint32_t pmm_fragmentation(uint32_t order) {
+    if (order > PMM_MAX_ORDER) {
+        order = PMM_MAX_ORDER;
+    }
+    uint32_t flags = irq_save();
+    uint32_t usable = 0;
+    for (uint32_t o = order; o <= PMM_MAX_ORDER; o++) {
+        usable += free_area[o].count << o;
+    }
+    uint32_t free = stats.free_pages;
+    irq_restore(flags);
+    return free ? (free - usable) * 1000 / free : 0;
+}
+
+void pmm_dump_stats(void) {
+    pmm_stats_t s;
+    pmm_get_stats(&s);
+    klog(KLOG_INFO, "pmm: %u/%u frames free, %u allocs (%u failed), %u frees\n",
+         s.free_pages, s.total_pages, s.alloc_calls, s.alloc_failed, s.free_calls);
+    klog(KLOG_INFO, "pmm: %u splits, %u merges\n", s.splits, s.merges);
+    for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++) {
+        uint32_t frag = pmm_fragmentation(o);
+        klog(KLOG_INFO, "pmm: order %2u: %5u free blocks, fragmentation %u.%u%%\n",
+             o, s.free_blocks[o], frag / 10, frag % 10);
+    }
+}
+
+#ifdef CONFIG_BENCH
+#define STRESS_SLOTS 512
+
+void pmm_stress(uint32_t rounds) {
+    static phys_addr_t slot_addr[STRESS_SLOTS];
+    static uint8_t slot_order[STRESS_SLOTS];
+    uint32_t seed = 0x2545F491;
+    uint32_t before = stats.free_pages;
+    uint32_t frag_before = pmm_fragmentation(PMM_MAX_ORDER);
+    uint64_t cycles = 0;
+    uint32_t ops = 0;
+
+    for (uint32_t r = 0; r < rounds; r++) {
+        // xorshift32
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        uint32_t i = seed % STRESS_SLOTS;
+        uint64_t t0 = rdtsc();
+        if (slot_addr[i]) {
+            free_pages(slot_addr[i], slot_order[i]);
+            slot_addr[i] = 0;
+        } else {
+            // Mostly small blocks with the occasional large one
+            uint32_t order = (seed >> 16) & 0xF;
+            order = order < 12 ? order & 3 : order - 6;
+            slot_addr[i] = alloc_pages(order);
+            slot_order[i] = (uint8_t)order;
+        }
+        cycles += rdtsc() - t0;
+        ops++;
+    }
+
+    klog(KLOG_INFO, "pmm stress: %u ops, %u cycles/op\n", ops, (uint32_t)div_u64_u32(cycles, ops ? ops : 1));
+    bench_report("pmm.alloc_free", 0, ops, cycles);
+    pmm_dump_stats(); // Fragmented state with about half the slots in use
+
+    for (uint32_t i = 0; i < STRESS_SLOTS; i++) {
+        if (slot_addr[i]) {
+            free_pages(slot_addr[i], slot_order[i]);
+            slot_addr[i] = 0;
+        }
+    }
+    // Everything must have coalesced back into the blocks we started with
+    klog(stats.free_pages == before ? KLOG_INFO : KLOG_ERROR,
+         "pmm stress: %u of %u frames back, max-order fragmentation %u/1000 (was %u)\n",
+         stats.free_pages, before, pmm_fragmentation(PMM_MAX_ORDER), frag_before);
+}
+#endif
@@ -0,0 +1,59 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include <stdint.h>
+#include "bootinfo.h" // For e820_entry_t
+
+// Physical memory manager: a binary buddy allocator over 4 KB page frames.
+// Memory below 1 MB (BIOS data, VGA, boot structures) and the kernel image
+// up to the end of .bss are never handed out.
+
+#define PAGE_SHIFT    12
+#define PAGE_SIZE     (1u << PAGE_SHIFT)
+#define PMM_MAX_ORDER 10 // Largest block: 2^10 pages = 4 MB
+
+// Everything the allocator returns is identity mapped (see paging.c), so RAM
+// above 3 GB, where the kernel's 4 KB mapping window and MMIO live, is ignored.
+#define PMM_PHYS_LIMIT 0xC0000000u
+
+typedef uint32_t phys_addr_t;
+
+typedef struct {
+    uint32_t total_pages;   // Frames managed by the allocator
+    uint32_t free_pages;    // Frames currently free
+    uint32_t free_blocks[PMM_MAX_ORDER + 1]; // Free list length per order
+    uint32_t alloc_calls;
+    uint32_t alloc_failed;  // No block of the requested order or larger
+    uint32_t free_calls;
+    uint32_t splits;        // Larger blocks split to satisfy an allocation
+    uint32_t merges;        // Buddies coalesced on free
+} pmm_stats_t;
+
+// Build the free lists from the BIOS memory map. Must run before any
+// allocation; a zero count falls back to assuming 1-16 MB of RAM. Frames
+// below keep_end (the loader's initrd, above the kernel) are never handed
+// out; pass 0 if the loader left nothing there.
+void pmm_init(const e820_entry_t* map, uint32_t count, phys_addr_t keep_end);
+
+// Allocate 2^order contiguous, naturally aligned frames. Returns the physical
+// address of the first frame, or 0 if no block is available. O(log n).
+phys_addr_t alloc_pages(uint32_t order);
+
+// Return a block from alloc_pages(); order must match the allocation. O(log n).
+void free_pages(phys_addr_t addr, uint32_t order);
+
+phys_addr_t pmm_phys_end(void); // End of the highest usable RAM frame
+
+void pmm_get_stats(pmm_stats_t* out);
+
+// Share of free memory (in 1/1000) that cannot satisfy a request of the
+// given order because it sits in smaller blocks. 0 means no fragmentation.
+uint32_t pmm_fragmentation(uint32_t order);
+
+void pmm_dump_stats(void); // klog the counters and per-order free lists
+
+#ifdef CONFIG_BENCH
+void pmm_stress(uint32_t rounds); // Random alloc/free mix, then report and check coalescing
+#endif
+
+#endif // PMM_H
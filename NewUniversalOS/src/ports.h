@@ -27,4 +27,26 @@ static inline void outw(uint16_t port, uint16_t value) {
     asm volatile ("outw %0, %1" : : "a"(value), "Nd"(port));
 }
 
+// Input a dword (32 bits) from a port
+static inline uint32_t inl(uint16_t port) {
+    uint32_t ret;
+    asm volatile ("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+// Output a dword (32 bits) to a port
+static inline void outl(uint16_t port, uint32_t value) {
+    asm volatile ("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+// Input count words from a port into buf (rep insw)
+static inline void insw(uint16_t port, void* buf, uint32_t count) {
+    asm volatile ("rep insw" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+// Output count words from buf to a port (rep outsw)
+static inline void outsw(uint16_t port, const void* buf, uint32_t count) {
+    asm volatile ("rep outsw" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
 #endif // PORTS_H
\ No newline at end of file
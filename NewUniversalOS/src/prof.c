@@ -0,0 +1,260 @@
+#include "prof.h"
+#include "idt.h"
+#include "timer.h"
+#include "clock.h"
+#include "sched.h"
+#include "dbgcon.h"
+#include "klog.h"
+#include "cpu.h"
+
+extern uint8_t kernel_stack[], kernel_stack_top[]; // entry.asm, the idle thread's stack
+
+#define PROF_MAX_PROBE 16 // Hash slots tried before a sample is dropped
+
+// Dump records (framed by dbgcon_send_record)
+#define PROF_MAGIC      0x31465250 // 'PRF1'
+#define PROF_REC_HEADER 1          // hz, flags, samples, dropped, stack walk errors
+#define PROF_REC_FLAT   2          // n x {eip, count}
+#define PROF_REC_STACKS 3          // n x {count, depth, depth x pc}, leaf first
+#define PROF_REC_END    4
+
+typedef struct {
+    uint32_t eip;
+    uint32_t count;
+} prof_bucket_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t depth;
+    uint32_t pc[PROF_MAX_DEPTH];
+} prof_stack_t;
+
+static prof_bucket_t buckets[PROF_BUCKETS];
+static prof_stack_t stacks[PROF_STACK_SLOTS];
+static prof_stats_t stats;
+static volatile int running = 0;
+static uint32_t prof_flags = 0;
+static uint32_t prof_hz = 0;
+static uint64_t period_ns = 0;
+static timer_id_t sample_timer = 0;
+static uint8_t payload[DBGCON_RECORD_MAX];
+
+static inline uint32_t prof_hash(uint32_t v) {
+    return v * 0x9E3779B1u; // Fibonacci hashing: use the top bits
+}
+
+static void record_eip(uint32_t eip) {
+    uint32_t i = prof_hash(eip) >> (32 - __builtin_ctz(PROF_BUCKETS));
+    for (uint32_t probe = 0; probe < PROF_MAX_PROBE; probe++, i = (i + 1) & (PROF_BUCKETS - 1)) {
+        if (buckets[i].eip == eip || buckets[i].count == 0) {
+            buckets[i].eip = eip;
+            buckets[i].count++;
+            return;
+        }
+    }
+    stats.dropped++;
+}
+
+// Walk the EBP chain of the interrupted context. Only frames inside the
+// current thread's stack are followed, and each caller's frame must be
+// above its callee's, so a function without a frame pointer ends the walk
+// instead of sending it into the weeds.
+static uint32_t walk_stack(const registers_t* regs, uint32_t* pc) {
+    thread_t* t = thread_current();
+    uint32_t lo, hi;
+    if (t->stack) {
+        lo = t->stack;
+        hi = lo + (PAGE_SIZE << THREAD_STACK_ORDER);
+    } else {
+        lo = (uint32_t)kernel_stack;
+        hi = (uint32_t)kernel_stack_top;
+    }
+
+    uint32_t depth = 0;
+    pc[depth++] = regs->eip;
+    uint32_t fp = regs->ebp;
+    while (depth < PROF_MAX_DEPTH && fp) {
+        if (fp < lo || fp + 8 > hi || (fp & 3)) {
+            stats.stack_walk_errors++;
+            break;
+        }
+        const uint32_t* frame = (const uint32_t*)fp;
+        if (!frame[1]) {
+            break;
+        }
+        pc[depth++] = frame[1]; // Return address into the caller
+        if (frame[0] && frame[0] <= fp) {
+            stats.stack_walk_errors++;
+            break;
+        }
+        fp = frame[0];
+    }
+    return depth;
+}
+
+static void record_stack(const registers_t* regs) {
+    uint32_t pc[PROF_MAX_DEPTH];
+    uint32_t depth = walk_stack(regs, pc);
+    uint32_t h = depth;
+    for (uint32_t d = 0; d < depth; d++) {
+        h = prof_hash(h ^ pc[d]);
+    }
+
+    uint32_t i = h >> (32 - __builtin_ctz(PROF_STACK_SLOTS));
+    for (uint32_t probe = 0; probe < PROF_MAX_PROBE; probe++, i = (i + 1) & (PROF_STACK_SLOTS - 1)) {
+        prof_stack_t* s = &stacks[i];
+        if (s->count == 0) {
+            s->depth = depth;
+            for (uint32_t d = 0; d < depth; d++) s->pc[d] = pc[d];
+            s->count = 1;
+            return;
+        }
+        if (s->depth == depth) {
+            uint32_t d = 0;
+            while (d < depth && s->pc[d] == pc[d]) d++;
+            if (d == depth) {
+                s->count++;
+                return;
+            }
+        }
+    }
+    stats.dropped++;
+}
+
+// Timer callback, so this runs inside the IRQ0 handler and irq_get_regs()
+// is the context the timer interrupted
+static void prof_sample(void* arg) {
+    (void)arg;
+    sample_timer = 0;
+    if (!running) {
+        return;
+    }
+    const registers_t* regs = irq_get_regs();
+    if (regs) {
+        stats.samples++;
+        record_eip(regs->eip);
+        if (prof_flags & PROF_STACKS) {
+            record_stack(regs);
+        }
+    }
+    sample_timer = timer_add(period_ns, prof_sample, 0);
+}
+
+void prof_start(uint32_t hz, uint32_t flags) {
+    uint32_t irq = irq_save();
+    prof_hz = hz ? hz : PROF_DEFAULT_HZ;
+    period_ns = NSEC_PER_SEC / prof_hz;
+    prof_flags = flags;
+    running = 1;
+    if (!sample_timer) {
+        sample_timer = timer_add(period_ns, prof_sample, 0);
+    }
+    irq_restore(irq);
+}
+
+void prof_stop(void) {
+    uint32_t irq = irq_save();
+    running = 0;
+    if (sample_timer) {
+        timer_cancel(sample_timer);
+        sample_timer = 0;
+    }
+    irq_restore(irq);
+}
+
+void prof_reset(void) {
+    uint32_t irq = irq_save();
+    for (uint32_t i = 0; i < PROF_BUCKETS; i++) buckets[i] = (prof_bucket_t){ 0, 0 };
+    for (uint32_t i = 0; i < PROF_STACK_SLOTS; i++) stacks[i].count = 0;
+    stats = (prof_stats_t){ 0 };
+    irq_restore(irq);
+}
+
+void prof_get_stats(prof_stats_t* out) {
+    uint32_t irq = irq_save();
+    *out = stats;
+    irq_restore(irq);
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+    return p + 4;
+}
+
+void prof_dump(void) {
+    int was_running = running;
+    prof_stop(); // Keep the tables still while they are sent
+
+    uint8_t* p = payload;
+    p = put32(p, prof_hz);
+    p = put32(p, prof_flags);
+    p = put32(p, stats.samples);
+    p = put32(p, stats.dropped);
+    p = put32(p, stats.stack_walk_errors);
+    dbgcon_send_record(PROF_MAGIC, PROF_REC_HEADER, payload, (uint32_t)(p - payload));
+
+    p = payload;
+    for (uint32_t i = 0; i < PROF_BUCKETS; i++) {
+        if (!buckets[i].count) {
+            continue;
+        }
+        if (p + 8 > payload + DBGCON_RECORD_MAX) {
+            dbgcon_send_record(PROF_MAGIC, PROF_REC_FLAT, payload, (uint32_t)(p - payload));
+            p = payload;
+        }
+        p = put32(p, buckets[i].eip);
+        p = put32(p, buckets[i].count);
+    }
+    if (p != payload) {
+        dbgcon_send_record(PROF_MAGIC, PROF_REC_FLAT, payload, (uint32_t)(p - payload));
+    }
+
+    p = payload;
+    for (uint32_t i = 0; i < PROF_STACK_SLOTS; i++) {
+        const prof_stack_t* s = &stacks[i];
+        if (!s->count) {
+            continue;
+        }
+        if (p + 8 + 4 * s->depth > payload + DBGCON_RECORD_MAX) {
+            dbgcon_send_record(PROF_MAGIC, PROF_REC_STACKS, payload, (uint32_t)(p - payload));
+            p = payload;
+        }
+        p = put32(p, s->count);
+        p = put32(p, s->depth);
+        for (uint32_t d = 0; d < s->depth; d++) {
+            p = put32(p, s->pc[d]);
+        }
+    }
+    if (p != payload) {
+        dbgcon_send_record(PROF_MAGIC, PROF_REC_STACKS, payload, (uint32_t)(p - payload));
+    }
+    dbgcon_send_record(PROF_MAGIC, PROF_REC_END, payload, 0);
+
+    if (was_running) {
+        prof_start(prof_hz, prof_flags);
+    }
+}
+
+static void prof_cmd_reset(void) {
+    prof_reset();
+    klog(KLOG_INFO, "prof: reset\n");
+}
+
+static void prof_cmd_toggle(void) {
+    if (running) {
+        prof_stop();
+        klog(KLOG_INFO, "prof: stopped after %u samples\n", stats.samples);
+    } else {
+        prof_start(prof_hz, prof_flags);
+        klog(KLOG_INFO, "prof: sampling at %u Hz\n", prof_hz);
+    }
+}
+
+void prof_init(void) {
+    dbgcon_register('p', prof_dump, "dump profiler samples (tools/profsym.py)");
+    dbgcon_register('r', prof_cmd_reset, "reset profiler samples");
+    dbgcon_register('s', prof_cmd_toggle, "stop/start the profiler");
+}
@@ -0,0 +1,39 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+
+// Statistical sampling profiler. A timer samples the EIP interrupted by
+// IRQ0 into a fixed hash table; with PROF_STACKS it also walks the EBP
+// chain and counts whole call stacks, which needs a kernel built with
+// frame pointers (make PROFILE=1). tools/profsym.py decodes the dump.
+
+#define PROF_BUCKETS     1024 // Distinct EIPs (power of two)
+#define PROF_STACK_SLOTS 256  // Distinct call stacks (power of two)
+#define PROF_MAX_DEPTH   8    // Frames per stack, including the sampled EIP
+#define PROF_DEFAULT_HZ  997  // Off the 60 Hz frame rate and other round periods
+
+#define PROF_STACKS 0x1       // prof_start flag: record call stacks too
+
+typedef struct {
+    uint32_t samples;
+    uint32_t dropped;         // Samples whose EIP (or stack) found no free slot
+    uint32_t stack_walk_errors; // Stacks cut short by an implausible frame pointer
+} prof_stats_t;
+
+// Register the profiler's debug console commands: 'p' dumps, 'r' resets,
+// 's' stops and restarts sampling
+void prof_init(void);
+
+// Start sampling at hz (at most about 1 kHz, the timer wheel's tick rate).
+// Needs the timer wheel. Restarting keeps the samples taken so far.
+void prof_start(uint32_t hz, uint32_t flags);
+void prof_stop(void);
+void prof_reset(void);
+void prof_get_stats(prof_stats_t* out);
+
+// Write the samples to the serial port as binary records for
+// tools/profsym.py. Call from a thread: it sleeps while the TX ring drains.
+void prof_dump(void);
+
+#endif // PROF_H
@@ -0,0 +1,370 @@
+#include "sched.h"
+#include "slab.h"
+#include "timer.h"
+#include "clock.h"
+#include "klog.h"
+#include "cpu.h"
+#include "trace.h"
+#include "bench.h"
+#include "gdt.h"
+
+extern void switch_context(uint32_t* prev_esp, uint32_t next_esp); // switch.asm
+
+#define THREAD_STACK_SIZE (PAGE_SIZE << THREAD_STACK_ORDER)
+
+static thread_t idle_thread;              // The boot context, never blocks
+static thread_t* current = 0;
+static thread_t* run_head[SCHED_PRIORITIES];
+static thread_t* run_tail[SCHED_PRIORITIES];
+static uint32_t ready_bitmap = 0;         // Bit n set: run queue n is non-empty
+static volatile int need_resched = 0;
+static timer_id_t slice_timer = 0;
+static thread_t* zombie = 0;              // Exited thread whose stack is still in use
+static kmem_cache_t* thread_cache = 0;
+static uint32_t next_thread_id = 1;
+static sched_stats_t stats;
+
+static void runqueue_push(thread_t* t) {
+    uint32_t prio = t->priority;
+    t->next = 0;
+    t->prev = run_tail[prio];
+    if (run_tail[prio]) {
+        run_tail[prio]->next = t;
+    } else {
+        run_head[prio] = t;
+    }
+    run_tail[prio] = t;
+    ready_bitmap |= 1u << prio;
+}
+
+static thread_t* runqueue_pop(uint32_t prio) {
+    thread_t* t = run_head[prio];
+    run_head[prio] = t->next;
+    if (run_head[prio]) {
+        run_head[prio]->prev = 0;
+    } else {
+        run_tail[prio] = 0;
+        ready_bitmap &= ~(1u << prio);
+    }
+    return t;
+}
+
+// Highest priority with a ready thread (lowest set bit, a single bsf).
+// Only valid while ready_bitmap is non-zero.
+static inline uint32_t ready_highest(void) {
+    return (uint32_t)__builtin_ctz(ready_bitmap);
+}
+
+static void slice_expired(void* arg) {
+    (void)arg;
+    slice_timer = 0;
+    need_resched = 1;
+}
+
+// Runs in the incoming thread right after every switch: free the stack of a
+// thread that exited on the way out
+static void sched_finish_switch(void) {
+    if (zombie && zombie != current) {
+        free_pages(zombie->stack, THREAD_STACK_ORDER);
+        kmem_cache_free(thread_cache, zombie);
+        zombie = 0;
+        stats.threads--;
+    }
+}
+
+// Switch to the highest-priority ready thread. Interrupts must be disabled.
+// A still-running caller only gives way to threads of equal or higher priority.
+static void schedule(void) {
+    need_resched = 0;
+    thread_t* prev = current;
+    if (prev->state == THREAD_RUNNING) {
+        if (!ready_bitmap || ready_highest() > prev->priority) {
+            return;
+        }
+        prev->state = THREAD_READY;
+        runqueue_push(prev);
+    }
+
+    // The idle thread never blocks, so something is always ready here
+    thread_t* next = runqueue_pop(ready_highest());
+    next->state = THREAD_RUNNING;
+    if (next == prev) {
+        return;
+    }
+
+    // Threads of the same priority are waiting: share the CPU in slices
+    if ((ready_bitmap & (1u << next->priority)) && !slice_timer) {
+        slice_timer = timer_add(SCHED_SLICE_NS, slice_expired, 0);
+    }
+    stats.switches++;
+    next->switches++;
+    current = next;
+    if (next->stack) {
+        gdt_set_kernel_stack(next->stack + THREAD_STACK_SIZE); // For entries from ring 3
+    }
+    trace_event(TRACE_SCHED_SWITCH, next->id);
+    switch_context(&prev->esp, next->esp);
+    sched_finish_switch();
+}
+
+// Make a blocked thread runnable; a preemption is requested if it outranks
+// the current thread
+static void thread_wake(thread_t* t) {
+    t->state = THREAD_READY;
+    runqueue_push(t);
+    if (t->priority < current->priority) {
+        need_resched = 1;
+    } else if (t->priority == current->priority && !slice_timer) {
+        slice_timer = timer_add(SCHED_SLICE_NS, slice_expired, 0);
+    }
+}
+
+// First code run by every new thread, entered from switch_context()
+static void thread_start(void) {
+    sched_finish_switch();
+    asm volatile ("sti");
+    current->entry(current->arg);
+    thread_exit();
+}
+
+void sched_init(void) {
+    thread_cache = kmem_cache_create("thread", sizeof(thread_t), 0, 0);
+    idle_thread.id = 0;
+    idle_thread.name = "idle";
+    idle_thread.priority = SCHED_IDLE_PRIORITY;
+    idle_thread.state = THREAD_RUNNING;
+    current = &idle_thread;
+    stats.threads = 1;
+}
+
+thread_t* thread_create(const char* name, thread_fn_t fn, void* arg, uint32_t priority) {
+    if (priority >= SCHED_PRIORITIES) {
+        priority = SCHED_IDLE_PRIORITY;
+    }
+    thread_t* t = kmem_cache_alloc(thread_cache);
+    if (!t) {
+        return 0;
+    }
+    phys_addr_t stack = alloc_pages(THREAD_STACK_ORDER);
+    if (!stack) {
+        kmem_cache_free(thread_cache, t);
+        return 0;
+    }
+
+    *t = (thread_t){ 0 };
+    t->name = name;
+    t->priority = (uint8_t)priority;
+    t->stack = stack;
+    t->entry = fn;
+    t->arg = arg;
+
+    // Initial frame popped by switch_context: four callee-saved registers,
+    // then the return address into thread_start (which itself never returns)
+    uint32_t* sp = (uint32_t*)(stack + THREAD_STACK_SIZE);
+    *--sp = 0;                      // Return address slot for thread_start
+    *--sp = (uint32_t)thread_start;
+    *--sp = 0;                      // ebp
+    *--sp = 0;                      // ebx
+    *--sp = 0;                      // esi
+    *--sp = 0;                      // edi
+    t->esp = (uint32_t)sp;
+
+    uint32_t flags = irq_save();
+    t->id = next_thread_id++;
+    stats.threads++;
+    thread_wake(t);
+    if (need_resched) {
+        schedule();
+    }
+    irq_restore(flags);
+    return t;
+}
+
+void thread_yield(void) {
+    uint32_t flags = irq_save();
+    schedule();
+    irq_restore(flags);
+}
+
+static void sleep_expired(void* arg) {
+    thread_wake((thread_t*)arg);
+}
+
+void thread_sleep(uint64_t ns) {
+    uint32_t flags = irq_save();
+    if (timer_add(ns, sleep_expired, current)) {
+        current->state = THREAD_BLOCKED;
+        schedule();
+    }
+    irq_restore(flags);
+}
+
+void thread_exit(void) {
+    asm volatile ("cli");
+    current->state = THREAD_DEAD;
+    zombie = current; // Freed by the next thread, once we are off this stack
+    schedule();
+    for (;;); // Not reached
+}
+
+thread_t* thread_current(void) {
+    return current;
+}
+
+void wait_queue_sleep(wait_queue_t* wq) {
+    thread_t* t = current;
+    t->state = THREAD_BLOCKED;
+    t->next = 0;
+    t->prev = wq->tail;
+    if (wq->tail) {
+        wq->tail->next = t;
+    } else {
+        wq->head = t;
+    }
+    wq->tail = t;
+    schedule();
+}
+
+int wait_queue_wake_one(wait_queue_t* wq) {
+    uint32_t flags = irq_save();
+    thread_t* t = wq->head;
+    if (t) {
+        wq->head = t->next;
+        if (wq->head) {
+            wq->head->prev = 0;
+        } else {
+            wq->tail = 0;
+        }
+        thread_wake(t);
+    }
+    irq_restore(flags);
+    return t != 0;
+}
+
+void wait_queue_wake_all(wait_queue_t* wq) {
+    while (wait_queue_wake_one(wq));
+}
+
+void sched_irq_exit(void) {
+    if (need_resched && current) {
+        if (ready_bitmap && ready_highest() <= current->priority) {
+            stats.preemptions++; // schedule() is about to switch away
+        }
+        schedule();
+    }
+}
+
+void sched_get_stats(sched_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
+
+#ifdef CONFIG_BENCH
+#define BENCH_YIELDS 20000 // Per thread
+#define BENCH_WAKES  2000
+#define BENCH_CTRL_PRIORITY   4 // Above the threads it measures, so it can start them all first
+#define BENCH_WAITER_PRIORITY 6
+#define BENCH_WORKER_PRIORITY 8
+
+static wait_queue_t bench_done = WAIT_QUEUE_INIT;
+static wait_queue_t bench_ctrl_done = WAIT_QUEUE_INIT;
+static volatile int bench_ctrl_running;
+static wait_queue_t bench_wq = WAIT_QUEUE_INIT;
+static volatile uint32_t bench_running;
+static volatile uint64_t bench_wake_tsc;
+static uint64_t bench_wake_total;
+static uint32_t bench_wake_max;
+
+static void bench_finished(void) {
+    uint32_t flags = irq_save();
+    if (--bench_running == 0) {
+        wait_queue_wake_one(&bench_done);
+    }
+    irq_restore(flags);
+}
+
+static void bench_yielder(void* arg) {
+    (void)arg;
+    for (uint32_t i = 0; i < BENCH_YIELDS; i++) {
+        thread_yield();
+    }
+    bench_finished();
+}
+
+static void bench_waiter(void* arg) {
+    (void)arg;
+    uint32_t flags = irq_save();
+    for (uint32_t i = 0; i < BENCH_WAKES; i++) {
+        wait_queue_sleep(&bench_wq);
+        uint32_t cycles = (uint32_t)(rdtsc() - bench_wake_tsc);
+        bench_wake_total += cycles;
+        if (cycles > bench_wake_max) bench_wake_max = cycles;
+    }
+    irq_restore(flags);
+    bench_finished();
+}
+
+static void bench_waker(void* arg) {
+    (void)arg;
+    for (uint32_t i = 0; i < BENCH_WAKES; i++) {
+        bench_wake_tsc = rdtsc();
+        wait_queue_wake_one(&bench_wq);
+        thread_yield(); // The waiter outranks us and runs right here
+    }
+    bench_finished();
+}
+
+static void bench_wait_all(void) {
+    uint32_t flags = irq_save();
+    while (bench_running) {
+        wait_queue_sleep(&bench_done);
+    }
+    irq_restore(flags);
+}
+
+static void sched_bench_thread(void* arg) {
+    (void)arg;
+
+    // Two equal-priority threads yielding to each other
+    uint32_t switches = stats.switches;
+    bench_running = 2;
+    uint64_t t0 = rdtsc();
+    thread_create("yield-a", bench_yielder, 0, BENCH_WORKER_PRIORITY);
+    thread_create("yield-b", bench_yielder, 0, BENCH_WORKER_PRIORITY);
+    bench_wait_all();
+    uint64_t cycles = rdtsc() - t0;
+    switches = stats.switches - switches;
+    uint32_t per_switch = (uint32_t)div_u64_u32(cycles, switches);
+    klog(KLOG_INFO, "sched bench: %u switches, %u cycles (%u ns) each, %u switches/s\n",
+         switches, per_switch, (uint32_t)clock_cycles_to_ns(per_switch),
+         (uint32_t)div_u64_u32((uint64_t)clock_tsc_khz() * 1000, per_switch ? per_switch : 1));
+    bench_report("sched.yield_switch", 0, switches, cycles);
+
+    // Wakeup latency: from wait_queue_wake_one() until the woken thread runs
+    bench_running = 2;
+    thread_create("waiter", bench_waiter, 0, BENCH_WAITER_PRIORITY);
+    thread_create("waker", bench_waker, 0, BENCH_WORKER_PRIORITY);
+    bench_wait_all();
+    uint32_t avg = (uint32_t)div_u64_u32(bench_wake_total, BENCH_WAKES);
+    klog(KLOG_INFO, "sched bench: wakeup latency avg %u ns, max %u ns over %u wakeups\n",
+         (uint32_t)clock_cycles_to_ns(avg), (uint32_t)clock_cycles_to_ns(bench_wake_max), BENCH_WAKES);
+    bench_report("sched.wakeup", 0, BENCH_WAKES, bench_wake_total);
+
+    uint32_t flags = irq_save();
+    bench_ctrl_running = 0;
+    wait_queue_wake_one(&bench_ctrl_done);
+    irq_restore(flags);
+}
+
+void sched_bench(void) {
+    uint32_t flags = irq_save();
+    bench_ctrl_running = 1;
+    if (thread_create("sched-bench", sched_bench_thread, 0, BENCH_CTRL_PRIORITY)) {
+        while (bench_ctrl_running) {
+            wait_queue_sleep(&bench_ctrl_done);
+        }
+    }
+    irq_restore(flags);
+}
+#endif
@@ -0,0 +1,82 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include "pmm.h" // For phys_addr_t
+
+// Preemptive priority scheduler for kernel threads. One FIFO run queue per
+// priority plus a bitmap of non-empty queues, so picking the next thread is
+// a single bit scan. Threads of equal priority share the CPU in time slices.
+
+#define SCHED_PRIORITIES       32 // 0 is the highest priority
+#define SCHED_DEFAULT_PRIORITY 16
+#define SCHED_IDLE_PRIORITY    (SCHED_PRIORITIES - 1)
+#define SCHED_SLICE_NS         10000000 // 10 ms
+#define THREAD_STACK_ORDER     1        // 8 KB kernel stacks
+
+#define THREAD_READY   0
+#define THREAD_RUNNING 1
+#define THREAD_BLOCKED 2 // On a wait queue or sleeping
+#define THREAD_DEAD    3
+
+typedef void (*thread_fn_t)(void* arg);
+
+typedef struct thread {
+    uint32_t esp;          // Saved stack pointer while switched out
+    struct thread* next;   // Run queue or wait queue links
+    struct thread* prev;
+    uint32_t id;
+    const char* name;
+    uint8_t priority;
+    uint8_t state;
+    uint16_t reserved;
+    phys_addr_t stack;     // Base of the kernel stack (0 for the boot thread)
+    thread_fn_t entry;
+    void* arg;
+    uint32_t switches;     // Times this thread was switched in
+    struct user_task* user; // Ring-3 task this thread runs (user.h), else 0
+} thread_t;
+
+typedef struct {
+    thread_t* head;
+    thread_t* tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { 0, 0 }
+
+typedef struct {
+    uint32_t switches;     // Context switches
+    uint32_t preemptions;  // Of those, switches on the way out of an interrupt
+    uint32_t threads;      // Live threads, including idle
+} sched_stats_t;
+
+// Turn the boot context (kmain) into the idle thread. Needs kmem_init().
+void sched_init(void);
+
+// Start a thread running fn(arg). Switches to it right away if it has a
+// higher priority than the caller. Returns 0 if out of memory.
+thread_t* thread_create(const char* name, thread_fn_t fn, void* arg, uint32_t priority);
+void thread_yield(void);
+void thread_sleep(uint64_t ns);
+void thread_exit(void) __attribute__((noreturn)); // Also reached by returning from fn
+thread_t* thread_current(void);
+
+// Block on a wait queue. Call with interrupts disabled, after checking the
+// condition being waited for; returns with interrupts still disabled.
+void wait_queue_sleep(wait_queue_t* wq);
+// Make waiters runnable. Safe from interrupt handlers. wake_one returns 1 if
+// a thread was woken.
+int wait_queue_wake_one(wait_queue_t* wq);
+void wait_queue_wake_all(wait_queue_t* wq);
+
+// Called by the interrupt dispatcher after the EOI: switches threads if a
+// wakeup or an expired time slice asked for it.
+void sched_irq_exit(void);
+
+void sched_get_stats(sched_stats_t* out);
+
+#ifdef CONFIG_BENCH
+void sched_bench(void); // Yield switches and wakeup latency; call from a thread, returns when done
+#endif
+
+#endif // SCHED_H
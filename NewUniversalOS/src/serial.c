@@ -1,13 +1,45 @@
 #include "serial.h"
 #include "ports.h" // For inb, outb
+#include "cpu.h"   // For irq_save/irq_restore
+#include "idt.h"   // For register_irq_handler
 
 // Define COM port registers relative to the base COM1_PORT
 #define SERIAL_DATA_PORT(base)          (base)
 #define SERIAL_INT_ENABLE_PORT(base)    (base + 1)
-#define SERIAL_FIFO_CTRL_PORT(base)     (base + 2)
+#define SERIAL_INT_ID_PORT(base)        (base + 2) // Read: interrupt identification
+#define SERIAL_FIFO_CTRL_PORT(base)     (base + 2) // Write: FIFO control
 #define SERIAL_LINE_CTRL_PORT(base)     (base + 3)
 #define SERIAL_MODEM_CTRL_PORT(base)    (base + 4)
 #define SERIAL_LINE_STATUS_PORT(base)   (base + 5)
+#define SERIAL_MODEM_STATUS_PORT(base)  (base + 6)
+
+// Interrupt enable register bits
+#define SERIAL_IER_RX_AVAIL   0x01
+#define SERIAL_IER_THR_EMPTY  0x02
+
+// Line status register bits
+#define SERIAL_LSR_DATA_READY 0x01
+#define SERIAL_LSR_OVERRUN    0x02
+#define SERIAL_LSR_THR_EMPTY  0x20
+
+// Interrupt identification register
+#define SERIAL_IIR_NONE_PENDING 0x01
+#define SERIAL_IIR_ID_MASK      0x0E
+#define SERIAL_IIR_MODEM_STATUS 0x00
+#define SERIAL_IIR_LINE_STATUS  0x06
+
+#define SERIAL_FIFO_DEPTH 16 // 16550A transmit FIFO size
+
+// Ring buffers. Indices are free-running; sizes must be powers of two.
+static volatile char tx_buf[SERIAL_TX_BUF_SIZE];
+static volatile uint32_t tx_head = 0; // Next slot to write (producer)
+static volatile uint32_t tx_tail = 0; // Next byte to send (THRE interrupt)
+
+static volatile char rx_buf[SERIAL_RX_BUF_SIZE];
+static volatile uint32_t rx_head = 0; // Next slot to fill (receive interrupt)
+static volatile uint32_t rx_tail = 0; // Next byte to hand out (serial_read)
+
+static serial_stats_t stats;
 
 void serial_init() {
    outb(SERIAL_INT_ENABLE_PORT(COM1_PORT), 0x00);    // Disable all interrupts for COM1
@@ -24,30 +56,141 @@ void serial_init() {
    //    return; // Faulty serial chip or setup
    // }
    // outb(SERIAL_MODEM_CTRL_PORT(COM1_PORT), 0x0F); // Restore normal operation
+
+   // Receive-data and transmit-empty interrupts (IRQ4). Nothing is delivered
+   // until the IRQ is unmasked on the PIC and interrupts are enabled.
+   register_irq_handler(IRQ_VECTOR(COM1_IRQ), serial_irq_handler, 0);
+   outb(SERIAL_INT_ENABLE_PORT(COM1_PORT), SERIAL_IER_RX_AVAIL | SERIAL_IER_THR_EMPTY);
 }
 
 int serial_is_transmit_empty() {
-   return inb(SERIAL_LINE_STATUS_PORT(COM1_PORT)) & 0x20; // Check bit 5 (Transmitter Holding Register Empty)
+   return inb(SERIAL_LINE_STATUS_PORT(COM1_PORT)) & SERIAL_LSR_THR_EMPTY; // Check bit 5 (Transmitter Holding Register Empty)
+}
+
+// Move up to one FIFO's worth of queued bytes into the UART.
+// Must be called with interrupts disabled.
+static void serial_tx_fill_fifo(void) {
+    if (!serial_is_transmit_empty()) {
+        return; // FIFO still draining; the THRE interrupt will call us again
+    }
+    for (int i = 0; i < SERIAL_FIFO_DEPTH && tx_tail != tx_head; i++) {
+        outb(SERIAL_DATA_PORT(COM1_PORT), tx_buf[tx_tail & (SERIAL_TX_BUF_SIZE - 1)]);
+        tx_tail++;
+    }
+}
+
+static void serial_rx_drain_fifo(void) {
+    uint8_t lsr;
+    while ((lsr = inb(SERIAL_LINE_STATUS_PORT(COM1_PORT))) & SERIAL_LSR_DATA_READY) {
+        if (lsr & SERIAL_LSR_OVERRUN) {
+            stats.rx_overrun++; // Hardware FIFO overflowed before we got here
+        }
+        char c = inb(SERIAL_DATA_PORT(COM1_PORT));
+        if (rx_head - rx_tail >= SERIAL_RX_BUF_SIZE) {
+            stats.rx_dropped++;
+            continue;
+        }
+        rx_buf[rx_head & (SERIAL_RX_BUF_SIZE - 1)] = c;
+        rx_head++;
+    }
+}
+
+// IRQ4, registered by serial_init
+void serial_irq_handler(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+    uint8_t iir;
+    while (!((iir = inb(SERIAL_INT_ID_PORT(COM1_PORT))) & SERIAL_IIR_NONE_PENDING)) {
+        switch (iir & SERIAL_IIR_ID_MASK) {
+            case SERIAL_IIR_LINE_STATUS:
+                if (inb(SERIAL_LINE_STATUS_PORT(COM1_PORT)) & SERIAL_LSR_OVERRUN) {
+                    stats.rx_overrun++;
+                }
+                break;
+            case SERIAL_IIR_MODEM_STATUS:
+                inb(SERIAL_MODEM_STATUS_PORT(COM1_PORT)); // Acknowledge
+                break;
+            default:
+                // RX data available, character timeout or THR empty. Reading IIR
+                // already acknowledged THRE, so service both directions.
+                serial_rx_drain_fifo();
+                serial_tx_fill_fifo();
+                break;
+        }
+    }
+}
+
+uint32_t serial_write(const char* buf, uint32_t len) {
+    uint32_t flags = irq_save();
+    uint32_t space = SERIAL_TX_BUF_SIZE - (tx_head - tx_tail);
+    uint32_t n = len < space ? len : space;
+
+    for (uint32_t i = 0; i < n; i++) {
+        tx_buf[(tx_head + i) & (SERIAL_TX_BUF_SIZE - 1)] = buf[i];
+    }
+    tx_head += n;
+    stats.tx_dropped += len - n;
+
+    uint32_t used = tx_head - tx_tail;
+    if (used > stats.tx_high_water) {
+        stats.tx_high_water = used;
+    }
+
+    // If the transmitter is idle no THRE interrupt is coming, so prime the FIFO
+    serial_tx_fill_fifo();
+    irq_restore(flags);
+    return n;
+}
+
+uint32_t serial_read(char* buf, uint32_t len) {
+    uint32_t flags = irq_save();
+    uint32_t n = 0;
+    while (n < len && rx_tail != rx_head) {
+        buf[n++] = rx_buf[rx_tail & (SERIAL_RX_BUF_SIZE - 1)];
+        rx_tail++;
+    }
+    irq_restore(flags);
+    return n;
+}
+
+void serial_flush(void) {
+    uint32_t flags = irq_save();
+    while (tx_tail != tx_head) {
+        while (serial_is_transmit_empty() == 0); // Interrupts may be off (e.g. halting), so poll
+        serial_tx_fill_fifo();
+    }
+    irq_restore(flags);
+}
+
+void serial_get_stats(serial_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    out->tx_pending = tx_head - tx_tail;
+    out->rx_pending = rx_head - rx_tail;
+    irq_restore(flags);
 }
 
 void serial_write_char(char a) {
-   while (serial_is_transmit_empty() == 0); // Wait until TX buffer is empty
-   outb(SERIAL_DATA_PORT(COM1_PORT), a);
+    serial_write(&a, 1);
 }
 
 void serial_print_string(const char* str) {
-    for (int i = 0; str[i] != '\0'; i++) {
-        serial_write_char(str[i]);
+    uint32_t len = 0;
+    while (str[len] != '\0') {
+        len++;
     }
+    serial_write(str, len);
 }
 
 void serial_print_hex(uint32_t n) {
-    serial_write_char('0');
-    serial_write_char('x');
     char hex_chars[] = "0123456789ABCDEF";
+    char buffer[10];
+    buffer[0] = '0';
+    buffer[1] = 'x';
     for (int i = 7; i >= 0; --i) {
-        serial_write_char(hex_chars[(n >> (i * 4)) & 0xF]);
+        buffer[9 - i] = hex_chars[(n >> (i * 4)) & 0xF];
     }
+    serial_write(buffer, sizeof(buffer));
 }
 
 void serial_print_dec(uint32_t n) {
@@ -55,14 +198,12 @@ void serial_print_dec(uint32_t n) {
         serial_write_char('0');
         return;
     }
-    char buffer[12]; 
-    int i = 0;
+    char buffer[12];
+    int i = sizeof(buffer);
     while (n > 0) {
-        buffer[i++] = (n % 10) + '0';
+        buffer[--i] = (n % 10) + '0';
         n /= 10;
     }
-    // buffer now holds digits in reverse order
-    while (i > 0) {
-        serial_write_char(buffer[--i]);
-    }
-}
\ No newline at end of file
+    // Digits were produced from the end of the buffer backwards
+    serial_write(&buffer[i], sizeof(buffer) - i);
+}
@@ -2,14 +2,38 @@
 #define SERIAL_H
 
 #include <stdint.h> // For standard integer types
+#include "idt.h"    // For registers_t
 
 #define COM1_PORT 0x3F8 // Base I/O port for COM1
+#define COM1_IRQ  4     // COM1 interrupt line on the master PIC
+
+// Ring buffer sizes (must be powers of two)
+#define SERIAL_TX_BUF_SIZE 4096
+#define SERIAL_RX_BUF_SIZE 256
+
+// Counters for sizing the ring buffers
+typedef struct {
+    uint32_t tx_dropped;    // Bytes discarded because the TX ring was full
+    uint32_t tx_high_water; // Largest number of bytes ever queued for TX
+    uint32_t tx_pending;    // Bytes currently queued for TX
+    uint32_t rx_dropped;    // Bytes discarded because the RX ring was full
+    uint32_t rx_overrun;    // UART overrun errors (bytes lost in hardware)
+    uint32_t rx_pending;    // Bytes currently waiting in the RX ring
+} serial_stats_t;
 
 void serial_init(void);
 int serial_is_transmit_empty(void);
+void serial_irq_handler(registers_t* regs, void* ctx); // IRQ4: drains RX and refills the TX FIFO
+
+// Non-blocking I/O. Both return the number of bytes actually transferred.
+uint32_t serial_write(const char* buf, uint32_t len);
+uint32_t serial_read(char* buf, uint32_t len);
+void serial_flush(void); // Busy-waits until the TX ring is empty (safe with interrupts off)
+void serial_get_stats(serial_stats_t* out);
+
 void serial_write_char(char a);
 void serial_print_string(const char* str);
 void serial_print_hex(uint32_t n); // For printing numbers in hex
 void serial_print_dec(uint32_t n); // For printing numbers in decimal
 
-#endif // SERIAL_H
\ No newline at end of file
+#endif // SERIAL_H
@@ -0,0 +1,396 @@
+#include "slab.h"
+#include "pmm.h"
+#include "klog.h"
+#include "cpu.h" // For irq_save/irq_restore
+#include "bench.h"
+
+#define SLAB_SIZE  (PAGE_SIZE << SLAB_ORDER)
+#define SLAB_MAGIC 0x51AB0B1E
+#define KMEM_MAX_EMPTY 1 // Empty slabs kept per cache before giving them back
+
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MAX_SHIFT 12
+#define KMALLOC_CACHES    (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+// Slab header, at the start of every SLAB_SIZE-aligned slab. kfree() finds
+// it by masking the object address.
+typedef struct slab {
+    struct slab* next;
+    struct slab* prev;
+    kmem_cache_t* cache;
+    void* free;          // First free object
+    uint32_t inuse;
+    uint32_t magic;
+} slab_t;
+
+struct kmem_cache {
+    const char* name;
+    uint32_t obj_size;
+    uint32_t stride;     // Object size plus free pointer, rounded to align
+    uint32_t align;
+    uint32_t free_off;   // Offset of the embedded free pointer in an object
+    uint32_t first_off;  // Offset of the first object in an uncoloured slab
+    uint32_t objs_per_slab;
+    uint32_t colors;     // Distinct colour offsets that fit in the slab's slack
+    uint32_t color_step;
+    uint32_t color_next;
+    kmem_ctor_t ctor;
+    slab_t* partial;
+    slab_t* full;
+    slab_t* empty;
+    uint32_t nr_empty;
+    kmem_cache_stats_t stats;
+    kmem_cache_t* next;  // All caches, for kmem_dump_stats()
+};
+
+// Caches are themselves slab objects; this one is set up by hand
+static kmem_cache_t cache_cache;
+static kmem_cache_t* cache_list = 0;
+static kmem_cache_t* kmalloc_caches[KMALLOC_CACHES];
+
+static const char* const kmalloc_names[KMALLOC_CACHES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
+    "kmalloc-512", "kmalloc-1024", "kmalloc-2048", "kmalloc-4096",
+};
+
+static inline uint32_t align_up(uint32_t v, uint32_t align) {
+    return (v + align - 1) & ~(align - 1);
+}
+
+static void slab_list_add(slab_t** head, slab_t* slab) {
+    slab->prev = 0;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void slab_list_del(slab_t** head, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+static inline void** obj_free_ptr(kmem_cache_t* cache, void* obj) {
+    return (void**)((uint8_t*)obj + cache->free_off);
+}
+
+// Fill in the cache layout. Returns 0 if an object does not fit in a slab.
+static int cache_setup(kmem_cache_t* cache, const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor) {
+    if (size == 0 || (align & (align - 1))) {
+        return 0;
+    }
+    if (align == 0) {
+        align = KMEM_CACHE_LINE;
+        while (align > sizeof(void*) && size <= align / 2) {
+            align /= 2;
+        }
+    }
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+
+    // The free pointer normally overlays the object. With a constructor it
+    // goes behind it so that free objects keep their constructed state.
+    uint32_t free_off = ctor ? align_up(size, sizeof(void*)) : 0;
+    uint32_t stride = align_up(ctor ? free_off + sizeof(void*) : size, align);
+    uint32_t first_off = align_up(sizeof(slab_t), align);
+    if (first_off + stride > SLAB_SIZE) {
+        return 0;
+    }
+
+    cache->name = name;
+    cache->obj_size = size;
+    cache->stride = stride;
+    cache->align = align;
+    cache->free_off = free_off;
+    cache->first_off = first_off;
+    cache->objs_per_slab = (SLAB_SIZE - first_off) / stride;
+    // Shift successive slabs by a cache line each so that the same object
+    // index in different slabs does not always land in the same cache set
+    cache->color_step = align > KMEM_CACHE_LINE ? align : KMEM_CACHE_LINE;
+    cache->colors = (SLAB_SIZE - first_off - cache->objs_per_slab * stride) / cache->color_step + 1;
+    cache->color_next = 0;
+    cache->ctor = ctor;
+
+    cache->next = cache_list;
+    cache_list = cache;
+    return 1;
+}
+
+// Take a new slab from the page allocator and construct its objects
+static slab_t* cache_grow(kmem_cache_t* cache) {
+    phys_addr_t phys = alloc_pages(SLAB_ORDER);
+    if (!phys) {
+        return 0;
+    }
+    slab_t* slab = (slab_t*)phys; // Identity mapped
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->magic = SLAB_MAGIC;
+
+    uint8_t* obj = (uint8_t*)slab + cache->first_off + cache->color_next * cache->color_step;
+    if (++cache->color_next == cache->colors) {
+        cache->color_next = 0;
+    }
+
+    // Chain the objects in address order so allocation walks the slab linearly
+    slab->free = obj;
+    for (uint32_t i = 0; i < cache->objs_per_slab; i++, obj += cache->stride) {
+        if (cache->ctor) {
+            cache->ctor(obj);
+        }
+        *obj_free_ptr(cache, obj) = i + 1 < cache->objs_per_slab ? obj + cache->stride : 0;
+    }
+
+    cache->stats.slabs++;
+    cache->stats.total_objs += cache->objs_per_slab;
+    cache->stats.grows++;
+    return slab;
+}
+
+static void cache_shrink(kmem_cache_t* cache, slab_t* slab) {
+    slab->magic = 0;
+    cache->stats.slabs--;
+    cache->stats.total_objs -= cache->objs_per_slab;
+    cache->stats.shrinks++;
+    free_pages((phys_addr_t)slab, SLAB_ORDER);
+}
+
+void kmem_init(void) {
+    cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0, 0);
+    for (int i = 0; i < KMALLOC_CACHES; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], 1u << (KMALLOC_MIN_SHIFT + i), 0, 0);
+    }
+}
+
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor) {
+    kmem_cache_t* cache = kmem_cache_alloc(&cache_cache);
+    if (!cache) {
+        return 0;
+    }
+    *cache = (kmem_cache_t){ 0 };
+    uint32_t flags = irq_save();
+    int ok = cache_setup(cache, name, size, align, ctor);
+    irq_restore(flags);
+    if (!ok) {
+        klog(KLOG_ERROR, "slab: cannot create cache %s (size %u, align %u)\n", name, size, align);
+        kmem_cache_free(&cache_cache, cache);
+        return 0;
+    }
+    return cache;
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    uint32_t flags = irq_save();
+    cache->stats.allocs++;
+
+    slab_t* slab = cache->partial;
+    if (slab) {
+        cache->stats.alloc_hits++;
+    } else if ((slab = cache->empty)) {
+        slab_list_del(&cache->empty, slab);
+        cache->nr_empty--;
+        slab_list_add(&cache->partial, slab);
+        cache->stats.alloc_hits++;
+    } else {
+        slab = cache_grow(cache);
+        if (!slab) {
+            irq_restore(flags);
+            return 0;
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+
+    void* obj = slab->free;
+    slab->free = *obj_free_ptr(cache, obj);
+    if (++slab->inuse == cache->objs_per_slab) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+    cache->stats.active_objs++;
+    irq_restore(flags);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    slab_t* slab = (slab_t*)((uint32_t)obj & ~(SLAB_SIZE - 1));
+    if (slab->magic != SLAB_MAGIC || slab->cache != cache) {
+        klog(KLOG_ERROR, "slab: free of %x to wrong cache %s\n", (uint32_t)obj, cache->name);
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    *obj_free_ptr(cache, obj) = slab->free;
+    slab->free = obj;
+    if (slab->inuse-- == cache->objs_per_slab) {
+        slab_list_del(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+    if (slab->inuse == 0) {
+        slab_list_del(&cache->partial, slab);
+        if (cache->nr_empty < KMEM_MAX_EMPTY) {
+            slab_list_add(&cache->empty, slab);
+            cache->nr_empty++;
+        } else {
+            cache_shrink(cache, slab);
+        }
+    }
+    cache->stats.active_objs--;
+    cache->stats.frees++;
+    irq_restore(flags);
+}
+
+void kmem_cache_get_stats(kmem_cache_t* cache, kmem_cache_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = cache->stats;
+    irq_restore(flags);
+}
+
+void* kmalloc(uint32_t size) {
+    if (size == 0 || size > KMALLOC_MAX_SIZE) {
+        return 0;
+    }
+    uint32_t index = 0;
+    if (size > KMALLOC_MIN_SIZE) {
+        index = 32 - __builtin_clz(size - 1) - KMALLOC_MIN_SHIFT; // Round up to a power of two
+    }
+    return kmem_cache_alloc(kmalloc_caches[index]);
+}
+
+void kfree(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    slab_t* slab = (slab_t*)((uint32_t)ptr & ~(SLAB_SIZE - 1));
+    if (slab->magic != SLAB_MAGIC) {
+        klog(KLOG_ERROR, "slab: kfree of %x, not a slab object\n", (uint32_t)ptr);
+        return;
+    }
+    kmem_cache_free(slab->cache, ptr);
+}
+
+void kmem_dump_stats(void) {
+    for (kmem_cache_t* cache = cache_list; cache; cache = cache->next) {
+        kmem_cache_stats_t s;
+        kmem_cache_get_stats(cache, &s);
+        if (!s.allocs) continue;
+        uint32_t hit = (uint32_t)div_u64_u32((uint64_t)s.alloc_hits * 1000, s.allocs);
+        klog(KLOG_INFO, "slab %s: %u/%u objs active, %u slabs\n",
+             cache->name, s.active_objs, s.total_objs, s.slabs);
+        klog(KLOG_INFO, "slab %s: %u allocs, hit rate %u.%u%%, %u grows\n",
+             cache->name, s.allocs, hit / 10, hit % 10, s.grows);
+    }
+}
+
+#ifdef CONFIG_BENCH
+// Naive first-fit heap for comparison: an implicit list of blocks with a
+// size/used header, split on allocation and coalesced forwards lazily
+#define FF_HEAP_ORDER PMM_MAX_ORDER
+#define FF_USED 1
+
+typedef struct {
+    uint32_t size; // Block size including the header; bit 0 marks it used
+    uint32_t pad;
+} ff_block_t;
+
+static uint8_t* ff_heap;
+static uint32_t ff_heap_size;
+
+static void ff_init(void* base, uint32_t size) {
+    ff_heap = base;
+    ff_heap_size = size;
+    ((ff_block_t*)ff_heap)->size = size;
+}
+
+static void* ff_malloc(uint32_t size) {
+    uint32_t need = align_up(size + sizeof(ff_block_t), 8);
+    uint8_t* end = ff_heap + ff_heap_size;
+    for (uint8_t* p = ff_heap; p < end; p += ((ff_block_t*)p)->size & ~FF_USED) {
+        ff_block_t* b = (ff_block_t*)p;
+        if (b->size & FF_USED) continue;
+        // Merge the free blocks that follow this one
+        ff_block_t* n;
+        while (p + b->size < end && !((n = (ff_block_t*)(p + b->size))->size & FF_USED)) {
+            b->size += n->size;
+        }
+        if (b->size < need) continue;
+        if (b->size - need >= sizeof(ff_block_t) + 16) {
+            ((ff_block_t*)(p + need))->size = b->size - need;
+            b->size = need;
+        }
+        b->size |= FF_USED;
+        return b + 1;
+    }
+    return 0;
+}
+
+static void ff_free(void* ptr) {
+    ((ff_block_t*)ptr - 1)->size &= ~FF_USED;
+}
+
+#define BENCH_SLOTS 1024
+
+// Replay the same random alloc/free sequence through one allocator pair.
+// Returns total cycles; *ops is the number of calls and *failed the
+// allocations that returned 0.
+static uint64_t kmem_bench_run(uint32_t rounds, void* (*alloc)(uint32_t), void (*release)(void*),
+                               uint32_t* ops, uint32_t* failed) {
+    static void* slot[BENCH_SLOTS];
+    uint32_t seed = 0x9E3779B9;
+    uint64_t cycles = 0;
+    *ops = 0;
+    *failed = 0;
+
+    for (uint32_t r = 0; r < rounds + BENCH_SLOTS; r++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        // Drain every slot at the end so both runs leave their heap empty
+        uint32_t i = r < rounds ? seed % BENCH_SLOTS : r - rounds;
+        uint64_t t0 = rdtsc();
+        if (slot[i]) {
+            release(slot[i]);
+            slot[i] = 0;
+        } else if (r < rounds) {
+            // Sizes skewed towards small objects: 8 << (0..9) bytes, minus some
+            uint32_t size = (8u << ((seed >> 8) % 10)) - ((seed >> 20) & 7);
+            if (size > KMALLOC_MAX_SIZE) size = KMALLOC_MAX_SIZE;
+            slot[i] = alloc(size);
+            if (!slot[i]) (*failed)++;
+        } else {
+            continue;
+        }
+        cycles += rdtsc() - t0;
+        (*ops)++;
+    }
+    return cycles;
+}
+
+void kmem_bench(uint32_t rounds) {
+    uint32_t ops, failed;
+    uint64_t cycles = kmem_bench_run(rounds, kmalloc, kfree, &ops, &failed);
+    klog(KLOG_INFO, "kmem bench: slab %u ops, %u cycles/op, %u failed\n",
+         ops, (uint32_t)div_u64_u32(cycles, ops), failed);
+    bench_report("kmem.slab", 0, ops, cycles);
+    kmem_dump_stats();
+
+    phys_addr_t heap = alloc_pages(FF_HEAP_ORDER);
+    if (!heap) {
+        klog(KLOG_WARN, "kmem bench: no memory for the first-fit heap\n");
+        return;
+    }
+    ff_init((void*)heap, PAGE_SIZE << FF_HEAP_ORDER);
+    cycles = kmem_bench_run(rounds, ff_malloc, ff_free, &ops, &failed);
+    klog(KLOG_INFO, "kmem bench: first-fit %u ops, %u cycles/op, %u failed\n",
+         ops, (uint32_t)div_u64_u32(cycles, ops), failed);
+    bench_report("kmem.first_fit", 0, ops, cycles);
+    free_pages(heap, FF_HEAP_ORDER);
+}
+#endif
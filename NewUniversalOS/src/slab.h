@@ -0,0 +1,52 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+
+// Slab allocator. Each cache hands out fixed-size objects carved from
+// SLAB_SIZE blocks of the page allocator; free objects are chained through
+// a pointer stored inside them. Objects come back from kmem_cache_alloc()
+// in their constructed state: the constructor only runs when a slab is
+// created, so callers must return objects to that state before freeing.
+
+#define SLAB_ORDER      3                       // Slabs are 2^3 pages (32 KB)
+#define KMEM_CACHE_LINE 64
+#define KMALLOC_MIN_SIZE 16
+#define KMALLOC_MAX_SIZE 4096
+
+typedef struct kmem_cache kmem_cache_t;
+typedef void (*kmem_ctor_t)(void* obj);
+
+typedef struct {
+    uint32_t active_objs;  // Objects handed out
+    uint32_t total_objs;   // Objects in all slabs of the cache
+    uint32_t slabs;
+    uint32_t allocs;
+    uint32_t alloc_hits;   // Allocations served without growing the cache
+    uint32_t frees;
+    uint32_t grows;        // Slabs taken from the page allocator
+    uint32_t shrinks;      // Empty slabs given back
+} kmem_cache_stats_t;
+
+void kmem_init(void); // Set up the kmalloc caches; needs pmm_init() first
+
+// align 0 picks cache-line alignment, reduced for objects of half a line or
+// less so that small objects are not padded out to 64 bytes. The name must
+// stay valid for the lifetime of the cache. Returns 0 on failure.
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+void kmem_cache_get_stats(kmem_cache_t* cache, kmem_cache_stats_t* out);
+
+// Power-of-two size classes from KMALLOC_MIN_SIZE to KMALLOC_MAX_SIZE.
+// Larger requests fail; use alloc_pages() for those.
+void* kmalloc(uint32_t size);
+void kfree(void* ptr);
+
+void kmem_dump_stats(void); // klog the counters of every cache
+
+#ifdef CONFIG_BENCH
+void kmem_bench(uint32_t rounds); // kmalloc/kfree against a first-fit heap on the same workload
+#endif
+
+#endif // SLAB_H
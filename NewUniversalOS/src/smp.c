@@ -0,0 +1,200 @@
+#include "smp.h"
+#include "acpi.h"
+#include "apic.h"
+#include "gdt.h"
+#include "idt.h"
+#include "pmm.h"
+#include "clock.h"
+#include "klog.h"
+#include "klib.h"
+#include "cpu.h"
+#include "bench.h"
+#include "syscall.h"
+
+#define AP_TRAMPOLINE_ADDR 0x8000 // Must match ap_boot.asm
+#define AP_STACK_ORDER     1      // 8 KB; APs only run IPI handlers
+#define AP_INIT_DELAY_US   10000  // INIT to first startup IPI
+#define AP_SIPI_DELAY_US   200    // Between the two startup IPIs
+#define AP_ONLINE_TIMEOUT_US 100000
+
+// Parameter block at the end of the trampoline (see ap_boot.asm)
+typedef struct {
+    uint16_t gdt_limit;
+    uint32_t gdt_base;
+    uint16_t pad;
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t stack;
+    uint32_t entry;
+    uint32_t arg;
+} __attribute__((packed)) ap_params_t;
+
+extern const uint8_t ap_trampoline[], ap_trampoline_params[], ap_trampoline_end[];
+
+percpu_t percpu[SMP_MAX_CPUS];
+static smp_config_t smp_cfg;
+static uint32_t cpus_online = 1;
+
+uint32_t smp_cpu_count(void) {
+    return cpus_online;
+}
+
+static void smp_call_handler(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+    percpu_t* cpu = this_cpu();
+    smp_call_fn_t fn = cpu->call_fn;
+    if (fn) {
+        cpu->call_fn = 0;
+        fn(cpu->call_arg);
+        cpu->calls++;
+        __atomic_store_n(&cpu->call_done, 1, __ATOMIC_RELEASE);
+    }
+    lapic_eoi();
+}
+
+int smp_call(uint32_t cpu, smp_call_fn_t fn, void* arg) {
+    if (cpu >= SMP_MAX_CPUS || !percpu[cpu].online) {
+        return -1;
+    }
+    percpu_t* target = &percpu[cpu];
+    uint32_t flags = spin_lock_irqsave(&target->call_lock);
+    if (target == this_cpu()) {
+        fn(arg);
+        spin_unlock_irqrestore(&target->call_lock, flags);
+        return 0;
+    }
+    target->call_arg = arg;
+    target->call_done = 0;
+    __atomic_store_n(&target->call_fn, fn, __ATOMIC_RELEASE);
+    lapic_send_ipi(target->apic_id, LAPIC_ICR_FIXED | SMP_CALL_VECTOR);
+    while (!__atomic_load_n(&target->call_done, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+    spin_unlock_irqrestore(&target->call_lock, flags);
+    return 0;
+}
+
+// First C code an AP runs, on its own stack, with interrupts off
+static void __attribute__((noreturn)) ap_main(uint32_t index) {
+    gdt_load_cpu(index);
+    idt_load(&idt_descriptor);
+    asm volatile ("fninit");
+    lapic_init_cpu();
+    syscall_init_cpu();
+
+    percpu_t* cpu = this_cpu();
+    cpu->lapic_timer_khz = lapic_timer_calibrate();
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+    klog(KLOG_INFO, "cpu %u online: APIC id %u, LAPIC timer %u kHz\n",
+         index, cpu->apic_id, cpu->lapic_timer_khz);
+
+    // Nothing to schedule here yet: sleep until an IPI arrives
+    for (;;) {
+        asm volatile ("sti; hlt");
+    }
+}
+
+void smp_init(void) {
+    percpu[0].online = 1;
+    if (acpi_find_smp_config(&smp_cfg) != 0) {
+        klog(KLOG_INFO, "smp: no MADT or MP table, staying on one CPU with the 8259s\n");
+        return;
+    }
+    if (apic_init(&smp_cfg) != 0) {
+        klog(KLOG_INFO, "smp: no usable APIC, staying on one CPU with the 8259s\n");
+        return;
+    }
+    percpu[0].apic_id = lapic_id();
+    percpu[0].lapic_timer_khz = lapic_timer_calibrate();
+    idt_set_gate(SMP_CALL_VECTOR, (uint32_t)isr240, GDT_KERNEL_CODE, 0x8E);
+    register_irq_handler(SMP_CALL_VECTOR, smp_call_handler, 0);
+    klog(KLOG_INFO, "smp: %u CPUs in the %s tables, LAPIC timer %u kHz\n",
+         smp_cfg.cpu_count, smp_cfg.source, percpu[0].lapic_timer_khz);
+}
+
+static int start_ap(uint32_t index, uint32_t apic_id, ap_params_t* params) {
+    phys_addr_t stack = alloc_pages(AP_STACK_ORDER);
+    if (!stack) {
+        klog(KLOG_WARN, "smp: no memory for the stack of CPU %u\n", index);
+        return -1;
+    }
+    params->stack = stack + (PAGE_SIZE << AP_STACK_ORDER);
+    params->arg = index;
+    percpu[index].apic_id = apic_id;
+
+    // INIT, then up to two startup IPIs (the second is ignored by a CPU
+    // that already left its wait-for-SIPI state)
+    lapic_send_init(apic_id);
+    clock_delay_us(AP_INIT_DELAY_US);
+    for (int sipi = 0; sipi < 2; sipi++) {
+        lapic_send_startup(apic_id, AP_TRAMPOLINE_ADDR / PAGE_SIZE);
+        clock_delay_us(AP_SIPI_DELAY_US);
+        if (__atomic_load_n(&percpu[index].online, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+    }
+    uint64_t deadline = ktime_ns() + (uint64_t)AP_ONLINE_TIMEOUT_US * 1000;
+    while (!__atomic_load_n(&percpu[index].online, __ATOMIC_ACQUIRE)) {
+        if (ktime_ns() > deadline) {
+            // The stack is not freed: the CPU might still turn up and use it
+            klog(KLOG_WARN, "smp: CPU with APIC id %u did not start\n", apic_id);
+            return -1;
+        }
+        cpu_relax();
+    }
+    return 0;
+}
+
+void smp_boot_aps(void) {
+    if (!apic_enabled() || smp_cfg.cpu_count < 2) {
+        return;
+    }
+    memcpy((void*)AP_TRAMPOLINE_ADDR, ap_trampoline, (uint32_t)(ap_trampoline_end - ap_trampoline));
+    ap_params_t* params = (ap_params_t*)(AP_TRAMPOLINE_ADDR + (ap_trampoline_params - ap_trampoline));
+    params->gdt_limit = gdt_descriptor.limit;
+    params->gdt_base = gdt_descriptor.base;
+    params->cr0 = read_cr0();
+    params->cr3 = read_cr3();
+    params->cr4 = read_cr4();
+    params->entry = (uint32_t)ap_main;
+
+    // One at a time: they all share the trampoline's parameter block
+    uint32_t index = 1;
+    for (uint32_t i = 0; i < smp_cfg.cpu_count && index < SMP_MAX_CPUS; i++) {
+        if (smp_cfg.apic_ids[i] == percpu[0].apic_id) {
+            continue;
+        }
+        if (start_ap(index, smp_cfg.apic_ids[i], params) == 0) {
+            index++;
+            cpus_online++;
+        }
+    }
+    klog(KLOG_INFO, "smp: %u of %u CPUs online\n", cpus_online, smp_cfg.cpu_count);
+}
+
+#ifdef CONFIG_BENCH
+#define SMP_BENCH_CALLS 10000
+
+static void smp_bench_nop(void* arg) {
+    (void)arg;
+}
+
+void smp_bench(void) {
+    if (cpus_online < 2) {
+        klog(KLOG_INFO, "smp bench: only one CPU online\n");
+        return;
+    }
+    for (uint32_t cpu = 1; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!percpu[cpu].online) {
+            continue;
+        }
+        uint64_t t0 = rdtsc();
+        for (uint32_t i = 0; i < SMP_BENCH_CALLS; i++) {
+            smp_call(cpu, smp_bench_nop, 0);
+        }
+        bench_report("smp.ipi_roundtrip", cpu, SMP_BENCH_CALLS, rdtsc() - t0);
+    }
+}
+#endif
@@ -0,0 +1,70 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stddef.h> // For offsetof
+#include "spinlock.h"
+
+// Multiprocessor support. The boot CPU runs the scheduler and takes every
+// device interrupt; application processors come up through the trampoline
+// in ap_boot.asm and then idle, running cross-CPU calls sent to them.
+
+#define SMP_MAX_CPUS     8
+#define SMP_CALL_VECTOR  0xF0 // IPI asking a CPU to run its pending smp_call()
+
+typedef void (*smp_call_fn_t)(void* arg);
+
+// Per-CPU area. Each CPU's GS segment starts at its own entry (see gdt.c),
+// so this_cpu() and cpu_index() are a single GS-relative load.
+typedef struct percpu {
+    struct percpu* self;        // %gs:0
+    uint32_t index;             // %gs:4, 0 for the boot CPU
+    uint32_t apic_id;
+    uint32_t lapic_timer_khz;   // LAPIC timer input clock
+    volatile uint32_t online;
+
+    // One cross-CPU call at a time, serialised by call_lock
+    spinlock_t call_lock;
+    smp_call_fn_t volatile call_fn;
+    void* volatile call_arg;
+    volatile uint32_t call_done;
+    uint32_t calls;             // Calls run on this CPU
+} __attribute__((aligned(64))) percpu_t; // One cache line each
+
+extern percpu_t percpu[SMP_MAX_CPUS];
+
+static inline percpu_t* this_cpu(void) {
+    percpu_t* p;
+    asm volatile ("movl %%gs:%c1, %0" : "=r"(p) : "i"(offsetof(percpu_t, self)));
+    return p;
+}
+
+static inline uint32_t cpu_index(void) {
+    uint32_t i;
+    asm volatile ("movl %%gs:%c1, %0" : "=r"(i) : "i"(offsetof(percpu_t, index)));
+    return i;
+}
+
+// Find the CPUs and interrupt controllers (ACPI MADT, else the MP table)
+// and switch from the 8259s to the I/O APIC. Needs paging and the TSC
+// clock; call before any IRQ is unmasked. Stays on the 8259s and one CPU
+// if the machine has no APIC.
+void smp_init(void);
+
+// Start the application processors, one at a time. Call with interrupts
+// enabled, after smp_init.
+void smp_boot_aps(void);
+
+uint32_t smp_cpu_count(void); // CPUs online, including the boot CPU
+
+// Run fn(arg) on cpu from its IPI handler and wait until it has returned.
+// fn runs in interrupt context. The caller spins with interrupts off, so
+// two CPUs must never call each other at the same time. Returns -1 if cpu
+// is not online.
+int smp_call(uint32_t cpu, smp_call_fn_t fn, void* arg);
+
+#ifdef CONFIG_BENCH
+void smp_bench(void); // IPI round trip to each other CPU
+#endif
+
+#endif // SMP_H
@@ -0,0 +1,39 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include "cpu.h" // For irq_save/irq_restore, cpu_relax
+
+// Ticket lock: each CPU takes the next ticket and waits for owner to reach
+// it, so waiters get the lock in arrival order. Code that also runs in
+// interrupt handlers must take it with the _irqsave variants.
+typedef struct {
+    volatile uint16_t next;  // Next ticket to hand out
+    volatile uint16_t owner; // Ticket now holding the lock
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0, 0 }
+
+static inline void spin_lock(spinlock_t* l) {
+    uint16_t ticket = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != ticket) {
+        cpu_relax();
+    }
+}
+
+static inline void spin_unlock(spinlock_t* l) {
+    __atomic_store_n(&l->owner, (uint16_t)(l->owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline uint32_t spin_lock_irqsave(spinlock_t* l) {
+    uint32_t flags = irq_save();
+    spin_lock(l);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* l, uint32_t flags) {
+    spin_unlock(l);
+    irq_restore(flags);
+}
+
+#endif // SPINLOCK_H
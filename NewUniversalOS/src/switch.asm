@@ -0,0 +1,23 @@
+bits 32
+
+section .text
+
+; void switch_context(uint32_t* prev_esp, uint32_t next_esp)
+; Called from schedule() with interrupts disabled. Only the callee-saved
+; registers need saving: the C caller already treats EAX, ECX and EDX as
+; clobbered, and EFLAGS is restored by the caller's irq_restore().
+global switch_context
+switch_context:
+    mov eax, [esp + 4]      ; prev_esp
+    mov edx, [esp + 8]      ; next_esp
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp          ; Save the outgoing stack pointer
+    mov esp, edx            ; and pick up the incoming one
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret                     ; Into the incoming thread's schedule() call, or thread_start
@@ -0,0 +1,149 @@
+bits 32
+
+; System call entry paths and the drop to ring 3 (see syscall.h, user.h)
+
+%define KERNEL_DATA_SEGMENT 0x10 ; From gdt.h
+%define USER_CODE_SEGMENT   0x1B
+%define USER_DATA_SEGMENT   0x23
+%define TSS_TO_PERCPU_SELECTOR (8 * 8) ; GDT_TSS(cpu) - GDT_PERCPU(cpu), as in idt.asm
+%define SYS_NULL  0
+%define SYS_EXIT  1
+%define SYS_COUNT 4              ; Must match syscall.h
+%define SYSCALL_ENOSYS 0xFFFFFFFF
+%define EFLAGS_USER 0x202        ; IF, plus the always-set bit 1
+
+extern syscall_table
+
+section .text
+
+; Data accesses in the handlers go through DS and ES, which must hold a flat
+; data segment. User code normally leaves the user data selector there; if
+; it loaded something else, put that back (the only reload on the fast
+; path). GS always gets this CPU's per-CPU segment, found through the task
+; register. Clobbers ECX.
+%macro SYSCALL_SEGMENTS 0
+    mov cx, ds
+    cmp cx, USER_DATA_SEGMENT
+    jne %%fix
+    mov cx, es
+    cmp cx, USER_DATA_SEGMENT
+    je %%ok
+%%fix:
+    mov cx, USER_DATA_SEGMENT
+    mov ds, cx
+    mov es, cx
+%%ok:
+    str cx
+    sub cx, TSS_TO_PERCPU_SELECTOR
+    mov gs, cx
+%endmacro
+
+; Call syscall_table[EAX](EBX, ESI, EDI); the result is left in EAX
+%macro SYSCALL_DISPATCH 0
+    cmp eax, SYS_COUNT
+    jae %%bad
+    push edi
+    push esi
+    push ebx
+    call [syscall_table + eax * 4]
+    add esp, 12
+    jmp %%done
+%%bad:
+    mov eax, SYSCALL_ENOSYS
+%%done:
+%endmacro
+
+; SYSENTER lands here with CS/SS from MSR 0x174, interrupts off and ESP
+; from MSR 0x175, which points at this CPU's TSS.esp0 rather than at a
+; stack: the current thread's kernel stack is one load away.
+global sysenter_entry
+sysenter_entry:
+    mov esp, [esp]
+    push ecx                    ; User ESP, for SYSEXIT
+    push edx                    ; User EIP, for SYSEXIT
+    push gs
+    SYSCALL_SEGMENTS
+    cld
+    sti
+    SYSCALL_DISPATCH
+    pop gs
+    pop edx
+    pop ecx
+    sysexit                     ; IF stays set, as the user had it
+
+; int 0x80, through a DPL 3 trap gate: interrupts stay enabled and the CPU
+; has already switched to TSS.esp0
+global syscall_int80
+syscall_int80:
+    push gs
+    SYSCALL_SEGMENTS
+    cld
+    SYSCALL_DISPATCH
+    pop gs
+    iret
+
+; void user_enter(uint32_t eip, uint32_t esp): leave for ring 3, never to
+; return. The kernel stack is abandoned; the next entry from ring 3 starts
+; again at its top.
+global user_enter
+user_enter:
+    mov ecx, [esp + 4]
+    mov edx, [esp + 8]
+    mov ax, USER_DATA_SEGMENT
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    push dword USER_DATA_SEGMENT ; SS
+    push edx                     ; ESP
+    push dword EFLAGS_USER
+    push dword USER_CODE_SEGMENT
+    push ecx                     ; EIP
+    xor eax, eax                 ; Leave no kernel values behind
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    iret
+
+; Null system call benchmark, run in ring 3 from a copy in user memory, so
+; it must be position independent. cdecl entry(path, count): make count
+; SYS_NULL calls through int 0x80 (path 0) or SYSENTER (path 1), then exit
+; with the TSC cycles they took (low 32 bits).
+section .rodata
+global user_null_bench, user_null_bench_end
+user_null_bench:
+    mov esi, [esp + 4]           ; path
+    mov edi, [esp + 8]           ; count
+    call .base
+.base:
+    pop ebp                      ; Where this copy runs
+    rdtsc
+    mov ebx, eax
+    test esi, esi
+    jnz .sysenter_loop
+.int80_loop:
+    mov eax, SYS_NULL
+    int 0x80
+    dec edi
+    jnz .int80_loop
+    jmp .done
+.sysenter_loop:
+    mov eax, SYS_NULL
+    mov ecx, esp
+    lea edx, [ebp + .sysenter_return - .base]
+    sysenter
+.sysenter_return:
+    dec edi
+    jnz .sysenter_loop
+.done:
+    rdtsc
+    sub eax, ebx
+    mov ebx, eax
+    mov eax, SYS_EXIT
+    int 0x80
+.hang:
+    jmp .hang
+user_null_bench_end:
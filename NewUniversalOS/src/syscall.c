@@ -0,0 +1,114 @@
+#include "syscall.h"
+#include "user.h"
+#include "gdt.h"
+#include "idt.h"
+#include "sched.h"
+#include "serial.h"
+#include "klog.h"
+#include "cpu.h"
+#include "smp.h"
+#include "bench.h"
+
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+#define CPUID_EDX_SEP (1u << 11)
+#define IDT_TRAP_GATE_USER 0xEF // Present, DPL 3 (reachable with int from ring 3), 32-bit trap gate
+
+extern void sysenter_entry(void); // syscall.asm
+extern void syscall_int80(void);
+
+static int have_sysenter = 0;
+
+static uint32_t sys_null(uint32_t a1, uint32_t a2, uint32_t a3) {
+    (void)a1;
+    (void)a2;
+    (void)a3;
+    return 0;
+}
+
+static uint32_t sys_exit(uint32_t code, uint32_t a2, uint32_t a3) {
+    (void)a2;
+    (void)a3;
+    user_exit(code);
+}
+
+static uint32_t sys_write(uint32_t buf, uint32_t len, uint32_t a3) {
+    (void)a3;
+    if (!user_range_ok(buf, len)) {
+        return SYSCALL_EFAULT;
+    }
+    return serial_write((const char*)buf, len);
+}
+
+static uint32_t sys_yield(uint32_t a1, uint32_t a2, uint32_t a3) {
+    (void)a1;
+    (void)a2;
+    (void)a3;
+    thread_yield();
+    return 0;
+}
+
+const syscall_fn_t syscall_table[SYS_COUNT] = {
+    [SYS_NULL]  = sys_null,
+    [SYS_EXIT]  = sys_exit,
+    [SYS_WRITE] = sys_write,
+    [SYS_YIELD] = sys_yield,
+};
+
+int syscall_have_sysenter(void) {
+    return have_sysenter;
+}
+
+void syscall_init_cpu(void) {
+    if (!have_sysenter) {
+        return;
+    }
+    // SYSENTER loads ESP from the MSR, which cannot follow thread switches;
+    // point it at this CPU's TSS.esp0 and let the entry code load through it
+    wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)gdt_kernel_stack_slot(cpu_index()));
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+}
+
+void syscall_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    uint32_t family = (a >> 8) & 0xF, model = (a >> 4) & 0xF, stepping = a & 0xF;
+    // Early Pentium Pros report SEP but do not implement it
+    have_sysenter = (d & CPUID_EDX_SEP) && !(family == 6 && model < 3 && stepping < 3);
+
+    idt_set_gate(SYSCALL_VECTOR, (uint32_t)syscall_int80, GDT_KERNEL_CODE, IDT_TRAP_GATE_USER);
+    syscall_init_cpu();
+    klog(KLOG_INFO, "syscall: int 0x80%s\n", have_sysenter ? " and SYSENTER" : " only, no SYSENTER");
+}
+
+#ifdef CONFIG_BENCH
+#define SYSCALL_BENCH_CALLS 100000
+#define SYSCALL_BENCH_INT80    0 // Paths understood by user_null_bench
+#define SYSCALL_BENCH_SYSENTER 1
+
+extern const uint8_t user_null_bench[], user_null_bench_end[]; // syscall.asm
+
+static void syscall_bench_path(const char* name, uint32_t path) {
+    user_task_t* t = user_spawn("sysbench", user_null_bench, (uint32_t)(user_null_bench_end - user_null_bench),
+                                path, SYSCALL_BENCH_CALLS, thread_current()->priority);
+    if (!t) {
+        klog(KLOG_WARN, "syscall bench: could not start the user task\n");
+        return;
+    }
+    uint32_t cycles = user_wait(t);
+    if (cycles == 0xFFFFFFFF) {
+        return; // Killed; user_fault has said why
+    }
+    bench_report(name, 0, SYSCALL_BENCH_CALLS, cycles);
+}
+
+void syscall_bench(void) {
+    syscall_bench_path("syscall.int80", SYSCALL_BENCH_INT80);
+    if (have_sysenter) {
+        syscall_bench_path("syscall.sysenter", SYSCALL_BENCH_SYSENTER);
+    }
+}
+#endif
@@ -0,0 +1,40 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include <stdint.h>
+
+// System calls from ring 3. The number goes in EAX and up to three
+// arguments in EBX, ESI and EDI; the result comes back in EAX. ECX and EDX
+// are clobbered, everything else is preserved.
+//
+// Two entry paths share the table: SYSENTER (user code puts its ESP in ECX
+// and its return address in EDX first; SYSEXIT takes them from there) and
+// int 0x80 for CPUs without SYSENTER. Neither saves more than it has to:
+// the handlers are plain C functions, which preserve EBX, ESI, EDI and EBP
+// themselves.
+
+#define SYSCALL_VECTOR 0x80
+
+#define SYS_NULL   0 // Does nothing; for measuring the entry path
+#define SYS_EXIT   1 // (code) End the calling task
+#define SYS_WRITE  2 // (buf, len) Write to the serial console; returns bytes written
+#define SYS_YIELD  3
+#define SYS_COUNT  4 // Must match syscall.asm
+
+#define SYSCALL_ENOSYS 0xFFFFFFFF // Returned for unknown numbers
+#define SYSCALL_EFAULT 0xFFFFFFFE // Returned for buffers outside user memory
+
+typedef uint32_t (*syscall_fn_t)(uint32_t a1, uint32_t a2, uint32_t a3);
+extern const syscall_fn_t syscall_table[SYS_COUNT];
+
+// Install the int 0x80 gate and set up SYSENTER on the boot CPU
+void syscall_init(void);
+// SYSENTER MSRs for an application processor
+void syscall_init_cpu(void);
+int syscall_have_sysenter(void);
+
+#ifdef CONFIG_BENCH
+void syscall_bench(void); // Null system call from ring 3 through each entry path
+#endif
+
+#endif // SYSCALL_H
@@ -0,0 +1,229 @@
+#include "timer.h"
+#include "clock.h"
+#include "pit.h"
+#include "cpu.h"
+
+// Four levels of 64 slots. Level n slot covers 64^n ticks, so the wheel
+// spans 2^24 ticks (~4.9 hours); later deadlines are clamped to that.
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS   6
+#define WHEEL_SIZE   (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_MAX_DELTA ((1ULL << (WHEEL_LEVELS * WHEEL_BITS)) - 1)
+
+#define TIMER_TICK_NS (1ULL << TIMER_TICK_SHIFT)
+#define TIMER_NONE    (~0ULL)
+
+// One-shot bounds: the PIT cannot count longer than ~54.9 ms, and anything
+// much shorter than the interrupt overhead is not worth programming.
+#define ONESHOT_MIN_NS 20000
+#define ONESHOT_MAX_NS 54000000
+
+typedef struct timer {
+    struct timer* next;
+    struct timer* prev;
+    uint64_t expires;     // Wheel tick at which the timer fires
+    timer_fn_t fn;
+    void* arg;
+    uint16_t generation;  // Bumped on every reuse so stale ids are rejected
+    uint8_t level;
+    uint8_t slot;
+    uint8_t pending;
+} timer_t;
+
+static timer_t timer_pool[TIMER_POOL_SIZE];
+static timer_t* timer_free_list = 0;
+
+static timer_t* wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint64_t wheel_occupied[WHEEL_LEVELS]; // Bit n set: slot n is non-empty
+static uint64_t wheel_now = 0;                // Next tick to process
+static uint32_t timers_pending = 0;
+static uint64_t armed_deadline_ns = TIMER_NONE;
+
+void timer_init(void) {
+    for (int i = TIMER_POOL_SIZE - 1; i >= 0; i--) {
+        timer_pool[i].next = timer_free_list;
+        timer_free_list = &timer_pool[i];
+    }
+    wheel_now = ktime_ns() >> TIMER_TICK_SHIFT;
+}
+
+static timer_id_t timer_id(timer_t* t) {
+    return ((uint32_t)t->generation << 8) | (uint32_t)(t - timer_pool + 1);
+}
+
+static void timer_free(timer_t* t) {
+    t->pending = 0;
+    t->generation++;
+    t->next = timer_free_list;
+    timer_free_list = t;
+}
+
+static void wheel_insert(timer_t* t) {
+    if (t->expires < wheel_now) {
+        t->expires = wheel_now;
+    }
+    uint64_t delta = t->expires - wheel_now;
+    if (delta > WHEEL_MAX_DELTA) {
+        delta = WHEEL_MAX_DELTA;
+        t->expires = wheel_now + delta;
+    }
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << ((level + 1) * WHEEL_BITS))) {
+        level++;
+    }
+    uint8_t slot = (t->expires >> (level * WHEEL_BITS)) & WHEEL_MASK;
+
+    t->level = level;
+    t->slot = slot;
+    t->prev = 0;
+    t->next = wheel[level][slot];
+    if (t->next) {
+        t->next->prev = t;
+    }
+    wheel[level][slot] = t;
+    wheel_occupied[level] |= 1ULL << slot;
+}
+
+static void wheel_unlink(timer_t* t) {
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        wheel[t->level][t->slot] = t->next;
+    }
+    if (t->next) {
+        t->next->prev = t->prev;
+    }
+    if (!wheel[t->level][t->slot]) {
+        wheel_occupied[t->level] &= ~(1ULL << t->slot);
+    }
+}
+
+// Re-sort one slot of a coarser level into finer levels. Returns the slot index.
+static uint32_t wheel_cascade(int level, uint32_t slot) {
+    timer_t* t = wheel[level][slot];
+    wheel[level][slot] = 0;
+    wheel_occupied[level] &= ~(1ULL << slot);
+    while (t) {
+        timer_t* next = t->next;
+        wheel_insert(t);
+        t = next;
+    }
+    return slot;
+}
+
+// Tick at which the PIT should next fire, or TIMER_NONE if nothing is pending
+static uint64_t wheel_next_expiry(void) {
+    if (!timers_pending) {
+        return TIMER_NONE;
+    }
+    uint32_t index = wheel_now & WHEEL_MASK;
+    uint64_t ahead = wheel_occupied[0] >> index;
+    if (ahead) {
+        return wheel_now + ctz64(ahead);
+    }
+    // Nothing left in this rotation of level 0: wake up for the next cascade
+    return (wheel_now | WHEEL_MASK) + 1;
+}
+
+static void timer_arm(void) {
+    uint64_t tick = wheel_next_expiry();
+    if (tick == TIMER_NONE) {
+        armed_deadline_ns = TIMER_NONE; // Nothing to wait for: leave the PIT idle
+        return;
+    }
+    uint64_t now = ktime_ns();
+    uint64_t deadline = tick << TIMER_TICK_SHIFT;
+    uint64_t delta = deadline > now ? deadline - now : 0;
+    if (delta < ONESHOT_MIN_NS) delta = ONESHOT_MIN_NS;
+    if (delta > ONESHOT_MAX_NS) delta = ONESHOT_MAX_NS;
+    armed_deadline_ns = now + delta;
+    pit_set_oneshot((uint32_t)delta);
+}
+
+timer_id_t timer_add(uint64_t ns, timer_fn_t cb, void* arg) {
+    uint32_t flags = irq_save();
+    timer_t* t = timer_free_list;
+    if (!t) {
+        irq_restore(flags);
+        return 0;
+    }
+    timer_free_list = t->next;
+
+    uint64_t now = ktime_ns();
+    uint64_t now_tick = now >> TIMER_TICK_SHIFT;
+    if (!timers_pending && now_tick > wheel_now) {
+        wheel_now = now_tick; // The wheel was idle: skip the empty ticks
+    }
+    t->expires = (now + ns + TIMER_TICK_NS - 1) >> TIMER_TICK_SHIFT;
+    t->fn = cb;
+    t->arg = arg;
+    t->pending = 1;
+    wheel_insert(t);
+    timers_pending++;
+
+    if ((t->expires << TIMER_TICK_SHIFT) < armed_deadline_ns) {
+        timer_arm();
+    }
+    timer_id_t id = timer_id(t);
+    irq_restore(flags);
+    return id;
+}
+
+int timer_cancel(timer_id_t id) {
+    uint32_t index = (id & 0xFF) - 1;
+    if (index >= TIMER_POOL_SIZE) {
+        return 0;
+    }
+    uint32_t flags = irq_save();
+    timer_t* t = &timer_pool[index];
+    int cancelled = 0;
+    if (t->pending && t->generation == (uint16_t)(id >> 8)) {
+        wheel_unlink(t);
+        timers_pending--;
+        timer_free(t);
+        cancelled = 1;
+    }
+    irq_restore(flags);
+    return cancelled; // An early PIT interrupt is harmless, so no re-arm
+}
+
+void timer_interrupt(void) {
+    uint64_t target = ktime_ns() >> TIMER_TICK_SHIFT;
+
+    while (wheel_now <= target) {
+        if (!timers_pending) {
+            wheel_now = target + 1;
+            break;
+        }
+        uint32_t index = wheel_now & WHEEL_MASK;
+        if (!index) {
+            // Level 0 wrapped: pull the next slot of each coarser level down
+            for (int level = 1; level < WHEEL_LEVELS; level++) {
+                if (wheel_cascade(level, (wheel_now >> (level * WHEEL_BITS)) & WHEEL_MASK)) {
+                    break;
+                }
+            }
+        }
+
+        // Detach the slot and advance first, so callbacks that re-add
+        // themselves land in a later slot rather than this one
+        timer_t* t = wheel[0][index];
+        wheel[0][index] = 0;
+        wheel_occupied[0] &= ~(1ULL << index);
+        wheel_now++;
+
+        while (t) {
+            timer_t* next = t->next;
+            timer_fn_t fn = t->fn;
+            void* arg = t->arg;
+            timers_pending--;
+            timer_free(t);
+            fn(arg);
+            t = next;
+        }
+    }
+
+    timer_arm();
+}
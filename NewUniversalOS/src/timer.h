@@ -0,0 +1,28 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// Hierarchical timer wheel driven by one-shot PIT interrupts.
+// Resolution is one wheel tick of 2^20 ns (~1.05 ms).
+
+#define TIMER_TICK_SHIFT 20
+#define TIMER_POOL_SIZE  64
+
+typedef uint32_t timer_id_t; // 0 is never a valid id
+typedef void (*timer_fn_t)(void* arg);
+
+void timer_init(void);
+
+// Run cb(arg) once, ns nanoseconds from now. Callbacks run in interrupt
+// context and may add new timers (re-adding themselves gives a periodic timer).
+// Returns 0 if the timer pool is exhausted. O(1).
+timer_id_t timer_add(uint64_t ns, timer_fn_t cb, void* arg);
+
+// Cancel a pending timer. Returns 1 if it was pending, 0 if it already ran
+// or was cancelled. O(1).
+int timer_cancel(timer_id_t id);
+
+void timer_interrupt(void); // IRQ0: run expired timers and arm the PIT for the next one
+
+#endif // TIMER_H
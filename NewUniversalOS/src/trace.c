@@ -0,0 +1,163 @@
+#include "trace.h"
+#include "dbgcon.h"
+#include "clock.h"
+#include "klib.h"
+#include "klog.h"
+
+// Dump records (framed by dbgcon_send_record)
+#define TRACE_MAGIC      0x31435254 // 'TRC1'
+#define TRACE_REC_HEADER 1          // TSC kHz, CPUs, ring size
+#define TRACE_REC_NAMES  2          // n x {u16 id, u16 length, name bytes}
+#define TRACE_REC_EVENTS 3          // n x trace_event_t, oldest first
+#define TRACE_REC_HIST   4          // n x {vector, TRACE_HIST_BUCKETS counts}
+#define TRACE_REC_END    5
+
+#define TRACE_NAME_OTHER (TRACE_MAX_NAMES - 1) // Shared by names past the end of the table
+
+trace_ring_t trace_rings[TRACE_MAX_CPUS];
+volatile int trace_enabled = 1;
+
+static uint32_t irq_hist[256][TRACE_HIST_BUCKETS];
+static const char* names[TRACE_MAX_NAMES] = { [TRACE_NAME_OTHER] = "(other)" };
+static uint32_t name_count = 0;
+static uint8_t payload[DBGCON_RECORD_MAX];
+
+void trace_irq_exit(uint32_t vector, uint64_t entry_tsc) {
+    uint64_t tsc = rdtsc();
+    trace_event_at(TRACE_IRQ_EXIT, vector, tsc);
+    uint32_t cycles = (uint32_t)(tsc - entry_tsc);
+    uint32_t bucket = cycles ? 31 - (uint32_t)__builtin_clz(cycles) : 0;
+    if (bucket >= TRACE_HIST_BUCKETS) {
+        bucket = TRACE_HIST_BUCKETS - 1;
+    }
+    irq_hist[vector & 0xFF][bucket]++;
+}
+
+uint32_t trace_name(const char* name) {
+    uint32_t flags = irq_save();
+    uint32_t id = 0;
+    while (id < name_count && names[id] != name) {
+        id++;
+    }
+    if (id == name_count) {
+        if (name_count < TRACE_NAME_OTHER) {
+            names[name_count++] = name;
+        } else {
+            id = TRACE_NAME_OTHER;
+        }
+    }
+    irq_restore(flags);
+    return id;
+}
+
+void trace_boot_phase(const char* name) {
+    trace_event_irqsave(TRACE_BOOT_PHASE, trace_name(name));
+}
+
+static uint8_t* put16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    return p + 2;
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t v) {
+    p = put16(p, (uint16_t)v);
+    return put16(p, (uint16_t)(v >> 16));
+}
+
+// Send what has been packed into payload so far and start over
+static uint8_t* flush_record(uint8_t type, uint8_t* p) {
+    if (p != payload) {
+        dbgcon_send_record(TRACE_MAGIC, type, payload, (uint32_t)(p - payload));
+    }
+    return payload;
+}
+
+void trace_dump(void) {
+    trace_enabled = 0; // Freeze the rings while they are read
+
+    uint8_t* p = payload;
+    p = put32(p, clock_tsc_khz());
+    p = put32(p, TRACE_MAX_CPUS);
+    p = put32(p, TRACE_RING_SIZE);
+    p = flush_record(TRACE_REC_HEADER, p);
+
+    for (uint32_t id = 0; id < TRACE_MAX_NAMES; id++) {
+        if (!names[id]) {
+            continue;
+        }
+        uint32_t len = 0;
+        while (names[id][len] && len < 255) len++;
+        if (p + 4 + len > payload + DBGCON_RECORD_MAX) {
+            p = flush_record(TRACE_REC_NAMES, p);
+        }
+        p = put16(p, (uint16_t)id);
+        p = put16(p, (uint16_t)len);
+        memcpy(p, names[id], len);
+        p += len;
+    }
+    p = flush_record(TRACE_REC_NAMES, p);
+
+    // trace_event_t is already in the little-endian wire layout
+    for (uint32_t cpu = 0; cpu < TRACE_MAX_CPUS; cpu++) {
+        const trace_ring_t* r = &trace_rings[cpu];
+        uint32_t n = r->head < TRACE_RING_SIZE ? r->head : TRACE_RING_SIZE;
+        for (uint32_t pos = r->head - n; pos != r->head; pos++) {
+            if (p + sizeof(trace_event_t) > payload + DBGCON_RECORD_MAX) {
+                p = flush_record(TRACE_REC_EVENTS, p);
+            }
+            memcpy(p, &r->ring[pos & (TRACE_RING_SIZE - 1)], sizeof(trace_event_t));
+            p += sizeof(trace_event_t);
+        }
+        p = flush_record(TRACE_REC_EVENTS, p);
+    }
+
+    for (uint32_t v = 0; v < 256; v++) {
+        uint32_t any = 0;
+        for (uint32_t b = 0; b < TRACE_HIST_BUCKETS; b++) any |= irq_hist[v][b];
+        if (!any) {
+            continue;
+        }
+        if (p + 4 + 4 * TRACE_HIST_BUCKETS > payload + DBGCON_RECORD_MAX) {
+            p = flush_record(TRACE_REC_HIST, p);
+        }
+        p = put32(p, v);
+        for (uint32_t b = 0; b < TRACE_HIST_BUCKETS; b++) {
+            p = put32(p, irq_hist[v][b]);
+        }
+    }
+    flush_record(TRACE_REC_HIST, p);
+    dbgcon_send_record(TRACE_MAGIC, TRACE_REC_END, payload, 0);
+
+    trace_enabled = 1;
+}
+
+// Upper bound in cycles of the bucket holding the pct-th percentile
+static uint32_t hist_percentile(const uint32_t* hist, uint32_t total, uint32_t pct) {
+    uint32_t want = (total * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (uint32_t b = 0; b < TRACE_HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= want) {
+            return 2u << b;
+        }
+    }
+    return 2u << (TRACE_HIST_BUCKETS - 1);
+}
+
+void trace_dump_hist(void) {
+    for (uint32_t v = 0; v < 256; v++) {
+        uint32_t total = 0;
+        for (uint32_t b = 0; b < TRACE_HIST_BUCKETS; b++) total += irq_hist[v][b];
+        if (!total) {
+            continue;
+        }
+        klog(KLOG_INFO, "trace: vector %u: %u entries, p50 < %u, p99 < %u cycles\n",
+             v, total, hist_percentile(irq_hist[v], total, 50), hist_percentile(irq_hist[v], total, 99));
+    }
+}
+
+void trace_init(void) {
+    dbgcon_register('t', trace_dump, "dump the event trace (tools/trace2json.py)");
+    dbgcon_register('l', trace_dump_hist, "log interrupt latency histograms");
+}
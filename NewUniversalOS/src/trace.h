@@ -0,0 +1,93 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "cpu.h"
+#include "smp.h" // For cpu_index
+
+// Static tracepoints. Each event is a TSC stamp, the CPU, an event id and
+// one argument, written to that CPU's ring, which keeps the most recent
+// TRACE_RING_SIZE events. Recording is a few stores, so tracepoints stay
+// compiled in. The 't' debug command dumps the rings for
+// tools/trace2json.py; 'l' logs per-vector interrupt latency histograms.
+
+#define TRACE_MAX_CPUS     SMP_MAX_CPUS
+#define TRACE_RING_SIZE    2048 // Events per CPU (power of two)
+#define TRACE_MAX_NAMES    64
+#define TRACE_HIST_BUCKETS 24   // log2 of cycles; the last bucket takes everything longer
+
+// Event ids
+#define TRACE_IRQ_ENTRY    1 // arg: vector
+#define TRACE_IRQ_EXIT     2 // arg: vector
+#define TRACE_IRQ_EOI      3 // arg: ISA IRQ line
+#define TRACE_SCHED_SWITCH 4 // arg: id of the thread switched to
+#define TRACE_BOOT_PHASE   5 // arg: name id; the phase lasts until the next one
+
+typedef struct {
+    uint64_t tsc;
+    uint16_t id;
+    uint8_t cpu;
+    uint8_t reserved;
+    uint32_t arg;
+} trace_event_t;
+
+typedef struct {
+    uint32_t head;         // Events ever written; the ring holds the last TRACE_RING_SIZE
+    trace_event_t ring[TRACE_RING_SIZE];
+} trace_ring_t;
+
+extern trace_ring_t trace_rings[TRACE_MAX_CPUS];
+extern volatile int trace_enabled;
+
+static inline uint32_t trace_cpu(void) {
+    return cpu_index();
+}
+
+// Record an event on this CPU's ring. Interrupts must be disabled, as they
+// are in interrupt handlers; elsewhere use trace_event_irqsave().
+static inline void trace_event_at(uint16_t id, uint32_t arg, uint64_t tsc) {
+    if (!trace_enabled) {
+        return;
+    }
+    uint32_t cpu = trace_cpu();
+    trace_ring_t* r = &trace_rings[cpu];
+    trace_event_t* e = &r->ring[r->head & (TRACE_RING_SIZE - 1)];
+    e->tsc = tsc;
+    e->id = id;
+    e->cpu = (uint8_t)cpu;
+    e->arg = arg;
+    r->head++;
+}
+
+static inline void trace_event(uint16_t id, uint32_t arg) {
+    trace_event_at(id, arg, rdtsc());
+}
+
+static inline void trace_event_irqsave(uint16_t id, uint32_t arg) {
+    uint32_t flags = irq_save();
+    trace_event(id, arg);
+    irq_restore(flags);
+}
+
+// Interrupt entry and exit, called by the dispatcher. exit also adds the
+// time since entry to the vector's latency histogram.
+static inline uint64_t trace_irq_enter(uint32_t vector) {
+    uint64_t tsc = rdtsc();
+    trace_event_at(TRACE_IRQ_ENTRY, vector, tsc);
+    return tsc;
+}
+void trace_irq_exit(uint32_t vector, uint64_t entry_tsc);
+
+// Id for a string that must stay valid forever (names are compared by
+// pointer). Returns TRACE_MAX_NAMES - 1 once the table is full.
+uint32_t trace_name(const char* name);
+
+// Mark the start of a named boot phase
+void trace_boot_phase(const char* name);
+
+// Register the 't' and 'l' debug console commands
+void trace_init(void);
+void trace_dump(void);      // Binary records over serial (thread context)
+void trace_dump_hist(void); // Latency percentiles per vector to klog
+
+#endif // TRACE_H
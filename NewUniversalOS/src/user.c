@@ -0,0 +1,142 @@
+#include "user.h"
+#include "sched.h"
+#include "paging.h"
+#include "pmm.h"
+#include "slab.h"
+#include "klib.h"
+#include "klog.h"
+#include "cpu.h"
+
+extern void user_enter(uint32_t eip, uint32_t esp) __attribute__((noreturn)); // syscall.asm
+
+struct user_task {
+    uint32_t base;            // First page of the task's range
+    uint32_t image_pages;
+    uint32_t arg0;
+    uint32_t arg1;
+    volatile uint32_t exited;
+    uint32_t exit_code;
+    wait_queue_t waiters;     // user_wait callers
+};
+
+static uint32_t user_next = USER_BASE; // Next free page of the window; ranges are never reused
+
+static uint32_t stack_base(const user_task_t* t) {
+    return t->base + (t->image_pages + 1) * PAGE_SIZE; // Past the guard page
+}
+
+static int map_range(uint32_t start, uint32_t pages) {
+    for (uint32_t i = 0; i < pages; i++) {
+        phys_addr_t frame = alloc_pages(0);
+        if (!frame) {
+            return -1;
+        }
+        if (map_page(start + i * PAGE_SIZE, frame, PTE_USER | PTE_WRITE) != 0) {
+            free_pages(frame, 0);
+            return -1;
+        }
+        memset((void*)(start + i * PAGE_SIZE), 0, PAGE_SIZE);
+    }
+    return 0;
+}
+
+static void unmap_range(uint32_t start, uint32_t pages) {
+    for (uint32_t i = 0; i < pages; i++) {
+        phys_addr_t frame = unmap_page(start + i * PAGE_SIZE);
+        if (frame) {
+            free_pages(frame, 0);
+        }
+    }
+}
+
+static void user_unmap(user_task_t* t) {
+    unmap_range(t->base, t->image_pages);
+    unmap_range(stack_base(t), USER_STACK_PAGES);
+}
+
+// Kernel side of the task: build the cdecl frame for entry(arg0, arg1) on
+// the user stack and drop to ring 3
+static void user_thread(void* arg) {
+    user_task_t* t = arg;
+    thread_current()->user = t;
+    uint32_t* sp = (uint32_t*)(stack_base(t) + USER_STACK_PAGES * PAGE_SIZE);
+    *--sp = t->arg1;
+    *--sp = t->arg0;
+    *--sp = 0; // Return address: entry must not return
+    user_enter(t->base, (uint32_t)sp);
+}
+
+user_task_t* user_spawn(const char* name, const void* image, uint32_t size,
+                        uint32_t arg0, uint32_t arg1, uint32_t priority) {
+    uint32_t image_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t span = (image_pages + 1 + USER_STACK_PAGES) * PAGE_SIZE;
+    user_task_t* t = kmalloc(sizeof(*t));
+    if (!t) {
+        return 0;
+    }
+
+    uint32_t flags = irq_save();
+    if (image_pages == 0 || span > USER_END - user_next) {
+        irq_restore(flags);
+        kfree(t);
+        return 0;
+    }
+    *t = (user_task_t){ 0 };
+    t->base = user_next;
+    t->image_pages = image_pages;
+    t->arg0 = arg0;
+    t->arg1 = arg1;
+    user_next += span;
+    irq_restore(flags);
+
+    if (map_range(t->base, image_pages) != 0 || map_range(stack_base(t), USER_STACK_PAGES) != 0) {
+        user_unmap(t);
+        kfree(t);
+        return 0;
+    }
+    memcpy((void*)t->base, image, size);
+    if (!thread_create(name, user_thread, t, priority)) {
+        user_unmap(t);
+        kfree(t);
+        return 0;
+    }
+    return t;
+}
+
+uint32_t user_wait(user_task_t* t) {
+    uint32_t flags = irq_save();
+    while (!t->exited) {
+        wait_queue_sleep(&t->waiters);
+    }
+    irq_restore(flags);
+    uint32_t code = t->exit_code;
+    kfree(t);
+    return code;
+}
+
+void user_exit(uint32_t code) {
+    user_task_t* t = thread_current()->user;
+    user_unmap(t); // We are on the kernel stack; nothing in ring 3 runs again
+    asm volatile ("cli");
+    t->exit_code = code;
+    t->exited = 1;
+    wait_queue_wake_all(&t->waiters); // The waiter may free t as soon as we switch away
+    thread_exit();
+}
+
+void user_fault(const registers_t* regs) {
+    klog(KLOG_WARN, "user: task killed by exception %u at 0x%08x, error 0x%x\n",
+         regs->int_no, regs->eip, regs->err_code);
+    user_exit(0xFFFFFFFF);
+}
+
+int user_range_ok(uint32_t addr, uint32_t len) {
+    const user_task_t* t = thread_current()->user;
+    uint32_t end = addr + len;
+    if (!t || end < addr) {
+        return 0;
+    }
+    uint32_t image_end = t->base + t->image_pages * PAGE_SIZE;
+    uint32_t stack_end = stack_base(t) + USER_STACK_PAGES * PAGE_SIZE;
+    return (addr >= t->base && end <= image_end) || (addr >= stack_base(t) && end <= stack_end);
+}
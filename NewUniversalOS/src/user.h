@@ -0,0 +1,37 @@
+#ifndef USER_H
+#define USER_H
+
+#include <stdint.h>
+#include "idt.h" // For registers_t
+
+// Ring-3 tasks. A task is a kernel thread that drops to ring 3 at the start
+// of a flat binary image. Tasks share the kernel's page directory; their
+// pages are the only ones mapped with PTE_USER, so they cannot touch kernel
+// memory. Each task gets its own range of the user window, laid out as
+// image, an unmapped guard page, then the stack.
+
+#define USER_BASE        0xC0000000u // Above any RAM the identity map covers (PMM_PHYS_LIMIT)
+#define USER_END         0xD0000000u // KERNEL_VMAP_BASE
+#define USER_STACK_PAGES 4
+
+typedef struct user_task user_task_t;
+
+// Copy image into fresh user pages and start it at its first byte as a
+// cdecl function entry(arg0, arg1), which must end with SYS_EXIT. Returns 0
+// if out of memory or user address space. Every task must be waited for.
+user_task_t* user_spawn(const char* name, const void* image, uint32_t size,
+                        uint32_t arg0, uint32_t arg1, uint32_t priority);
+
+// Block until the task has exited, free it and return its exit code
+uint32_t user_wait(user_task_t* task);
+
+// End the calling task (SYS_EXIT). Its pages are freed right away.
+void user_exit(uint32_t code) __attribute__((noreturn));
+
+// A CPU exception in ring 3: log it and end the task with code 0xFFFFFFFF
+void user_fault(const registers_t* regs) __attribute__((noreturn));
+
+// Nonzero if [addr, addr + len) lies inside the calling task's pages
+int user_range_ok(uint32_t addr, uint32_t len);
+
+#endif // USER_H
@@ -1,16 +1,110 @@
 #include "vga_text.h"
+#include "klib.h"
+#include "timer.h"
+#include "clock.h"
+#include "ports.h"
+#include "cpu.h"
+#ifdef CONFIG_BENCH
+#include "klog.h"
+#include "bench.h"
+#endif
+
+#define VGA_WIDTH  80
+#define VGA_HEIGHT 25
+#define VGA_ALL_ROWS ((1u << VGA_HEIGHT) - 1)
+
+#define VGA_CRTC_INDEX  0x3D4
+#define VGA_CRTC_DATA   0x3D5
+#define VGA_CURSOR_HIGH 0x0E
+#define VGA_CURSOR_LOW  0x0F
+
+#define VGA_FLUSH_PERIOD_NS (NSEC_PER_SEC / 60) // At most one flush per frame
 
 volatile unsigned short* video_memory = (unsigned short*)0xB8000;
 int cursor_row = 0;
 int cursor_col = 0;
-const int VGA_WIDTH = 80;
-const int VGA_HEIGHT = 25;
+
+// Everything is drawn into a RAM shadow of the screen and copied out by
+// vga_flush(). The shadow is a ring of rows: screen row r lives in
+// shadow[(top_row + r) % VGA_HEIGHT], so scrolling only advances top_row and
+// blanks one row. All state is updated with interrupts disabled, since the
+// flush runs from a timer callback.
+static uint16_t shadow[VGA_HEIGHT][VGA_WIDTH];
+static int top_row = 0;
+static uint32_t dirty_rows = 0; // Bit r set: screen row r is out of date
+static int cursor_dirty = 0;
+static timer_id_t flush_timer = 0;
+
+static inline uint16_t* shadow_row(int row) {
+    int r = top_row + row;
+    if (r >= VGA_HEIGHT) r -= VGA_HEIGHT;
+    return shadow[r];
+}
+
+static void vga_flush_locked(void) {
+    while (dirty_rows) {
+        // Copy each run of dirty rows in one go; a run is contiguous in the
+        // shadow unless it wraps around the end of the ring
+        int first = __builtin_ctz(dirty_rows);
+        int count = __builtin_ctz(~(dirty_rows >> first));
+        int start = top_row + first;
+        if (start >= VGA_HEIGHT) start -= VGA_HEIGHT;
+        int before_wrap = VGA_HEIGHT - start;
+        unsigned short* screen = (unsigned short*)video_memory + first * VGA_WIDTH;
+        if (count > before_wrap) {
+            memcpy(screen, shadow[start], before_wrap * sizeof(shadow[0]));
+            memcpy(screen + before_wrap * VGA_WIDTH, shadow[0], (count - before_wrap) * sizeof(shadow[0]));
+        } else {
+            memcpy(screen, shadow[start], count * sizeof(shadow[0]));
+        }
+        dirty_rows &= ~(((1u << count) - 1) << first);
+    }
+
+    if (cursor_dirty) {
+        // The software cursor can sit one past the last column or row until
+        // the next character wraps or scrolls
+        int row = cursor_row < VGA_HEIGHT ? cursor_row : VGA_HEIGHT - 1;
+        int col = cursor_col < VGA_WIDTH ? cursor_col : VGA_WIDTH - 1;
+        uint16_t pos = (uint16_t)(row * VGA_WIDTH + col);
+        outb(VGA_CRTC_INDEX, VGA_CURSOR_LOW);
+        outb(VGA_CRTC_DATA, pos & 0xFF);
+        outb(VGA_CRTC_INDEX, VGA_CURSOR_HIGH);
+        outb(VGA_CRTC_DATA, pos >> 8);
+        cursor_dirty = 0;
+    }
+}
+
+static void flush_expired(void* arg) {
+    (void)arg;
+    flush_timer = 0;
+    vga_flush_locked();
+}
+
+// Push changes out with the next frame. Until the timer wheel is running
+// (or if it is out of timers) they are written through right away.
+static void vga_schedule_flush(void) {
+    if (flush_timer) {
+        return;
+    }
+    flush_timer = timer_add(VGA_FLUSH_PERIOD_NS, flush_expired, 0);
+    if (!flush_timer) {
+        vga_flush_locked();
+    }
+}
+
+void vga_flush(void) {
+    uint32_t flags = irq_save();
+    vga_flush_locked();
+    irq_restore(flags);
+}
 
 void vga_set_cursor_pos(int row, int col) {
+    uint32_t flags = irq_save();
     cursor_row = row;
     cursor_col = col;
-    // Code to update hardware cursor could go here if desired (via outb to 0x3D4/0x3D5)
-    // For now, we manage it purely in software for printing.
+    cursor_dirty = 1;
+    vga_schedule_flush();
+    irq_restore(flags);
 }
 
 void vga_get_cursor_pos(int* row, int* col) {
@@ -18,24 +112,19 @@ void vga_get_cursor_pos(int* row, int* col) {
     *col = cursor_col;
 }
 
-void vga_scroll() {
-    // Shift all lines up by one
-    for (int r = 0; r < VGA_HEIGHT - 1; ++r) {
-        for (int c = 0; c < VGA_WIDTH; ++c) {
-            video_memory[r * VGA_WIDTH + c] = video_memory[(r + 1) * VGA_WIDTH + c];
-        }
-    }
-    // Clear the last line
-    char space_attr = (video_memory[(VGA_HEIGHT-2)*VGA_WIDTH] >> 8); // Use attribute of line above
+static void vga_scroll() {
+    // The old top row comes back round as the new bottom row
+    top_row = top_row + 1 < VGA_HEIGHT ? top_row + 1 : 0;
+    char space_attr = (shadow_row(VGA_HEIGHT - 2)[0] >> 8); // Use attribute of line above
     if (space_attr == 0) space_attr = 0x07; // Default if screen was blank
-    for (int c = 0; c < VGA_WIDTH; ++c) {
-        video_memory[(VGA_HEIGHT - 1) * VGA_WIDTH + c] = (space_attr << 8) | ' ';
-    }
+    memset16(shadow_row(VGA_HEIGHT - 1), (uint8_t)space_attr << 8 | ' ', VGA_WIDTH);
+    dirty_rows = VGA_ALL_ROWS; // Every row moved on screen
     cursor_row = VGA_HEIGHT - 1;
     cursor_col = 0;
 }
 
-void vga_print_char(char character, char attribute) {
+static void vga_put_char(char character, char attribute) {
+    cursor_dirty = 1;
     if (character == '\n') {
         cursor_col = 0;
         cursor_row++;
@@ -49,15 +138,37 @@ void vga_print_char(char character, char attribute) {
         if (cursor_row >= VGA_HEIGHT) {
             vga_scroll();
         }
-        video_memory[cursor_row * VGA_WIDTH + cursor_col] = (attribute << 8) | character;
+        shadow_row(cursor_row)[cursor_col] = (uint8_t)attribute << 8 | (uint8_t)character;
+        dirty_rows |= 1u << cursor_row;
         cursor_col++;
     }
 }
 
+void vga_print_char(char character, char attribute) {
+    uint32_t flags = irq_save();
+    vga_put_char(character, attribute);
+    vga_schedule_flush();
+    irq_restore(flags);
+}
+
 void vga_print_string(const char* str, char attribute) {
+    uint32_t flags = irq_save();
     while (*str) {
-        vga_print_char(*str++, attribute);
+        vga_put_char(*str++, attribute);
+    }
+    vga_schedule_flush();
+    irq_restore(flags);
+}
+
+void vga_put_char_at(int row, int col, char character, char attribute) {
+    if (row < 0 || row >= VGA_HEIGHT || col < 0 || col >= VGA_WIDTH) {
+        return;
     }
+    uint32_t flags = irq_save();
+    shadow_row(row)[col] = (uint8_t)attribute << 8 | (uint8_t)character;
+    dirty_rows |= 1u << row;
+    vga_schedule_flush();
+    irq_restore(flags);
 }
 
 void vga_print_hex(unsigned int n, char attribute) {
@@ -90,8 +201,74 @@ void vga_print_dec(unsigned int n, char attribute) {
 }
 
 void vga_clear_screen(char attribute) {
-    for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; ++i) {
-        video_memory[i] = (attribute << 8) | ' ';
+    uint32_t flags = irq_save();
+    memset16(shadow, (uint8_t)attribute << 8 | ' ', VGA_WIDTH * VGA_HEIGHT);
+    top_row = 0;
+    dirty_rows = VGA_ALL_ROWS;
+    cursor_row = 0;
+    cursor_col = 0;
+    cursor_dirty = 1;
+    vga_schedule_flush();
+    irq_restore(flags);
+}
+
+#ifdef CONFIG_BENCH
+#define BENCH_LINES 2000
+
+static const char bench_line[] = "vga bench: scrolling a long log through the text console 0123456789\n";
+
+// The console as it was before the shadow buffer: every cell written
+// straight to video memory and the whole screen moved on each new line
+static void bench_direct_print(const char* str, int* row, int* col) {
+    for (; *str; str++) {
+        if (*str == '\n') {
+            *col = 0;
+            if (++*row < VGA_HEIGHT) {
+                continue;
+            }
+            for (int r = 0; r < VGA_HEIGHT - 1; ++r) {
+                for (int c = 0; c < VGA_WIDTH; ++c) {
+                    video_memory[r * VGA_WIDTH + c] = video_memory[(r + 1) * VGA_WIDTH + c];
+                }
+            }
+            for (int c = 0; c < VGA_WIDTH; ++c) {
+                video_memory[(VGA_HEIGHT - 1) * VGA_WIDTH + c] = 0x0700 | ' ';
+            }
+            *row = VGA_HEIGHT - 1;
+        } else {
+            video_memory[*row * VGA_WIDTH + *col] = 0x0700 | (uint8_t)*str;
+            ++*col;
+        }
     }
-    vga_set_cursor_pos(0, 0);
-}
\ No newline at end of file
+}
+
+static uint32_t bench_lines_per_sec(uint64_t cycles) {
+    uint64_t per_sec = (uint64_t)BENCH_LINES * clock_tsc_khz() * 1000;
+    return (uint32_t)div_u64_u32(per_sec, (uint32_t)cycles ? (uint32_t)cycles : 1);
+}
+
+void vga_bench(void) {
+    // Other output may still be flushed over the direct run; that only
+    // changes what is on screen, not the work being timed
+    vga_flush();
+    int row = 0, col = 0;
+    uint64_t t0 = rdtsc();
+    for (uint32_t i = 0; i < BENCH_LINES; i++) {
+        bench_direct_print(bench_line, &row, &col);
+    }
+    uint64_t direct = rdtsc() - t0;
+
+    t0 = rdtsc();
+    for (uint32_t i = 0; i < BENCH_LINES; i++) {
+        vga_print_string(bench_line, 0x07);
+    }
+    vga_flush();
+    uint64_t buffered = rdtsc() - t0;
+
+    vga_clear_screen(0x07);
+    klog(KLOG_INFO, "vga bench: %u lines, direct %u lines/s, shadow buffer %u lines/s\n",
+         BENCH_LINES, bench_lines_per_sec(direct), bench_lines_per_sec(buffered));
+    bench_report("vga.scroll_line_direct", 0, BENCH_LINES, direct);
+    bench_report("vga.scroll_line", 0, BENCH_LINES, buffered);
+}
+#endif
@@ -3,12 +3,20 @@
 
 #include <stddef.h> // For size_t, though not strictly used yet
 
+// Output is drawn into a shadow buffer and reaches the screen (and the
+// hardware cursor) at most once per frame, or on vga_flush()
 void vga_set_cursor_pos(int row, int col);
 void vga_get_cursor_pos(int* row, int* col);
 void vga_print_char(char character, char attribute); // Prints at current cursor, advances cursor
 void vga_print_string(const char* str, char attribute);
+void vga_put_char_at(int row, int col, char character, char attribute); // Leaves the cursor alone
 void vga_print_hex(unsigned int n, char attribute);
 void vga_print_dec(unsigned int n, char attribute);
 void vga_clear_screen(char attribute);
+void vga_flush(void); // Copy pending changes to video memory now
 
-#endif // VGA_TEXT_H
\ No newline at end of file
+#ifdef CONFIG_BENCH
+void vga_bench(void); // Lines per second scrolling a long log, direct vs shadowed
+#endif
+
+#endif // VGA_TEXT_H
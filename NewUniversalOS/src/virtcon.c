@@ -0,0 +1,174 @@
+#include "virtcon.h"
+#include "virtio.h"
+#include "spinlock.h"
+#include "ports.h"
+#include "klib.h"
+#include "klog.h"
+
+#define VIRTCON_QUEUE_TX 1 // Port 0 transmitq (queue 0 is its receiveq)
+
+static const pci_id_t virtcon_ids[] = {
+    { VIRTIO_VENDOR, VIRTCON_DEVICE },
+    { PCI_ID_END, PCI_ID_END },
+};
+
+static virtqueue_t txq;
+static char* tx_buf[VIRTCON_TX_BUFS]; // Indexed by descriptor
+static int ready = 0;
+static spinlock_t tx_lock = SPINLOCK_INIT;
+
+static void reclaim(void) {
+    while (virtqueue_reclaim(&txq, 0) >= 0) {
+    }
+}
+
+static int virtcon_probe(pci_device_t* dev) {
+    const pci_bar_t* bar = &dev->bar[0];
+    if (!bar->is_io || !bar->size) {
+        return -1;
+    }
+    uint16_t io = (uint16_t)bar->base;
+    pci_enable(dev, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+    virtio_begin(io);
+    if (virtqueue_init(&txq, io, VIRTCON_QUEUE_TX) != 0) {
+        outb(io + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+    // Only descriptors 0..VIRTCON_TX_BUFS-1 ever leave the free list (it is
+    // LIFO and starts at 0), so the descriptor doubles as the buffer index
+    if (txq.num_free > VIRTCON_TX_BUFS) {
+        txq.num_free = VIRTCON_TX_BUFS;
+    }
+    for (uint32_t i = 0; i < txq.num_free; i++) {
+        tx_buf[i] = (char*)alloc_pages(0);
+        if (!tx_buf[i]) {
+            txq.num_free = i;
+            break;
+        }
+    }
+    if (txq.num_free == 0) {
+        outb(io + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+    txq.avail->flags = VRING_AVAIL_F_NO_INTERRUPT; // We poll the used ring
+    virtio_finish(io, 0); // No multiport: port 0 is the console
+    ready = 1;
+    klog_set_sink(virtcon_write);
+    klog(KLOG_INFO, "virtcon: io 0x%x, %u of %u descriptors, %u KB buffered\n",
+         io, txq.num_free, txq.size, txq.num_free * PAGE_SIZE / 1024);
+    return 0;
+}
+
+const pci_driver_t virtcon_driver = { "virtio-console", virtcon_ids, virtcon_probe };
+
+int virtcon_ready(void) {
+    return ready;
+}
+
+void virtcon_write(const char* buf, uint32_t len) {
+    if (!ready) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&tx_lock);
+    int posted = 0;
+    while (len) {
+        reclaim();
+        if (txq.num_free == 0) {
+            if (posted) {
+                virtqueue_kick(&txq); // The device may be waiting for us
+                posted = 0;
+            }
+            cpu_relax();
+            continue;
+        }
+        uint32_t n = len < PAGE_SIZE ? len : PAGE_SIZE;
+        uint16_t d = txq.free_head; // What virtqueue_add is about to hand out
+        memcpy(tx_buf[d], buf, n);
+        virtqueue_add(&txq, (phys_addr_t)tx_buf[d], n, 0);
+        posted = 1;
+        buf += n;
+        len -= n;
+    }
+    if (posted) {
+        virtqueue_kick(&txq);
+    }
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+void virtcon_flush(void) {
+    if (!ready) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&tx_lock);
+    reclaim();
+    while (txq.avail_idx != txq.last_used) {
+        cpu_relax();
+        reclaim();
+    }
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+#ifdef CONFIG_BENCH
+#include "bench.h"
+#include "serial.h"
+
+#define VIRTCON_BENCH_BYTES (1024 * 1024)
+#define SERIAL_BENCH_BYTES  (64 * 1024) // At 115200 baud this alone is ~6 s on real hardware
+
+static const char bench_line[] = "virtcon bench: filler text to time the transmit path 0123456789\n";
+
+void virtcon_bench(void) {
+    const uint32_t len = sizeof(bench_line) - 1;
+
+    serial_flush();
+    uint32_t sent = 0;
+    uint64_t t0 = rdtsc();
+    while (sent < SERIAL_BENCH_BYTES) {
+        serial_print_string(bench_line);
+        sent += len;
+    }
+    serial_flush();
+    uint64_t serial_cycles = rdtsc() - t0;
+    bench_report("serial.print_string_byte", 0, sent, serial_cycles);
+    klog(KLOG_INFO, "virtcon bench: serial %u KB/s\n", bench_kb_per_sec(sent, serial_cycles));
+
+    if (!ready) {
+        klog(KLOG_INFO, "virtcon bench: no virtio-console, skipped\n");
+        return;
+    }
+
+    // Line at a time, as the klog mirror writes
+    virtcon_flush();
+    sent = 0;
+    t0 = rdtsc();
+    while (sent < VIRTCON_BENCH_BYTES) {
+        virtcon_write(bench_line, len);
+        sent += len;
+    }
+    virtcon_flush();
+    uint64_t line_cycles = rdtsc() - t0;
+    uint32_t line_sent = sent;
+    bench_report("virtio.line_byte", 0, sent, line_cycles);
+
+    // Whole buffers
+    char* block = (char*)alloc_pages(0);
+    if (!block) {
+        return;
+    }
+    for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+        block[i] = bench_line[i % len];
+    }
+    sent = 0;
+    t0 = rdtsc();
+    while (sent < VIRTCON_BENCH_BYTES) {
+        virtcon_write(block, PAGE_SIZE);
+        sent += PAGE_SIZE;
+    }
+    virtcon_flush();
+    uint64_t bulk_cycles = rdtsc() - t0;
+    free_pages((phys_addr_t)block, 0);
+    bench_report("virtio.tx_byte", 0, sent, bulk_cycles);
+    klog(KLOG_INFO, "virtcon bench: virtio %u KB/s by line, %u KB/s in 4 KB writes\n",
+         bench_kb_per_sec(line_sent, line_cycles), bench_kb_per_sec(sent, bulk_cycles));
+}
+#endif
@@ -0,0 +1,30 @@
+#ifndef VIRTCON_H
+#define VIRTCON_H
+
+#include <stdint.h>
+#include "pci.h"
+
+// virtio-console output channel. Once bound it mirrors every drained klog
+// line, so logs and BENCH results reach the host at memory speed rather
+// than at 115200 baud (see QEMU_VIRTIO in the Makefile). Transmit only, on
+// port 0; completions are polled, the device never interrupts.
+
+#define VIRTCON_DEVICE  0x1003 // Legacy (transitional) virtio-console
+#define VIRTCON_TX_BUFS 32     // 4 KB transmit buffers in flight at most
+
+extern const pci_driver_t virtcon_driver;
+
+int virtcon_ready(void);
+
+// Queue len bytes for the host and return once they are all posted. Spins
+// while every transmit buffer is in flight; safe with interrupts off.
+void virtcon_write(const char* buf, uint32_t len);
+
+// Wait until the device has consumed everything posted so far
+void virtcon_flush(void);
+
+#ifdef CONFIG_BENCH
+void virtcon_bench(void); // Bulk throughput against serial_print_string
+#endif
+
+#endif // VIRTCON_H
@@ -0,0 +1,107 @@
+#include "virtio.h"
+#include "ports.h"
+#include "klib.h"
+
+// Descriptor table, then the avail ring (with its trailing used_event),
+// then on the next VRING_ALIGN boundary the used ring (with avail_event)
+static uint32_t vring_used_offset(uint32_t size) {
+    uint32_t head = size * sizeof(vring_desc_t) + sizeof(vring_avail_t) + (size + 1) * sizeof(uint16_t);
+    return (head + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1);
+}
+
+static uint32_t vring_bytes(uint32_t size) {
+    return vring_used_offset(size) + sizeof(vring_used_t) + size * sizeof(vring_used_elem_t) + sizeof(uint16_t);
+}
+
+void virtio_begin(uint16_t io_base) {
+    outb(io_base + VIRTIO_REG_STATUS, 0); // Reset
+    outb(io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK);
+    outb(io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+}
+
+uint32_t virtio_device_features(uint16_t io_base) {
+    return inl(io_base + VIRTIO_REG_DEVICE_FEATURES);
+}
+
+void virtio_finish(uint16_t io_base, uint32_t features) {
+    outl(io_base + VIRTIO_REG_GUEST_FEATURES, features);
+    outb(io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+}
+
+int virtqueue_init(virtqueue_t* vq, uint16_t io_base, uint16_t index) {
+    outw(io_base + VIRTIO_REG_QUEUE_SELECT, index);
+    uint16_t size = inw(io_base + VIRTIO_REG_QUEUE_SIZE);
+    if (size == 0 || (size & (size - 1))) {
+        return -1;
+    }
+
+    uint32_t bytes = vring_bytes(size);
+    uint32_t order = 0;
+    while ((PAGE_SIZE << order) < bytes) {
+        order++;
+    }
+    phys_addr_t ring = alloc_pages(order); // Identity-mapped, so it is also its own address
+    if (!ring) {
+        return -1;
+    }
+    memset((void*)ring, 0, PAGE_SIZE << order);
+
+    *vq = (virtqueue_t){ 0 };
+    vq->io_base = io_base;
+    vq->index = index;
+    vq->size = size;
+    vq->num_free = size;
+    vq->ring_phys = ring;
+    vq->ring_order = order;
+    vq->desc = (vring_desc_t*)ring;
+    vq->avail = (vring_avail_t*)(ring + size * sizeof(vring_desc_t));
+    vq->used = (volatile vring_used_t*)(ring + vring_used_offset(size));
+    for (uint16_t i = 0; i < size; i++) {
+        vq->desc[i].next = i + 1;
+    }
+
+    outl(io_base + VIRTIO_REG_QUEUE_PFN, ring >> PAGE_SHIFT);
+    return 0;
+}
+
+int virtqueue_add(virtqueue_t* vq, phys_addr_t buf, uint32_t len, uint16_t flags) {
+    if (vq->num_free == 0) {
+        return -1;
+    }
+    uint16_t d = vq->free_head;
+    vq->free_head = vq->desc[d].next;
+    vq->num_free--;
+
+    vq->desc[d].addr = buf;
+    vq->desc[d].len = len;
+    vq->desc[d].flags = flags & VRING_DESC_F_WRITE; // Single-buffer chains only
+    vq->avail->ring[vq->avail_idx & (vq->size - 1)] = d;
+    vq->avail_idx++;
+    return d;
+}
+
+void virtqueue_kick(virtqueue_t* vq) {
+    // The ring entries must be visible before the index that publishes them
+    __atomic_store_n(&vq->avail->idx, vq->avail_idx, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // And the index before we read the suppression flag
+    if (!(vq->used->flags & VRING_USED_F_NO_NOTIFY)) {
+        outw(vq->io_base + VIRTIO_REG_QUEUE_NOTIFY, vq->index);
+    }
+}
+
+int virtqueue_reclaim(virtqueue_t* vq, uint32_t* written) {
+    if (__atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE) == vq->last_used) {
+        return -1;
+    }
+    volatile vring_used_elem_t* e = &vq->used->ring[vq->last_used & (vq->size - 1)];
+    uint16_t d = (uint16_t)e->id;
+    if (written) {
+        *written = e->len;
+    }
+    vq->last_used++;
+
+    vq->desc[d].next = vq->free_head;
+    vq->free_head = d;
+    vq->num_free++;
+    return d;
+}
@@ -0,0 +1,97 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+#include "pci.h"
+#include "pmm.h" // For phys_addr_t
+
+// Legacy (0.9.5) virtio-pci transport: the device registers sit in I/O BAR0
+// and each queue is a split virtqueue in one physically contiguous block
+// whose page number is handed to the device.
+
+#define VIRTIO_VENDOR 0x1AF4
+
+// Register offsets in BAR0
+#define VIRTIO_REG_DEVICE_FEATURES 0x00
+#define VIRTIO_REG_GUEST_FEATURES  0x04
+#define VIRTIO_REG_QUEUE_PFN       0x08
+#define VIRTIO_REG_QUEUE_SIZE      0x0C
+#define VIRTIO_REG_QUEUE_SELECT    0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY    0x10
+#define VIRTIO_REG_STATUS          0x12
+#define VIRTIO_REG_ISR             0x13
+#define VIRTIO_REG_CONFIG          0x14 // Device-specific configuration (no MSI-X)
+
+#define VIRTIO_STATUS_ACK       0x01
+#define VIRTIO_STATUS_DRIVER    0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED    0x80
+
+#define VRING_DESC_F_NEXT          0x1
+#define VRING_DESC_F_WRITE         0x2 // Device writes the buffer (receive)
+#define VRING_AVAIL_F_NO_INTERRUPT 0x1 // Driver to device: do not interrupt on completion
+#define VRING_USED_F_NO_NOTIFY     0x1 // Device to driver: no need to kick
+
+#define VRING_ALIGN 4096 // The used ring starts on its own page
+
+typedef struct {
+    uint64_t addr;  // Physical address
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} vring_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} vring_avail_t;
+
+typedef struct {
+    uint32_t id;    // Head descriptor of the finished chain
+    uint32_t len;   // Bytes the device wrote
+} vring_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem_t ring[];
+} vring_used_t;
+
+typedef struct {
+    uint16_t io_base;
+    uint16_t index;       // Queue number on the device
+    uint16_t size;        // Descriptors, a power of two set by the device
+    uint16_t free_head;   // Free descriptors are chained through next
+    uint16_t num_free;
+    uint16_t avail_idx;   // Our copy of avail->idx
+    uint16_t last_used;   // used->idx up to which we have reclaimed
+    uint16_t reserved;
+    vring_desc_t* desc;
+    vring_avail_t* avail;
+    volatile vring_used_t* used;
+    phys_addr_t ring_phys;
+    uint32_t ring_order;  // alloc_pages order of the ring block
+} virtqueue_t;
+
+// Reset the device, then acknowledge it and say we have a driver for it
+void virtio_begin(uint16_t io_base);
+// Accept features (a subset of the device's) and mark the driver ready
+void virtio_finish(uint16_t io_base, uint32_t features);
+uint32_t virtio_device_features(uint16_t io_base);
+
+// Allocate queue index and tell the device where it is. Returns 0 on success,
+// -1 if the queue does not exist or memory ran out.
+int virtqueue_init(virtqueue_t* vq, uint16_t io_base, uint16_t index);
+
+// Post one device-readable (or, with VRING_DESC_F_WRITE, device-writable)
+// buffer. Returns its descriptor, or -1 if the queue is full. The device is
+// not told until virtqueue_kick.
+int virtqueue_add(virtqueue_t* vq, phys_addr_t buf, uint32_t len, uint16_t flags);
+void virtqueue_kick(virtqueue_t* vq);
+
+// Take back one finished buffer. Returns its descriptor (as returned by
+// virtqueue_add) or -1 if the device has finished nothing new.
+int virtqueue_reclaim(virtqueue_t* vq, uint32_t* written);
+
+#endif // VIRTIO_H
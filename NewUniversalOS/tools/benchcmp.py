@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Compare benchmark results from a BENCH=1 serial capture against a baseline.
+
+    benchcmp.py [--threshold PCT] baseline.txt serial.out
+    benchcmp.py --update baseline.txt serial.out
+
+The kernel logs one line per result (see src/bench.h):
+    BENCH <name>[/<param>] <cycles per op> cycles/op
+followed by a BENCH-END line once every benchmark has run. The baseline
+holds one "<name> <cycles per op> [threshold %]" per line; # starts a
+comment and a cycle count of - sets a threshold before there is a result.
+A result fails when it is more than its threshold (default --threshold)
+slower than the baseline. Results missing from the capture fail too;
+results missing from the baseline are listed as new and counted in a
+warning. Until the baseline holds at least one cycle count there is nothing
+to compare against: the results are listed, a warning says so and the
+comparison passes. --update rewrites the baseline from the capture, keeping
+per-result thresholds.
+"""
+import argparse
+import re
+import sys
+
+RESULT = re.compile(r"BENCH (\S+) (\d+\.\d+) cycles/op")
+END = re.compile(r"BENCH-END (\d+) results")
+
+
+def read_results(path):
+    """Return ({name: cycles per op}, finished) from a serial capture."""
+    results = {}
+    finished = False
+    with open(path, "rb") as f:
+        for line in f.read().decode("ascii", errors="replace").splitlines():
+            m = RESULT.search(line)
+            if m:
+                results[m.group(1)] = float(m.group(2))
+            elif END.search(line):
+                finished = True
+    return results, finished
+
+
+def read_baseline(path):
+    """Return {name: (cycles per op or None, threshold or None)}, in file order."""
+    baseline = {}
+    try:
+        with open(path) as f:
+            for line in f:
+                fields = line.split("#", 1)[0].split()
+                if not fields:
+                    continue
+                threshold = float(fields[2]) if len(fields) > 2 else None
+                base = None if fields[1] == "-" else float(fields[1])
+                baseline[fields[0]] = (base, threshold)
+    except FileNotFoundError:
+        pass
+    return baseline
+
+
+def update(baseline_path, results):
+    old = read_baseline(baseline_path)
+    with open(baseline_path, "w") as f:
+        f.write("# Benchmark baseline for make bench: <name> <cycles/op> [threshold %]\n")
+        f.write("# Regenerate with make bench-baseline on the reference machine.\n")
+        for name in sorted(results):
+            threshold = old.get(name, (None, None))[1]
+            if threshold is None:
+                f.write("%s %.2f\n" % (name, results[name]))
+            else:
+                f.write("%s %.2f %g\n" % (name, results[name], threshold))
+    print("%s: %d results" % (baseline_path, len(results)))
+
+
+def compare(baseline, results, default_threshold):
+    failures = 0
+    for name, (base, threshold) in baseline.items():
+        if base is None:
+            continue
+        if threshold is None:
+            threshold = default_threshold
+        if name not in results:
+            print("MISSING  %-32s baseline %10.2f" % (name, base))
+            failures += 1
+            continue
+        now = results[name]
+        change = (now - base) * 100.0 / base if base else 0.0
+        status = "ok"
+        if change > threshold:
+            status = "SLOWER"
+            failures += 1
+        print("%-8s %-32s %10.2f -> %10.2f cycles/op %+7.1f%%" % (status, name, base, now, change))
+    new = sorted(n for n in results if baseline.get(n, (None,))[0] is None)
+    for name in new:
+        print("new      %-32s            %10.2f cycles/op" % (name, results[name]))
+    if new:
+        print("warning: %d result(s) have no baseline and were not checked" % len(new), file=sys.stderr)
+    return failures
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="allowed slowdown in percent (default 10)")
+    parser.add_argument("--update", action="store_true",
+                        help="write the capture's results to the baseline")
+    parser.add_argument("baseline")
+    parser.add_argument("capture")
+    args = parser.parse_args(argv[1:])
+
+    results, finished = read_results(args.capture)
+    if not finished:
+        print("%s: the benchmark run did not finish" % args.capture, file=sys.stderr)
+        return 1
+    if args.update:
+        update(args.baseline, results)
+        return 0
+    baseline = read_baseline(args.baseline)
+    failures = compare(baseline, results, args.threshold)
+    if not any(base is not None for base, _ in baseline.values()):
+        print("warning: %s has no cycle counts, so nothing was compared; run "
+              "make bench-baseline on the reference machine and check it in" % args.baseline,
+              file=sys.stderr)
+    if failures:
+        print("%d benchmark(s) regressed or missing" % failures, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
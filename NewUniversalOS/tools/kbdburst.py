@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""Type a burst of keys into the kernel under QEMU and check none were lost.
+
+    kbdburst.py [--qemu qemu-system-i386] [--keys N] [--hold-ms MS] os.img
+
+QEMU runs headless with the serial port on a pipe and the monitor on a
+Unix socket. Once the kernel is up, the script sends a random string
+through the monitor's sendkey command as fast as the monitor accepts it,
+then asks the kernel for its keyboard counters with the 'k' debug
+command (see keyboard_report() in src/kernel.c). It passes if every
+scancode reached the decoder, no event was dropped, and the characters
+decoded hash to the same value as the text that was typed.
+"""
+import argparse
+import os
+import random
+import re
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+FNV_PRIME = 16777619
+COUNTERS = re.compile(rb"kbd: (\d+) scancodes \((\d+) dropped\), (\d+) events \((\d+) dropped\)")
+TYPED = re.compile(rb"kbd: typed (\d+) chars, hash ([0-9a-f]{8})")
+
+# Characters to type and their sendkey names. Shifted ones cost four
+# scancodes (shift down, key down, key up, shift up), the rest two.
+PLAIN = {c: c for c in "abcdefghijklmnopqrstuvwxyz0123456789"}
+PLAIN.update({" ": "spc", "-": "minus", "=": "equal", ",": "comma",
+              ".": "dot", "/": "slash", ";": "semicolon"})
+SHIFTED = {c.upper(): "shift-" + c for c in "abcdefghijklmnopqrstuvwxyz"}
+SHIFTED.update({"!": "shift-1", "?": "shift-slash", ":": "shift-semicolon"})
+
+
+class Kernel:
+    def __init__(self, qemu, image, workdir):
+        self.monitor_path = os.path.join(workdir, "monitor.sock")
+        self.proc = subprocess.Popen(
+            [qemu, "-drive", "file=%s,format=raw" % image, "-display", "none",
+             "-serial", "stdio", "-monitor", "unix:%s,server=on,wait=off" % self.monitor_path],
+            stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        self.output = b""
+        self.lock = threading.Lock()
+        threading.Thread(target=self._reader, daemon=True).start()
+        self.monitor = None
+
+    def _reader(self):
+        while True:
+            data = self.proc.stdout.read1(4096)
+            if not data:
+                return
+            with self.lock:
+                self.output += data
+
+    def wait_for(self, pattern, start, timeout):
+        """Return the first match of pattern in the output after offset start."""
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            with self.lock:
+                m = pattern.search(self.output, start)
+            if m:
+                return m
+            time.sleep(0.05)
+        raise TimeoutError("no %r from the kernel" % pattern.pattern)
+
+    def offset(self):
+        with self.lock:
+            return len(self.output)
+
+    def connect_monitor(self, timeout):
+        deadline = time.time() + timeout
+        while True:
+            try:
+                self.monitor = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+                self.monitor.connect(self.monitor_path)
+                return
+            except OSError:
+                if time.time() > deadline:
+                    raise
+                time.sleep(0.1)
+
+    def sendkeys(self, names, hold_ms):
+        self.monitor.sendall("".join("sendkey %s %d\n" % (n, hold_ms) for n in names).encode())
+
+    def report(self, timeout):
+        start = self.offset()
+        self.proc.stdin.write(b"k")
+        self.proc.stdin.flush()
+        counters = self.wait_for(COUNTERS, start, timeout)
+        typed = self.wait_for(TYPED, start, timeout)
+        scancodes, sc_dropped, events, ev_dropped = (int(x) for x in counters.groups())
+        return {"scancodes": scancodes, "scancodes_dropped": sc_dropped,
+                "events": events, "events_dropped": ev_dropped,
+                "chars": int(typed.group(1)), "hash": int(typed.group(2), 16)}
+
+    def close(self):
+        self.proc.kill()
+        self.proc.wait()
+
+
+def fnv1a(h, text):
+    for c in text.encode():
+        h = ((h ^ c) * FNV_PRIME) & 0xFFFFFFFF
+    return h
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--qemu", default="qemu-system-i386")
+    parser.add_argument("--keys", type=int, default=2000, help="characters to type")
+    parser.add_argument("--hold-ms", type=int, default=1, help="sendkey hold time")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--timeout", type=float, default=60.0)
+    parser.add_argument("image")
+    args = parser.parse_args(argv[1:])
+
+    rng = random.Random(args.seed)
+    chars = list(PLAIN) * 3 + list(SHIFTED) # Mostly unshifted, like real text
+    text = "".join(rng.choice(chars) for _ in range(args.keys))
+    names = [PLAIN.get(c) or SHIFTED[c] for c in text]
+    scancodes = sum(4 if c in SHIFTED else 2 for c in text)
+
+    with tempfile.TemporaryDirectory() as workdir:
+        kernel = Kernel(args.qemu, args.image, workdir)
+        try:
+            kernel.wait_for(re.compile(rb"IRQ1 \(Keyboard\) Unmasked"), 0, args.timeout)
+            kernel.connect_monitor(args.timeout)
+            time.sleep(1.0) # Let the debug console thread start
+            before = kernel.report(args.timeout)
+
+            t0 = time.time()
+            kernel.sendkeys(names, args.hold_ms)
+            # Wait for the counters to reach the burst, or to stop moving
+            after = before
+            deadline = time.time() + args.timeout
+            while time.time() < deadline:
+                time.sleep(0.5)
+                now = kernel.report(args.timeout)
+                done = now["scancodes"] - before["scancodes"] >= scancodes
+                if done or (now == after and now != before):
+                    after = now
+                    break
+                after = now
+            elapsed = time.time() - t0
+        finally:
+            kernel.close()
+
+    got = {k: after[k] - before[k] for k in ("scancodes", "scancodes_dropped", "events", "events_dropped", "chars")}
+    expected_hash = fnv1a(before["hash"], text)
+    print("typed %d chars (%d scancodes) in %.1f s, %.0f scancodes/s" %
+          (len(text), scancodes, elapsed, got["scancodes"] / elapsed if elapsed else 0))
+    print("kernel: %(scancodes)d scancodes, %(scancodes_dropped)d dropped, "
+          "%(events)d events, %(events_dropped)d dropped, %(chars)d chars" % got)
+
+    failures = []
+    if got["scancodes"] != scancodes:
+        failures.append("expected %d scancodes, the kernel saw %d" % (scancodes, got["scancodes"]))
+    if got["scancodes_dropped"] or got["events_dropped"]:
+        failures.append("the kernel dropped input")
+    if got["events"] != scancodes:
+        failures.append("expected %d key events, got %d" % (scancodes, got["events"]))
+    if got["chars"] != len(text) or after["hash"] != expected_hash:
+        failures.append("decoded text differs from what was typed")
+    for f in failures:
+        print("FAIL: " + f, file=sys.stderr)
+    if not failures:
+        print("PASS")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""Stamp the image size into kernel.bin's header and pad it to whole sectors.
+
+    mkkernel.py kernel.bin              stamp kernel.bin in place
+    mkkernel.py --lz4 kernel.bin OUT    write an LZ4-compressed image of it to OUT
+
+The header layout is defined in src/entry.asm; boot.asm reads image_size to
+know how many sectors to load. A compressed image is a copy of the 64-byte
+header with HDR_FLAG_LZ4 set, followed by one LZ4 block holding the whole
+stamped kernel.bin. Stage 2 of boot.asm expands it to the load address.
+"""
+import struct
+import sys
+
+KERNEL_MAGIC = 0x4B534F55  # 'UOSK'
+HDR_SIZE = 64
+HDR_IMAGE_SIZE = 12
+HDR_FLAGS = 24
+HDR_PAYLOAD_SIZE = 28
+HDR_UNCOMPRESSED_SIZE = 32
+HDR_FLAG_LZ4 = 0x1
+SECTOR_SIZE = 512
+
+# LZ4 block format limits
+MIN_MATCH = 4
+LAST_LITERALS = 5   # The last 5 bytes are always literals
+MF_LIMIT = 12       # The last match must start at least 12 bytes before the end
+MAX_OFFSET = 0xFFFF
+
+
+def pad_sector(data):
+    return data + bytes(-len(data) % SECTOR_SIZE)
+
+
+def lz4_length(out, n):
+    """Emit the 255-run extension of a length whose nibble was saturated."""
+    n -= 15
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def lz4_compress(data):
+    """Greedy LZ4 block compressor (hash of every 4-byte sequence)."""
+    out = bytearray()
+    table = {}
+    end = len(data)
+    anchor = 0
+    i = 0
+    while i < end - MF_LIMIT:
+        key = data[i:i + MIN_MATCH]
+        cand = table.get(key)
+        table[key] = i
+        if cand is None or i - cand > MAX_OFFSET:
+            i += 1
+            continue
+
+        length = MIN_MATCH
+        max_length = end - LAST_LITERALS - i
+        while length < max_length and data[cand + length] == data[i + length]:
+            length += 1
+
+        literals = i - anchor
+        token = (min(literals, 15) << 4) | min(length - MIN_MATCH, 15)
+        out.append(token)
+        if literals >= 15:
+            lz4_length(out, literals)
+        out += data[anchor:i]
+        out += struct.pack("<H", i - cand)
+        if length - MIN_MATCH >= 15:
+            lz4_length(out, length - MIN_MATCH)
+
+        for j in range(i + 1, min(i + length, end - MF_LIMIT)):
+            table[data[j:j + MIN_MATCH]] = j
+        i += length
+        anchor = i
+
+    literals = end - anchor
+    out.append(min(literals, 15) << 4)
+    if literals >= 15:
+        lz4_length(out, literals)
+    out += data[anchor:]
+    return bytes(out)
+
+
+def lz4_decompress(src):
+    """Reference decoder, used to check the compressor output."""
+    out = bytearray()
+    i = 0
+    while i < len(src):
+        token = src[i]
+        i += 1
+        literals = token >> 4
+        if literals == 15:
+            while True:
+                b = src[i]
+                i += 1
+                literals += b
+                if b != 255:
+                    break
+        out += src[i:i + literals]
+        i += literals
+        if i >= len(src):
+            break
+        offset, = struct.unpack_from("<H", src, i)
+        i += 2
+        length = token & 15
+        if length == 15:
+            while True:
+                b = src[i]
+                i += 1
+                length += b
+                if b != 255:
+                    break
+        for _ in range(length + MIN_MATCH):
+            out.append(out[-offset])
+    return bytes(out)
+
+
+def main():
+    args = sys.argv[1:]
+    lz4_out = None
+    if len(args) == 3 and args[0] == "--lz4":
+        lz4_out = args[2]
+        args = args[1:2]
+    if len(args) != 1:
+        sys.exit("usage: mkkernel.py [--lz4] kernel.bin [OUT]")
+    path = args[0]
+    with open(path, "rb") as f:
+        image = bytearray(f.read())
+
+    magic, = struct.unpack_from("<I", image, 0)
+    if magic != KERNEL_MAGIC:
+        sys.exit("%s: bad kernel header magic 0x%08x" % (path, magic))
+
+    image = bytearray(pad_sector(bytes(image)))
+    struct.pack_into("<I", image, HDR_IMAGE_SIZE, len(image))
+    if lz4_out is None:
+        with open(path, "wb") as f:
+            f.write(image)
+        return
+
+    payload = lz4_compress(bytes(image))
+    if lz4_decompress(payload) != image:
+        sys.exit("%s: LZ4 round trip failed" % path)
+
+    header = bytearray(image[:HDR_SIZE])
+    flags, = struct.unpack_from("<I", header, HDR_FLAGS)
+    struct.pack_into("<I", header, HDR_FLAGS, flags | HDR_FLAG_LZ4)
+    struct.pack_into("<I", header, HDR_IMAGE_SIZE, HDR_SIZE + len(payload))
+    struct.pack_into("<I", header, HDR_PAYLOAD_SIZE, len(payload))
+    struct.pack_into("<I", header, HDR_UNCOMPRESSED_SIZE, len(image))
+    with open(lz4_out, "wb") as f:
+        f.write(pad_sector(bytes(header) + payload))
+    print("%s: %d -> %d bytes (LZ4)" % (lz4_out, len(image), len(payload)))
+
+
+if __name__ == "__main__":
+    main()
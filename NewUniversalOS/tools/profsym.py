@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""Decode a profiler dump captured from the serial port and symbolize it.
+
+    profsym.py kernel.elf serial.out             flat profile by function
+    profsym.py --addresses kernel.elf serial.out flat profile by address
+    profsym.py --collapsed kernel.elf serial.out collapsed stacks, one per
+                                                 line, for flamegraph.pl
+
+The capture may contain log text around the binary records written by
+prof_dump() in src/prof.c; the last complete dump in it is used. Symbols
+come from `nm` (override with NM=...), so the ELF must be the one that was
+booted, e.g. build/kernel.elf.
+"""
+import bisect
+import os
+import struct
+import subprocess
+import sys
+
+PROF_MAGIC = b"PRF1"
+REC_HEADER = 1
+REC_FLAT = 2
+REC_STACKS = 3
+REC_END = 4
+PROF_STACKS = 0x1
+
+
+def read_records(data):
+    """Yield (type, payload) for every intact record in the capture."""
+    pos = data.find(PROF_MAGIC)
+    while pos >= 0:
+        if pos + 8 <= len(data):
+            rtype, _, length = struct.unpack_from("<BBH", data, pos + 4)
+            end = pos + 8 + length + 2
+            if end <= len(data):
+                payload = data[pos + 8:pos + 8 + length]
+                (checksum,) = struct.unpack_from("<H", data, pos + 8 + length)
+                if sum(payload) & 0xFFFF == checksum:
+                    yield rtype, payload
+                    pos = data.find(PROF_MAGIC, end)
+                    continue
+        pos = data.find(PROF_MAGIC, pos + 1)
+
+
+def last_dump(data):
+    """Return (header, flat, stacks) of the last dump that ran to its end record."""
+    result = None
+    current = None
+    for rtype, payload in read_records(data):
+        if rtype == REC_HEADER:
+            hz, flags, samples, dropped, walk_errors = struct.unpack_from("<5I", payload)
+            current = ({"hz": hz, "flags": flags, "samples": samples,
+                        "dropped": dropped, "walk_errors": walk_errors}, {}, [])
+        elif current is None:
+            continue
+        elif rtype == REC_FLAT:
+            for eip, count in struct.iter_unpack("<II", payload):
+                current[1][eip] = current[1].get(eip, 0) + count
+        elif rtype == REC_STACKS:
+            off = 0
+            while off < len(payload):
+                count, depth = struct.unpack_from("<II", payload, off)
+                pcs = struct.unpack_from("<%dI" % depth, payload, off + 8)
+                current[2].append((count, pcs))
+                off += 8 + 4 * depth
+        elif rtype == REC_END:
+            result = current
+            current = None
+    return result
+
+
+class Symbols:
+    def __init__(self, elf):
+        nm = os.environ.get("NM", "nm")
+        out = subprocess.run([nm, "-n", "--defined-only", elf], check=True,
+                             capture_output=True, text=True).stdout
+        self.addrs = []
+        self.names = []
+        for line in out.splitlines():
+            parts = line.split()
+            if len(parts) == 3 and parts[1] in "tTwW":
+                self.addrs.append(int(parts[0], 16))
+                self.names.append(parts[2])
+
+    def lookup(self, addr, offset=False):
+        i = bisect.bisect_right(self.addrs, addr) - 1
+        if i < 0:
+            return "0x%08x" % addr
+        if offset:
+            return "%s+0x%x" % (self.names[i], addr - self.addrs[i])
+        return self.names[i]
+
+
+def main(argv):
+    opts = [a for a in argv if a.startswith("--")]
+    args = [a for a in argv if not a.startswith("--")]
+    if len(args) != 2 or not set(opts) <= {"--addresses", "--collapsed"}:
+        sys.exit(__doc__)
+    elf, capture = args
+    with open(capture, "rb") as f:
+        dump = last_dump(f.read())
+    if dump is None:
+        sys.exit("no complete profile dump in %s" % capture)
+    header, flat, stacks = dump
+    syms = Symbols(elf)
+
+    if "--collapsed" in opts:
+        if not header["flags"] & PROF_STACKS:
+            sys.exit("the dump has no call stacks (start the profiler with PROF_STACKS)")
+        collapsed = {}
+        for count, pcs in stacks:
+            # Stacks are recorded leaf first; flame graphs want the root first.
+            # Return addresses point after the call, so look up pc - 1.
+            frames = [syms.lookup(pcs[0])] + [syms.lookup(pc - 1) for pc in pcs[1:]]
+            key = ";".join(reversed(frames))
+            collapsed[key] = collapsed.get(key, 0) + count
+        for key, count in sorted(collapsed.items()):
+            print("%s %d" % (key, count))
+        return
+
+    by_name = {}
+    for eip, count in flat.items():
+        name = syms.lookup(eip, offset="--addresses" in opts)
+        by_name[name] = by_name.get(name, 0) + count
+    total = sum(by_name.values()) or 1
+    print("%d samples at %d Hz, %d dropped, %d stack walks cut short" %
+          (header["samples"], header["hz"], header["dropped"], header["walk_errors"]))
+    print("%8s %7s  %s" % ("samples", "%", "function"))
+    for name, count in sorted(by_name.items(), key=lambda kv: -kv[1]):
+        print("%8d %6.2f%%  %s" % (count, 100.0 * count / total, name))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+"""Convert an event trace captured from the serial port to Chrome trace JSON.
+
+    trace2json.py serial.out > trace.json
+
+The capture may contain log text around the binary records written by
+trace_dump() in src/trace.c ('t' on the debug console); the last complete
+dump in it is used. Load the output in chrome://tracing or Perfetto.
+Interrupt handlers show up as slices on each CPU's track, EOIs and thread
+switches as instants, and boot phases as slices on their own track. The
+per-vector latency histograms are printed to stderr.
+"""
+import json
+import struct
+import sys
+
+TRACE_MAGIC = b"TRC1"
+REC_HEADER = 1
+REC_NAMES = 2
+REC_EVENTS = 3
+REC_HIST = 4
+REC_END = 5
+
+IRQ_ENTRY = 1
+IRQ_EXIT = 2
+IRQ_EOI = 3
+SCHED_SWITCH = 4
+BOOT_PHASE = 5
+
+HIST_BUCKETS = 24
+BOOT_TID = 100
+VECTOR_NAMES = {
+    0: "#DE", 6: "#UD", 8: "#DF", 13: "#GP", 14: "#PF",
+    32: "IRQ0 timer", 33: "IRQ1 keyboard", 36: "IRQ4 COM1",
+}
+
+
+def read_records(data):
+    """Yield (type, payload) for every intact record in the capture."""
+    pos = data.find(TRACE_MAGIC)
+    while pos >= 0:
+        if pos + 8 <= len(data):
+            rtype, _, length = struct.unpack_from("<BBH", data, pos + 4)
+            end = pos + 8 + length + 2
+            if end <= len(data):
+                payload = data[pos + 8:pos + 8 + length]
+                (checksum,) = struct.unpack_from("<H", data, pos + 8 + length)
+                if sum(payload) & 0xFFFF == checksum:
+                    yield rtype, payload
+                    pos = data.find(TRACE_MAGIC, end)
+                    continue
+        pos = data.find(TRACE_MAGIC, pos + 1)
+
+
+def last_dump(data):
+    """Return the last dump that ran to its end record, as a dict."""
+    result = None
+    current = None
+    for rtype, payload in read_records(data):
+        if rtype == REC_HEADER:
+            khz, cpus, ring = struct.unpack_from("<3I", payload)
+            current = {"tsc_khz": khz, "cpus": cpus, "ring": ring,
+                       "names": {}, "events": [], "hist": {}}
+        elif current is None:
+            continue
+        elif rtype == REC_NAMES:
+            off = 0
+            while off < len(payload):
+                ident, length = struct.unpack_from("<HH", payload, off)
+                current["names"][ident] = payload[off + 4:off + 4 + length].decode(errors="replace")
+                off += 4 + length
+        elif rtype == REC_EVENTS:
+            current["events"].extend(struct.iter_unpack("<QHBBI", payload))
+        elif rtype == REC_HIST:
+            for fields in struct.iter_unpack("<%dI" % (1 + HIST_BUCKETS), payload):
+                current["hist"][fields[0]] = fields[1:]
+        elif rtype == REC_END:
+            result = current
+            current = None
+    return result
+
+
+def vector_name(vector):
+    return VECTOR_NAMES.get(vector, "vector %d" % vector)
+
+
+def to_chrome(dump):
+    khz = dump["tsc_khz"] or 1
+    events = sorted(dump["events"])
+    if not events:
+        return {"traceEvents": []}
+    t0 = events[0][0]
+
+    def us(tsc):
+        return (tsc - t0) * 1000.0 / khz
+
+    out = [{"name": "process_name", "ph": "M", "pid": 0, "args": {"name": "NewUniversalOS"}},
+           {"name": "thread_name", "ph": "M", "pid": 0, "tid": BOOT_TID, "args": {"name": "boot"}}]
+    depth = {}
+    phase = None
+    for tsc, ident, cpu, _, arg in events:
+        if cpu not in depth:
+            depth[cpu] = 0
+            out.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": cpu,
+                        "args": {"name": "cpu %d" % cpu}})
+        if ident == IRQ_ENTRY:
+            depth[cpu] += 1
+            out.append({"name": vector_name(arg), "cat": "irq", "ph": "B",
+                        "ts": us(tsc), "pid": 0, "tid": cpu})
+        elif ident == IRQ_EXIT:
+            if depth[cpu] == 0:
+                continue # Its entry was overwritten in the ring
+            depth[cpu] -= 1
+            out.append({"ph": "E", "ts": us(tsc), "pid": 0, "tid": cpu})
+        elif ident == IRQ_EOI:
+            out.append({"name": "EOI %d" % arg, "cat": "irq", "ph": "i", "s": "t",
+                        "ts": us(tsc), "pid": 0, "tid": cpu})
+        elif ident == SCHED_SWITCH:
+            out.append({"name": "switch", "cat": "sched", "ph": "i", "s": "t",
+                        "ts": us(tsc), "pid": 0, "tid": cpu, "args": {"thread": arg}})
+        elif ident == BOOT_PHASE:
+            if phase:
+                phase["dur"] = us(tsc) - phase["ts"]
+                out.append(phase)
+            phase = {"name": dump["names"].get(arg, "name %d" % arg), "cat": "boot",
+                     "ph": "X", "ts": us(tsc), "pid": 0, "tid": BOOT_TID}
+    if phase:
+        phase["dur"] = 0 # The last phase runs until shutdown
+        out.append(phase)
+    return {"traceEvents": out, "displayTimeUnit": "ns",
+            "otherData": {"tsc_khz": dump["tsc_khz"], "events": len(events)}}
+
+
+def print_hist(dump, f):
+    khz = dump["tsc_khz"] or 1
+    for vector in sorted(dump["hist"]):
+        counts = dump["hist"][vector]
+        total = sum(counts)
+        print("%s: %d entries" % (vector_name(vector), total), file=f)
+        for bucket, count in enumerate(counts):
+            if count:
+                bound = 2 << bucket
+                print("  < %9d cycles (%8.2f us) %8d" % (bound, bound * 1000.0 / khz, count), file=f)
+
+
+def main(argv):
+    if len(argv) != 2:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+    with open(argv[1], "rb") as f:
+        dump = last_dump(f.read())
+    if dump is None:
+        print("no complete trace dump in %s" % argv[1], file=sys.stderr)
+        return 1
+    json.dump(to_chrome(dump), sys.stdout)
+    sys.stdout.write("\n")
+    print_hist(dump, sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))